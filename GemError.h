@@ -18,6 +18,7 @@ unsigned char Error_gem[] =
 "class IllegalArgumentError :: Error{}\n"
 "class LookUpError :: Error{}\n"
 "class FormatError :: Error{}\n"
+"class MemoryError :: Error{}\n"
 "\n";
 
 unsigned int Error_gem_len = sizeof(Error_gem) - 1;
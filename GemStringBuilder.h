@@ -0,0 +1,25 @@
+unsigned char StringBuilder_gem[] =
+"class StringBuilder{\n"
+"    init(){\n"
+"        this.parts = [];\n"
+"    }\n"
+"    append(value){\n"
+"        this.parts.append(value);\n"
+"        return this;\n"
+"    }\n"
+"    toString(){\n"
+"        var text = this.parts.join(\"\");\n"
+"        this.parts = [text];\n"
+"        return text;\n"
+"    }\n"
+"    length(){\n"
+"        return this.toString().length();\n"
+"    }\n"
+"    clear(){\n"
+"        this.parts = [];\n"
+"        return this;\n"
+"    }\n"
+"}\n"
+;
+
+unsigned int StringBuilder_gem_len = sizeof(StringBuilder_gem) - 1;
@@ -2,129 +2,109 @@
 
 #include "value.h"
 #include "object.h"
+#include "vm.h"
 #include <stdbool.h>
 
-#define CHECK_NUM_ARGS(fn, n)
+// Math statics take and return plain numbers. The VM checks and unboxes
+// the arguments from the descriptors at the bottom of this file.
 
-#define CHECK_ARG_TYPE(fn, index, predicate)
-
-
-static Value math_abs(Thread* ctx, int argCount, Value* args) {
-  CHECK_NUM_ARGS("abs", 1);
-  CHECK_ARG_TYPE("abs", 0, IS_NUMBER);
-  return NUMBER_VAL(fabs(AS_NUMBER(args[0])));
+static double math_abs(double* args) {
+    return fabs(args[0]);
 }
-#include <stdio.h>
-static Value math_min(Thread* ctx, int argCount, Value* args) {
-    CHECK_NUM_ARGS("min", 2);
-    CHECK_ARG_TYPE("min", 0, IS_NUMBER);
-    CHECK_ARG_TYPE("min", 1, IS_NUMBER);
-    Value a = args[0];
-    Value b = args[1];
-    if (AS_NUMBER(a) < AS_NUMBER(b))
-        return a;
-    return b;
+
+static double math_min(double* args) {
+    return args[0] < args[1] ? args[0] : args[1];
 }
 
-static Value math_max(Thread* ctx, int argCount, Value* args) {
-    CHECK_NUM_ARGS("max", 2);
-    CHECK_ARG_TYPE("max", 0, IS_NUMBER);
-    CHECK_ARG_TYPE("max", 1, IS_NUMBER);
-    return NUMBER_VAL(fmax(AS_NUMBER(args[0]), AS_NUMBER(args[1])));
+static double math_max(double* args) {
+    return fmax(args[0], args[1]);
 }
 
-static Value math_clamp(Thread* ctx, int argCount, Value* args) {
-    CHECK_NUM_ARGS("clamp", 3);
-    double x = AS_NUMBER(args[0]);
-    double a = AS_NUMBER(args[1]);
-    double b = AS_NUMBER(args[2]);
-    return NUMBER_VAL(fmax(a, fmin(b, x)));
+static double math_clamp(double* args) {
+    return fmax(args[1], fmin(args[2], args[0]));
 }
 
-static Value math_sign(Thread* ctx, int argCount, Value* args) {
-    CHECK_NUM_ARGS("sign", 1);
-    double x = AS_NUMBER(args[0]);
-    return NUMBER_VAL((x > 0) - (x < 0));
+static double math_sign(double* args) {
+    return (args[0] > 0) - (args[0] < 0);
 }
 
-static Value math_pow(Thread* ctx, int argCount, Value* args) {
-    CHECK_NUM_ARGS("pow", 2);
-    return NUMBER_VAL(pow(AS_NUMBER(args[0]), AS_NUMBER(args[1])));
+static double math_pow(double* args) {
+    return pow(args[0], args[1]);
 }
 
-static Value math_sqrt(Thread* ctx, int argCount, Value* args) {
-    CHECK_NUM_ARGS("sqrt", 1);
-    return NUMBER_VAL(sqrt(AS_NUMBER(args[0])));
+static double math_sqrt(double* args) {
+    return sqrt(args[0]);
 }
 
-static Value math_cbrt(Thread* ctx, int argCount, Value* args) {
-    CHECK_NUM_ARGS("cbrt", 1);
-    return NUMBER_VAL(cbrt(AS_NUMBER(args[0])));
+static double math_cbrt(double* args) {
+    return cbrt(args[0]);
 }
 
-static Value math_exp(Thread* ctx, int argCount, Value* args) {
-    CHECK_NUM_ARGS("exp", 1);
-    return NUMBER_VAL(exp(AS_NUMBER(args[0])));
+static double math_exp(double* args) {
+    return exp(args[0]);
 }
 
-static Value math_log(Thread* ctx, int argCount, Value* args) {
-    CHECK_NUM_ARGS("log", 1);
-    return NUMBER_VAL(log(AS_NUMBER(args[0])));
+static double math_log(double* args) {
+    return log(args[0]);
 }
 
-static Value math_log10(Thread* ctx, int argCount, Value* args) {
-    CHECK_NUM_ARGS("log10", 1);
-    return NUMBER_VAL(log10(AS_NUMBER(args[0])));
+static double math_log10(double* args) {
+    return log10(args[0]);
 }
 
-static Value math_sin(Thread* ctx, int argCount, Value* args) {
-    CHECK_NUM_ARGS("sin", 1);
-    return NUMBER_VAL(sin(AS_NUMBER(args[0])));
+static double math_sin(double* args) {
+    return sin(args[0]);
 }
 
-static Value math_cos(Thread* ctx, int argCount, Value* args) {
-    CHECK_NUM_ARGS("cos", 1);
-    return NUMBER_VAL(cos(AS_NUMBER(args[0])));
+static double math_cos(double* args) {
+    return cos(args[0]);
 }
 
-static Value math_tan(Thread* ctx, int argCount, Value* args) {
-    CHECK_NUM_ARGS("tan", 1);
-    return NUMBER_VAL(tan(AS_NUMBER(args[0])));
+static double math_tan(double* args) {
+    return tan(args[0]);
 }
 
-static Value math_asin(Thread* ctx, int argCount, Value* args) {
-    CHECK_NUM_ARGS("asin", 1);
-    return NUMBER_VAL(asin(AS_NUMBER(args[0])));
+static double math_asin(double* args) {
+    return asin(args[0]);
 }
 
-static Value math_acos(Thread* ctx, int argCount, Value* args) {
-    CHECK_NUM_ARGS("acos", 1);
-    return NUMBER_VAL(acos(AS_NUMBER(args[0])));
+static double math_acos(double* args) {
+    return acos(args[0]);
 }
 
-static Value math_atan(Thread* ctx, int argCount, Value* args) {
-    CHECK_NUM_ARGS("atan", 1);
-    return NUMBER_VAL(atan(AS_NUMBER(args[0])));
+static double math_atan(double* args) {
+    return atan(args[0]);
 }
 
-static Value math_atan2(Thread* ctx, int argCount, Value* args) {
-    CHECK_NUM_ARGS("atan2", 2);
-    return NUMBER_VAL(atan2(AS_NUMBER(args[0]), AS_NUMBER(args[1])));
+static double math_atan2(double* args) {
+    return atan2(args[0], args[1]);
 }
 
-static Value math_floor(Thread* ctx, int argCount, Value* args) {
-    CHECK_NUM_ARGS("floor", 1);
-    return NUMBER_VAL(floor(AS_NUMBER(args[0])));
+static double math_floor(double* args) {
+    return floor(args[0]);
 }
 
-static Value math_ceil(Thread* ctx, int argCount, Value* args) {
-    CHECK_NUM_ARGS("ceil", 1);
-    return NUMBER_VAL(ceil(AS_NUMBER(args[0])));
+static double math_ceil(double* args) {
+    return ceil(args[0]);
 }
 
 static Value math_round(Thread* ctx, int argCount, Value* args) {
+    if (argCount != 1 && argCount != 2) {
+        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
+                     "No method round for arity %d.", argCount);
+        return NIL_VAL;
+    }
+
+    if (!IS_NUMBER(args[0]) || (argCount == 2 && !IS_NUMBER(args[1]))) {
+        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
+                     "round: expected (Number, Number) but got (%s, %s).",
+                     getValueTypeName(args[0]),
+                     argCount == 2 ? getValueTypeName(args[1]) : "none");
+        return NIL_VAL;
+    }
+
     double x = AS_NUMBER(args[0]);
-    int decimals = (int)AS_NUMBER(args[1]);
+    int decimals = argCount == 2 ? (int)AS_NUMBER(args[1]) : 0;
 
     if (decimals <= 0) {
         double factor = pow(10.0, -decimals);
@@ -136,20 +116,59 @@ static Value math_round(Thread* ctx, int argCount, Value* args) {
 }
 
 
-static Value math_trunc(Thread* ctx, int argCount, Value* args) {
-    CHECK_NUM_ARGS("trunc", 1);
-    return NUMBER_VAL(trunc(AS_NUMBER(args[0])));
-}
-
-static Value math_mod(Thread* ctx, int argCount, Value* args) {
-    CHECK_NUM_ARGS("mod", 2);
-    return NUMBER_VAL(fmod(AS_NUMBER(args[0]), AS_NUMBER(args[1])));
-}
-
-static Value math_lerp(Thread* ctx, int argCount, Value* args) {
-    CHECK_NUM_ARGS("lerp", 3);
-    double a = AS_NUMBER(args[0]);
-    double b = AS_NUMBER(args[1]);
-    double t = AS_NUMBER(args[2]);
-    return NUMBER_VAL(a + t * (b - a));
+static double math_trunc(double* args) {
+    return trunc(args[0]);
+}
+
+static double math_mod(double* args) {
+    return fmod(args[0], args[1]);
+}
+
+static double math_lerp(double* args) {
+    return args[0] + args[2] * (args[1] - args[0]);
+}
+
+#define MATH_1 1, {NATIVE_NUMBER}
+#define MATH_2 2, {NATIVE_NUMBER, NATIVE_NUMBER}
+#define MATH_3 3, {NATIVE_NUMBER, NATIVE_NUMBER, NATIVE_NUMBER}
+
+// Indexed by MathIntrinsic so OP_MATH can call the same entries.
+static const NativeDef mathNatives[] = {
+    [MATH_ABS] = {"abs", NULL, MATH_1, math_abs},
+    [MATH_SIGN] = {"sign", NULL, MATH_1, math_sign},
+    [MATH_SQRT] = {"sqrt", NULL, MATH_1, math_sqrt},
+    [MATH_CBRT] = {"cbrt", NULL, MATH_1, math_cbrt},
+    [MATH_EXP] = {"exp", NULL, MATH_1, math_exp},
+    [MATH_LOG] = {"log", NULL, MATH_1, math_log},
+    [MATH_LOG10] = {"log10", NULL, MATH_1, math_log10},
+    [MATH_SIN] = {"sin", NULL, MATH_1, math_sin},
+    [MATH_COS] = {"cos", NULL, MATH_1, math_cos},
+    [MATH_TAN] = {"tan", NULL, MATH_1, math_tan},
+    [MATH_ASIN] = {"asin", NULL, MATH_1, math_asin},
+    [MATH_ACOS] = {"acos", NULL, MATH_1, math_acos},
+    [MATH_ATAN] = {"atan", NULL, MATH_1, math_atan},
+    [MATH_FLOOR] = {"floor", NULL, MATH_1, math_floor},
+    [MATH_CEIL] = {"ceil", NULL, MATH_1, math_ceil},
+    [MATH_TRUNC] = {"trunc", NULL, MATH_1, math_trunc},
+    [MATH_MIN] = {"min", NULL, MATH_2, math_min},
+    [MATH_MAX] = {"max", NULL, MATH_2, math_max},
+    [MATH_POW] = {"pow", NULL, MATH_2, math_pow},
+    [MATH_ATAN2] = {"atan2", NULL, MATH_2, math_atan2},
+    [MATH_MOD] = {"mod", NULL, MATH_2, math_mod},
+    [MATH_CLAMP] = {"clamp", NULL, MATH_3, math_clamp},
+    [MATH_LERP] = {"lerp", NULL, MATH_3, math_lerp},
+    [MATH_INTRINSIC_COUNT] = {"round", math_round, NATIVE_VARIADIC},
+    {NULL},
+};
+
+#undef MATH_1
+#undef MATH_2
+#undef MATH_3
+
+// Computes the Math static numbered `id` for OP_MATH. The arguments are
+// known to be numbers.
+static double mathIntrinsic(int id, Value* args) {
+    double numbers[3];
+    for (int i = 0; i < mathNatives[id].arity; i++) numbers[i] = AS_NUMBER(args[i]);
+    return mathNatives[id].number(numbers);
 }
@@ -1,7 +1,9 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "chunk.h"
 #include "memory.h"
+#include "object.h"
 #include "vm.h"
 
 
@@ -11,11 +13,14 @@ void initChunk(Chunk* chunk) {
     chunk->code = NULL;
     chunk->lines = NULL;
     initValueArray(&chunk->constants);
+    chunk->calls = 0;
+    chunk->backedges = NULL;
 }
 
 void freeChunk(Chunk* chunk) {
     FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
     FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    FREE_ARRAY(uint32_t, chunk->backedges, chunk->count + 1);
     freeValueArray(&chunk->constants);
     initChunk(chunk);
 }
@@ -24,9 +29,9 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line) {
     if (chunk->capacity < chunk->count + 1) {
         int oldCapacity = chunk->capacity;
         chunk->capacity = GROW_CAPACITY(oldCapacity);
-        chunk->code = GROW_ARRAY(uint8_t, chunk->code,
+        chunk->code = GROW_ARRAY_ATOMIC(uint8_t, chunk->code,
             oldCapacity, chunk->capacity);
-        chunk->lines = GROW_ARRAY(int, chunk->lines,
+        chunk->lines = GROW_ARRAY_ATOMIC(int, chunk->lines,
             oldCapacity, chunk->capacity);
     }
 
@@ -35,6 +40,32 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line) {
     chunk->count++;
 }
 
+// Counters are only allocated for chunks that actually loop. Two threads
+// may get here at once; the table that is published first wins.
+uint32_t* initBackedges(Chunk* chunk) {
+    uint32_t* backedges = ALLOCATE_ATOMIC(uint32_t, chunk->count + 1);
+    memset(backedges, 0, sizeof(uint32_t) * (chunk->count + 1));
+    uint32_t* expected = NULL;
+    if (!__atomic_compare_exchange_n(&chunk->backedges, &expected, backedges, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        FREE_ARRAY(uint32_t, backedges, chunk->count + 1);
+        return expected;
+    }
+    return backedges;
+}
+
+// Strings use their cached hash and integers their own value, which the
+// self-hosted compiler can compute too. Any other key hashes to zero.
+uint32_t switchKeyHash(Value key) {
+    if (IS_STRING(key)) return AS_STRING(key)->hash;
+    if (IS_NUMBER(key)) {
+        double n = AS_NUMBER(key);
+        if (n >= INT32_MIN && n <= INT32_MAX && n == (int32_t)n) return (uint32_t)(int32_t)n;
+    }
+    if (IS_BOOL(key)) return AS_BOOL(key) ? 1 : 0;
+    return 0;
+}
+
 int addConstant(Chunk* chunk, Value value) {
     writeValueArray(&chunk->constants, value);
     return chunk->constants.count - 1;
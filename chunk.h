@@ -61,20 +61,83 @@ typedef enum {
     OP_INSTANCEOF,
     OP_EXPORT_LOCAL,
     OP_EXPORT_UPVALUE,
+    OP_SWITCH_TABLE,
+    OP_SWITCH_HASH,
+    OP_FOR_ITER,
+    OP_RANGE,
+    OP_FOR_STEP,
+    OP_TAIL_CALL,
+    OP_TAIL_INVOKE,
+    OP_INLINE_GUARD,
+    OP_INLINE_INVOKE_GUARD,
+    OP_PEEK,
+    OP_INLINE_RETURN,
+    OP_MATH,
+    OP_RETURN_VALUES,
+    OP_UNPACK,
+    OP_FIELD,
+    OP_SINK,
+    OP_GET_SUNK,
 } OpCode;
 
+// The Math statics OP_MATH computes itself, numbered as in its operand.
+typedef enum {
+    MATH_ABS,
+    MATH_SIGN,
+    MATH_SQRT,
+    MATH_CBRT,
+    MATH_EXP,
+    MATH_LOG,
+    MATH_LOG10,
+    MATH_SIN,
+    MATH_COS,
+    MATH_TAN,
+    MATH_ASIN,
+    MATH_ACOS,
+    MATH_ATAN,
+    MATH_FLOOR,
+    MATH_CEIL,
+    MATH_TRUNC,
+    MATH_MIN,
+    MATH_MAX,
+    MATH_POW,
+    MATH_ATAN2,
+    MATH_MOD,
+    MATH_CLAMP,
+    MATH_LERP,
+    MATH_INTRINSIC_COUNT,
+} MathIntrinsic;
+
 typedef struct {
     int count;
     int capacity;
     uint8_t* code;
     int* lines;
     ValueArray constants;
+
+    // Profile counters, filled in as the chunk runs.
+    uint32_t calls;        // Frames started on this chunk.
+    uint32_t* backedges;   // Taken backward jumps, by the offset after the jump.
 } Chunk;
 
 void initChunk(Chunk* chunk);
 void freeChunk(Chunk* chunk);
 void writeChunk(Chunk* chunk, uint8_t byte, int line);
 int addConstant(Chunk* chunk, Value value);
+uint32_t* initBackedges(Chunk* chunk);
+
+// OP_SWITCH_HASH keeps its keys in an open-addressed table laid out by the
+// compiler, so both compilers and the VM must agree on where a key goes.
+#define SWITCH_EMPTY_SLOT UINT16_MAX
+uint32_t switchKeyHash(Value key);
+
+// Threads running the same function share its counters, so they are
+// bumped atomically. Relaxed order is enough for a heuristic.
+static inline uint32_t countBackedge(Chunk* chunk, int offset) {
+    uint32_t* backedges = __atomic_load_n(&chunk->backedges, __ATOMIC_ACQUIRE);
+    if (backedges == NULL) backedges = initBackedges(chunk);
+    return __atomic_add_fetch(&backedges[offset], 1, __ATOMIC_RELAXED);
+}
 
 
 #endif
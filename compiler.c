@@ -31,6 +31,7 @@ typedef struct {
     int breakJumpOffsets[MAX_LOOP_DEPTH];
     int breakCount;
     int localCount;
+    bool isSwitch; // 'break' leaves a switch, 'continue' skips past it
 } LoopContext;
 
 static LoopContext loopStack[MAX_LOOP_DEPTH];
@@ -41,6 +42,149 @@ static char** importedFiles = NULL;
 static int importedCount = 0;
 static int importedCapacity = 0;
 
+// Module sources, preprocessor output and the strings built along the way
+// come from a bump arena. Tokens point into these buffers, so nothing is
+// released until the outermost compile() returns. Imported modules compile
+// into the same arena.
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN(size) (((size) + 15) & ~(size_t)15)
+
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t capacity;
+    size_t used;
+    char data[];
+} ArenaBlock;
+
+static _Thread_local ArenaBlock* arena = NULL;
+static _Thread_local int arenaDepth = 0;
+
+static ArenaBlock* newArenaBlock(size_t capacity) {
+    ArenaBlock* block = malloc(sizeof(ArenaBlock) + capacity);
+    if (block == NULL) exit(1);
+    block->capacity = capacity;
+    block->used = 0;
+    return block;
+}
+
+static void* arenaAlloc(size_t size) {
+    size = ARENA_ALIGN(size);
+    if (size > ARENA_BLOCK_SIZE / 2) {
+        // Large buffers get a block of their own behind the current one,
+        // which keeps its free space for the small strings.
+        ArenaBlock* block = newArenaBlock(size);
+        block->used = size;
+        if (arena == NULL) {
+            block->next = NULL;
+            arena = block;
+        } else {
+            block->next = arena->next;
+            arena->next = block;
+        }
+        return block->data;
+    }
+    if (arena == NULL || arena->capacity - arena->used < size) {
+        ArenaBlock* block = newArenaBlock(ARENA_BLOCK_SIZE);
+        block->next = arena;
+        arena = block;
+    }
+    void* result = arena->data + arena->used;
+    arena->used += size;
+    return result;
+}
+
+static bool arenaIsLast(void* pointer, size_t size) {
+    return arena != NULL &&
+           (char*)pointer + ARENA_ALIGN(size) == arena->data + arena->used;
+}
+
+// Resizes in place when pointer is the most recent allocation.
+static void* arenaGrow(void* pointer, size_t oldSize, size_t newSize) {
+    if (pointer == NULL) return arenaAlloc(newSize);
+    if (arenaIsLast(pointer, oldSize)) {
+        size_t start = (char*)pointer - arena->data;
+        if (start + ARENA_ALIGN(newSize) <= arena->capacity) {
+            arena->used = start + ARENA_ALIGN(newSize);
+            return pointer;
+        }
+    }
+    if (newSize <= oldSize) return pointer;
+    void* result = arenaAlloc(newSize);
+    memcpy(result, pointer, oldSize);
+    return result;
+}
+
+// Only the most recent allocation can be handed back; anything else stays
+// until the arena is released.
+static void arenaFree(void* pointer, size_t size) {
+    if (arenaIsLast(pointer, size)) arena->used -= ARENA_ALIGN(size);
+}
+
+static void beginArena() {
+    arenaDepth++;
+}
+
+static void endArena() {
+    if (--arenaDepth > 0) return;
+    while (arena != NULL) {
+        ArenaBlock* next = arena->next;
+        free(arena);
+        arena = next;
+    }
+}
+
+static char* my_strndup(const char* s, int n) {
+    char* p = arenaAlloc((size_t)n + 1);
+    memcpy(p, s, (size_t)n);
+    p[n] = '\0';
+    return p;
+}
+static char* my_strdup(const char* s) { return my_strndup(s, (int)strlen(s)); }
+
+// Values of `const` and `enum` declarations, shared with imported modules.
+static Table compileConstants;
+static Table compileEnums;
+
+// Field names of the structs declared at the top level, as lists. A name
+// declared twice maps to nil.
+static Table compileStructs;
+
+// Top-level functions and methods that calls may inline, by name. A name
+// defined more than once maps to nil.
+static Table inlineFunctions;
+static Table inlineMethods;
+
+// Imported modules compile inside their importer, so the tables above last
+// from the outermost compile() to its return.
+// The tokens from the first allocation sinking candidate in a block to the
+// block's closing brace, followed by four EOF tokens to look ahead into.
+// Later candidates in the same block start somewhere inside it, so each
+// block is scanned once.
+static Token* blockTokens = NULL;
+static int blockTokenCount = 0;
+static int blockTokenCapacity = 0;
+
+static int compileDepth = 0;
+
+static void initCompileTables() {
+    initTable(&compileConstants);
+    initTable(&compileEnums);
+    initTable(&compileStructs);
+    initTable(&inlineFunctions);
+    initTable(&inlineMethods);
+}
+
+static void freeCompileTables() {
+    freeTable(&compileConstants);
+    freeTable(&compileEnums);
+    freeTable(&compileStructs);
+    freeTable(&inlineFunctions);
+    freeTable(&inlineMethods);
+    FREE_ARRAY(Token, blockTokens, blockTokenCapacity);
+    blockTokens = NULL;
+    blockTokenCapacity = 0;
+}
+
 typedef enum {
     PREC_NONE,
     PREC_ASSIGNMENT,  // =
@@ -48,6 +192,7 @@ typedef enum {
     PREC_AND,         // and
     PREC_EQUALITY,    // == !=
     PREC_COMPARISON,  // < > <= >=
+    PREC_RANGE,       // ..
     PREC_TERM,        // + -
     PREC_FACTOR,      // * /
     PREC_UNARY,       // ! -
@@ -68,6 +213,8 @@ typedef struct {
     Token name;
     int depth;
     bool isCaptured;
+    int sunk;          // Fields kept in the slots after this one, if sunk.
+    ObjList* fields;   // Their names for a struct, NULL for a list.
 } Local;
 
 typedef struct {
@@ -95,11 +242,15 @@ typedef struct Compiler {
     int scopeDepth;
 
     bool inLoop;
+    int lastCall;    // Offset of the last OP_CALL or OP_INVOKE emitted.
+    int lastGlobal;  // Offset of the last OP_GET_GLOBAL emitted.
+    int lastInline;  // Offset of the guard of the last inlined call.
 } Compiler;
 
 typedef struct ClassCompiler {
     struct ClassCompiler* enclosing;
     bool hasSuperclass;
+    bool isStruct;
 } ClassCompiler;
 
 Parser parser;
@@ -218,6 +369,59 @@ static void emitConstant(Value value) {
     emitShort(constant);
 }
 
+// The most recently emitted literal, so operators can fold it at compile time.
+typedef struct {
+    Chunk* chunk;
+    int start;
+    int end;
+    Value value;
+} FoldedConstant;
+
+static FoldedConstant lastConstant = {NULL, -1, -1};
+static int operandStart = -1;
+
+static void emitFoldable(Value value) {
+    int start = currentChunk()->count;
+
+    if (IS_NIL(value)) emitByte(OP_NIL);
+    else if (IS_BOOL(value)) emitByte(AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+    else emitConstant(value);
+
+    lastConstant.chunk = currentChunk();
+    lastConstant.start = start;
+    lastConstant.end = currentChunk()->count;
+    lastConstant.value = value;
+}
+
+// True when everything emitted since start is a single literal.
+static bool constantSince(int start, Value* value) {
+    if (lastConstant.chunk != currentChunk() ||
+        lastConstant.start != start ||
+        lastConstant.end != currentChunk()->count) return false;
+
+    *value = lastConstant.value;
+    return true;
+}
+
+static void rewindChunk(int offset) {
+    currentChunk()->count = offset;
+    lastConstant.end = -1;
+}
+
+// Removes a literal emitted at start, reclaiming its pool slot when it is the newest.
+static void dropConstant(int start) {
+    Chunk* chunk = currentChunk();
+    if (chunk->code[start] == OP_CONSTANT) {
+        int index = (chunk->code[start + 1] << 8) | chunk->code[start + 2];
+        if (index == chunk->constants.count - 1) chunk->constants.count--;
+    }
+    rewindChunk(start);
+}
+
+static bool isFalseyConstant(Value value) {
+    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value)) || (IS_NUMBER(value) && AS_NUMBER(value) == 0.0);
+}
+
 static void patchJump(int offset) {
     int jump = currentChunk()->count - offset - 2;
 
@@ -248,6 +452,7 @@ static void beginLoop() {
     LoopContext* loop = &loopStack[loopDepth++];
     loop->breakCount = 0;
     loop->localCount = current->localCount; // NEW
+    loop->isSwitch = false;
 }
 
 
@@ -266,12 +471,17 @@ static void initCompiler(Compiler* compiler, FunctionType type) {
     compiler->type = type;
     compiler->localCount = 0;
     compiler->scopeDepth = 0;
+    compiler->lastCall = -1;
+    compiler->lastGlobal = -1;
+    compiler->lastInline = -1;
     compiler->function = newFunction();
     current = compiler;
 
     Local* local = &current->locals[current->localCount++];
     local->depth = 0;
     local->isCaptured = false;
+    local->sunk = 0;
+    local->fields = NULL;
     local->name.start = "";
     // type == TYPE_METHOD || type == TYPE_INITIALIZER to remove static methods refering to the class
     if (type == TYPE_METHOD || type == TYPE_INITIALIZER || type == TYPE_STATIC_METHOD) {
@@ -317,11 +527,77 @@ static ParseRule* getRule(TokenType type);
 static void parsePrecedence(Precedence precedence);
 static uint16_t identifierConstant(Token* name);
 
+// Mirrors the runtime semantics of the arithmetic and comparison opcodes.
+static bool foldBinary(TokenType operatorType, Value a, Value b, Value* result) {
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        double x = AS_NUMBER(a);
+        double y = AS_NUMBER(b);
+
+        switch (operatorType) {
+            case TOKEN_PLUS:          *result = NUMBER_VAL(x + y); return true;
+            case TOKEN_MINUS:         *result = NUMBER_VAL(x - y); return true;
+            case TOKEN_STAR:          *result = NUMBER_VAL(x * y); return true;
+            case TOKEN_SLASH:
+                if (y == 0) return false;
+                *result = NUMBER_VAL(x / y);
+                return true;
+            case TOKEN_PERCENT:
+                if (y == 0) return false;
+                *result = NUMBER_VAL(fmod(x, y));
+                return true;
+            case TOKEN_INS:
+                if (y == 0 || fabs(x / y) >= INT_MAX) return false;
+                *result = NUMBER_VAL((int)(x / y));
+                return true;
+            case TOKEN_GREATER:       *result = BOOL_VAL(x > y); return true;
+            case TOKEN_GREATER_EQUAL: *result = BOOL_VAL(!(x < y)); return true;
+            case TOKEN_LESS:          *result = BOOL_VAL(x < y); return true;
+            case TOKEN_LESS_EQUAL:    *result = BOOL_VAL(!(x > y)); return true;
+            default: break;
+        }
+    }
+
+    if (operatorType == TOKEN_PLUS && IS_STRING(a) && IS_STRING(b)) {
+        ObjString* left = AS_STRING(a);
+        ObjString* right = AS_STRING(b);
+
+        int length = left->length + right->length;
+        char* chars = ALLOCATE_ATOMIC(char, length + 1);
+        memcpy(chars, left->chars, left->length);
+        memcpy(chars + left->length, right->chars, right->length);
+        chars[length] = '\0';
+
+        *result = OBJ_VAL(internString(newString(chars, length)));
+        return true;
+    }
+
+    switch (operatorType) {
+        case TOKEN_EQUAL_EQUAL: *result = BOOL_VAL(valuesEqual(a, b)); return true;
+        case TOKEN_BANG_EQUAL:  *result = BOOL_VAL(!valuesEqual(a, b)); return true;
+        default: return false;
+    }
+}
+
 static void binary(bool canAssign) {
     TokenType operatorType = parser.previous.type;
+
+    int leftStart = operandStart;
+    Value left;
+    bool leftConstant = constantSince(leftStart, &left);
+
+    int rightStart = currentChunk()->count;
     ParseRule* rule = getRule(operatorType);
     parsePrecedence((Precedence)(rule->precedence + 1));
 
+    Value right, folded;
+    if (leftConstant && constantSince(rightStart, &right) &&
+        foldBinary(operatorType, left, right, &folded)) {
+        dropConstant(rightStart);
+        dropConstant(leftStart);
+        emitFoldable(folded);
+        return;
+    }
+
     switch (operatorType) {
         case TOKEN_PLUS:          emitByte(OP_ADD); break;
         case TOKEN_MINUS:         emitByte(OP_SUBTRACT); break;
@@ -336,39 +612,336 @@ static void binary(bool canAssign) {
         case TOKEN_LESS:          emitByte(OP_LESS); break;
         case TOKEN_LESS_EQUAL:    emitBytes(OP_GREATER, OP_NOT); break;
         case TOKEN_IS:            emitByte(OP_INSTANCEOF); break;
+        case TOKEN_DOT_DOT:       emitByte(OP_RANGE); break;
         default: return; // Unreachable.
     }
 }
 
 static uint8_t argumentList();
 
+// ---------------------
+// Inlining
+// ---------------------
+// A call to a small function is replaced by a copy of its bytecode, behind
+// a guard that checks the callee at runtime and otherwise makes the call.
+#define INLINE_MAX_CODE 32
+
+static uint16_t readShortAt(uint8_t* code) {
+    return (uint16_t)((code[0] << 8) | code[1]);
+}
+
+// Length of an instruction an inlined body may contain, or 0.
+static int inlineLength(uint8_t instruction) {
+    switch (instruction) {
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_POP:
+        case OP_NEGATE:
+        case OP_NOT:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_MOD:
+        case OP_INS:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_GET_INDEX:
+        case OP_RETURN:
+            return 1;
+        case OP_GET_LOCAL:
+        case OP_LIST:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+            return 2;
+        case OP_CONSTANT:
+        case OP_GET_GLOBAL:
+        case OP_GET_PROPERTY:
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+            return 3;
+        case OP_INVOKE:
+        case OP_TAIL_INVOKE:
+            return 4;
+        case OP_MATH:
+            return 5;
+        default:
+            return 0;
+    }
+}
+
+// Works out the stack depth above the arguments before each reachable
+// instruction, leaving -1 for unreachable ones. Returns false unless the
+// function is small, has no loops or upvalues, only reads its parameters,
+// and doesn't name itself or a private member.
+static bool inlineDepths(ObjFunction* function, int* depths) {
+    Chunk* chunk = &function->chunk;
+    if (chunk->count > INLINE_MAX_CODE || function->upvalueCount > 0 || function->arity >= 10) {
+        return false;
+    }
+
+    for (int i = 0; i < chunk->count; i++) depths[i] = -1;
+    depths[0] = 0;
+
+    for (int offset = 0; offset < chunk->count;) {
+        uint8_t* code = &chunk->code[offset];
+        int length = inlineLength(code[0]);
+        if (length == 0 || offset + length > chunk->count) return false;
+
+        int depth = depths[offset];
+        int effect = 0;
+        int target = -1;
+        ObjString* name = NULL;
+
+        switch (code[0]) {
+            case OP_CONSTANT:
+            case OP_NIL:
+            case OP_TRUE:
+            case OP_FALSE:
+                effect = 1;
+                break;
+            case OP_GET_LOCAL:
+                if (code[1] > function->arity) return false;
+                effect = 1;
+                break;
+            case OP_GET_GLOBAL:
+                name = AS_STRING(chunk->constants.values[readShortAt(code + 1)]);
+                effect = 1;
+                break;
+            case OP_GET_PROPERTY:
+                name = AS_STRING(chunk->constants.values[readShortAt(code + 1)]);
+                break;
+            case OP_INVOKE:
+            case OP_TAIL_INVOKE:
+                name = AS_STRING(chunk->constants.values[readShortAt(code + 1)]);
+                effect = -code[3];
+                break;
+            case OP_MATH:
+                effect = -code[3];
+                break;
+            case OP_LIST:
+                effect = 1 - code[1];
+                break;
+            case OP_CALL:
+            case OP_TAIL_CALL:
+                effect = -code[1];
+                break;
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE:
+                target = offset + 3 + readShortAt(code + 1);
+                break;
+            case OP_NEGATE:
+            case OP_NOT:
+                break;
+            default:
+                effect = -1;
+                break;
+        }
+
+        if (name != NULL && (name == function->name || name->chars[0] == '#')) return false;
+        offset += length;
+        if (depth == -1) continue;
+
+        int next = depth + effect;
+        if (next < 0) return false;
+        if (target != -1) {
+            if (target >= chunk->count) return false;
+            if (depths[target] != -1 && depths[target] != next) return false;
+            depths[target] = next;
+        }
+        if (code[0] != OP_JUMP && code[0] != OP_RETURN && offset < chunk->count) {
+            if (depths[offset] != -1 && depths[offset] != next) return false;
+            depths[offset] = next;
+        }
+    }
+    return true;
+}
+
+// Remembers a function that calls by its name may inline. A second
+// definition means an overload or an override, so the name is dropped.
+static void registerInline(Table* table, ObjFunction* function) {
+    int depths[INLINE_MAX_CODE];
+    Value existing;
+    if (tableGet(table, function->name, &existing) || !inlineDepths(function, depths)) {
+        tableSet(table, function->name, NIL_VAL);
+        return;
+    }
+    tableSet(table, function->name, OBJ_VAL(function));
+}
+
+// Inside a method, a bare name is looked up on the receiver before the
+// globals. An inlined body runs with the caller's receiver, so a body that
+// reads one can only be inlined where there is no receiver to find it on.
+static bool readsGlobal(ObjFunction* function) {
+    Chunk* chunk = &function->chunk;
+    for (int offset = 0; offset < chunk->count; offset += inlineLength(chunk->code[offset])) {
+        if (chunk->code[offset] == OP_GET_GLOBAL) return true;
+    }
+    return false;
+}
+
+static ObjFunction* inlineCandidate(Table* table, ObjString* name, int argCount) {
+    Value value;
+    if (!tableGet(table, name, &value) || IS_NIL(value)) return NULL;
+    ObjFunction* function = AS_FUNCTION(value);
+    if (function->arity != argCount) return NULL;
+    if ((table == &inlineMethods || currentClass != NULL) && readsGlobal(function)) return NULL;
+    return function;
+}
+
+// Copies the body after the arguments. Parameters become reads relative to
+// the stack top, and each return leaves the result where the callee was.
+// Returns the number of jumps to the end of the call written to exits.
+static int emitInlineBody(ObjFunction* function, uint8_t argCount, int* exits) {
+    Chunk* chunk = &function->chunk;
+    int depths[INLINE_MAX_CODE];
+    int starts[INLINE_MAX_CODE];
+    int jumps[INLINE_MAX_CODE];
+    int targets[INLINE_MAX_CODE];
+    int jumpCount = 0;
+    int exitCount = 0;
+    inlineDepths(function, depths);
+
+    for (int offset = 0; offset < chunk->count;) {
+        uint8_t* code = &chunk->code[offset];
+        int length = inlineLength(code[0]);
+        starts[offset] = currentChunk()->count;
+        if (depths[offset] == -1) {
+            offset += length;
+            continue;
+        }
+
+        switch (code[0]) {
+            case OP_GET_LOCAL:
+                emitBytes(OP_PEEK, argCount + depths[offset] - code[1]);
+                break;
+            case OP_CONSTANT:
+            case OP_GET_GLOBAL:
+            case OP_GET_PROPERTY:
+                emitByte(code[0]);
+                emitShort(makeConstant(chunk->constants.values[readShortAt(code + 1)]));
+                break;
+            case OP_INVOKE:
+            case OP_TAIL_INVOKE:
+                emitByte(OP_INVOKE);
+                emitShort(makeConstant(chunk->constants.values[readShortAt(code + 1)]));
+                emitByte(code[3]);
+                break;
+            case OP_MATH:
+                emitByte(OP_MATH);
+                emitShort(makeConstant(chunk->constants.values[readShortAt(code + 1)]));
+                emitBytes(code[3], code[4]);
+                break;
+            case OP_CALL:
+            case OP_TAIL_CALL:
+                emitBytes(OP_CALL, code[1]);
+                break;
+            case OP_LIST:
+                emitBytes(OP_LIST, code[1]);
+                break;
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE:
+                targets[jumpCount] = offset + 3 + readShortAt(code + 1);
+                jumps[jumpCount++] = emitJump(code[0]);
+                break;
+            case OP_RETURN:
+                emitBytes(OP_INLINE_RETURN, argCount);
+                exits[exitCount++] = emitJump(OP_JUMP);
+                break;
+            default:
+                emitByte(code[0]);
+                break;
+        }
+        offset += length;
+    }
+
+    for (int i = 0; i < jumpCount; i++) {
+        patchJumpTo(jumps[i], starts[targets[i]]);
+    }
+    return exitCount;
+}
+
+// The guard keeps the callee as a constant. Calls in the same chunk share
+// it so the saved bytecode holds one copy.
+static uint16_t functionConstant(ObjFunction* function) {
+    ValueArray* constants = &currentChunk()->constants;
+    for (int i = 0; i < constants->count; i++) {
+        if (IS_OBJ(constants->values[i]) && AS_OBJ(constants->values[i]) == (Obj*)function) return i;
+    }
+    return makeConstant(OBJ_VAL(function));
+}
+
+// Emits the guard, the inlined body and the ordinary call or invoke the
+// guard falls back to. A method guard also needs the method name.
+static void emitInlineCall(ObjFunction* function, ObjString* method, uint8_t argCount) {
+    current->lastInline = currentChunk()->count;
+    emitByte(method == NULL ? OP_INLINE_GUARD : OP_INLINE_INVOKE_GUARD);
+    emitByte(argCount);
+    if (method != NULL) emitShort(makeConstant(OBJ_VAL(method)));
+    emitShort(functionConstant(function));
+    int fallback = currentChunk()->count;
+    emitBytes(0xff, 0xff);
+
+    int exits[INLINE_MAX_CODE];
+    int exitCount = emitInlineBody(function, argCount, exits);
+
+    patchJump(fallback);
+    current->lastCall = currentChunk()->count;
+    if (method == NULL) {
+        emitBytes(OP_CALL, argCount);
+    } else {
+        emitByte(OP_INVOKE);
+        emitShort(makeConstant(OBJ_VAL(method)));
+        emitByte(argCount);
+    }
+
+    for (int i = 0; i < exitCount; i++) {
+        patchJump(exits[i]);
+    }
+}
+
 static void call(bool canAssign) {
+    ObjString* callee = NULL;
+    int global = current->lastGlobal;
+    if (global >= 0 && global + 3 == currentChunk()->count) {
+        callee = AS_STRING(currentChunk()->constants.values[readShortAt(&currentChunk()->code[global + 1])]);
+    }
+
     uint8_t argCount = argumentList();
+    ObjFunction* function = callee != NULL ? inlineCandidate(&inlineFunctions, callee, argCount) : NULL;
+    if (function != NULL) {
+        emitInlineCall(function, NULL, argCount);
+        return;
+    }
+
+    current->lastCall = currentChunk()->count;
     emitBytes(OP_CALL, argCount);
 }
 
 static void number(bool canAssign) {
     double value = strtod(parser.previous.start, NULL);
-    emitConstant(NUMBER_VAL(value));
+    emitFoldable(NUMBER_VAL(value));
 }
 
 static void hex_number(bool canAssign) {
     double value = (double)strtoll(parser.previous.start + 2, NULL, 16);
-    emitConstant(NUMBER_VAL(value));
+    emitFoldable(NUMBER_VAL(value));
 }
 
 static void oct_number(bool canAssign) {
     double value = (double)strtoll(parser.previous.start + 2, NULL, 8);
-    emitConstant(NUMBER_VAL(value));
+    emitFoldable(NUMBER_VAL(value));
 }
 
 static void bin_number(bool canAssign) {
     double value = (double)strtoll(parser.previous.start + 2, NULL, 2);
-    emitConstant(NUMBER_VAL(value));
+    emitFoldable(NUMBER_VAL(value));
 }
 
 static void string(bool canAssign) {
-    emitConstant(OBJ_VAL(copyString(parser.previous.start + 1,
+    emitFoldable(OBJ_VAL(copyString(parser.previous.start + 1,
                                     parser.previous.length - 2)));
 }
 
@@ -413,15 +986,52 @@ static int resolveUpvalue(Compiler* compiler, Token* name) {
     return -1;
 }
 
+static ObjString* enumMemberName(Token* enumName, Token* member) {
+    int length = enumName->length + 1 + member->length;
+    char* chars = ALLOCATE_ATOMIC(char, length + 1);
+    memcpy(chars, enumName->start, enumName->length);
+    chars[enumName->length] = '.';
+    memcpy(chars + enumName->length + 1, member->start, member->length);
+    chars[length] = '\0';
+    return takeString(chars, length);
+}
+
+static void sunkVariable(int slot);
+
 static void namedVariable(Token name, bool canAssign) {
     uint8_t getOp, setOp;
+    Value constant;
     int arg = resolveLocal(current, &name);
-    if (arg != -1) {
+    if (arg != -1 && current->locals[arg].sunk > 0) {
+        sunkVariable(arg);
+        return;
+    } else if (arg != -1) {
         getOp = OP_GET_LOCAL;
         setOp = OP_SET_LOCAL;
     } else if ((arg = resolveUpvalue(current, &name)) != -1) {
         getOp = OP_GET_UPVALUE;
         setOp = OP_SET_UPVALUE;
+    } else if (tableGet(&compileEnums, copyString(name.start, name.length), &constant)) {
+        consume(TOKEN_DOT, "Expect '.' after enum name.");
+        consume(TOKEN_IDENTIFIER, "Expect enum member name.");
+
+        if (!tableGet(&compileConstants, enumMemberName(&name, &parser.previous), &constant)) {
+            error("Undefined enum member.");
+            return;
+        }
+        if (canAssign && match(TOKEN_EQUAL)) {
+            error("Can't assign to an enum member.");
+            return;
+        }
+        emitFoldable(constant);
+        return;
+    } else if (tableGet(&compileConstants, copyString(name.start, name.length), &constant)) {
+        if (canAssign && match(TOKEN_EQUAL)) {
+            error("Can't assign to a constant.");
+            return;
+        }
+        emitFoldable(constant);
+        return;
     } else {
         arg = identifierConstant(&name);
         getOp = OP_GET_GLOBAL;
@@ -432,6 +1042,7 @@ static void namedVariable(Token name, bool canAssign) {
             emitByte(setOp);
             emitShort(arg);
         } else {
+            current->lastGlobal = currentChunk()->count;
             emitByte(getOp);
             emitShort(arg);
         }
@@ -455,8 +1066,24 @@ static void unary(bool canAssign) {
     TokenType operatorType = parser.previous.type;
 
     // Compile the operand.
+    int start = currentChunk()->count;
     parsePrecedence(PREC_UNARY);
 
+    // Fold literal operands.
+    Value operand;
+    if (constantSince(start, &operand)) {
+        if (operatorType == TOKEN_MINUS && IS_NUMBER(operand)) {
+            dropConstant(start);
+            emitFoldable(NUMBER_VAL(-AS_NUMBER(operand)));
+            return;
+        }
+        if (operatorType == TOKEN_BANG) {
+            dropConstant(start);
+            emitFoldable(BOOL_VAL(isFalseyConstant(operand)));
+            return;
+        }
+    }
+
     // Emit the operator instruction.
     switch (operatorType) {
         case TOKEN_MINUS: emitByte(OP_NEGATE); break;
@@ -467,9 +1094,9 @@ static void unary(bool canAssign) {
 
 static void literal(bool canAssign) {
     switch (parser.previous.type) {
-        case TOKEN_FALSE: emitByte(OP_FALSE); break;
-        case TOKEN_NIL: emitByte(OP_NIL); break;
-        case TOKEN_TRUE: emitByte(OP_TRUE); break;
+        case TOKEN_FALSE: emitFoldable(BOOL_VAL(false)); break;
+        case TOKEN_NIL: emitFoldable(NIL_VAL); break;
+        case TOKEN_TRUE: emitFoldable(BOOL_VAL(true)); break;
         default: return; // Unreachable.
     }
 }
@@ -528,7 +1155,44 @@ static void or_(bool canAssign) {
     patchJump(endJump);
 }
 
+// Names and arities of the Math statics, indexed by MathIntrinsic.
+static const struct {
+    const char* name;
+    int arity;
+} mathIntrinsics[] = {
+    [MATH_ABS] = {"abs", 1},     [MATH_SIGN] = {"sign", 1},
+    [MATH_SQRT] = {"sqrt", 1},   [MATH_CBRT] = {"cbrt", 1},
+    [MATH_EXP] = {"exp", 1},     [MATH_LOG] = {"log", 1},
+    [MATH_LOG10] = {"log10", 1}, [MATH_SIN] = {"sin", 1},
+    [MATH_COS] = {"cos", 1},     [MATH_TAN] = {"tan", 1},
+    [MATH_ASIN] = {"asin", 1},   [MATH_ACOS] = {"acos", 1},
+    [MATH_ATAN] = {"atan", 1},   [MATH_FLOOR] = {"floor", 1},
+    [MATH_CEIL] = {"ceil", 1},   [MATH_TRUNC] = {"trunc", 1},
+    [MATH_MIN] = {"min", 2},     [MATH_MAX] = {"max", 2},
+    [MATH_POW] = {"pow", 2},     [MATH_ATAN2] = {"atan2", 2},
+    [MATH_MOD] = {"mod", 2},     [MATH_CLAMP] = {"clamp", 3},
+    [MATH_LERP] = {"lerp", 3},
+};
+
+// The intrinsic for `Math.<method>(...)` when the receiver is the global
+// Math read right before `receiverEnd`, or -1.
+static int mathIntrinsic(int receiverEnd, ObjString* method, int argCount) {
+    int global = current->lastGlobal;
+    if (global < 0 || global + 3 != receiverEnd) return -1;
+
+    ObjString* receiver = AS_STRING(currentChunk()->constants.values[readShortAt(&currentChunk()->code[global + 1])]);
+    if (receiver->length != 4 || memcmp(receiver->chars, "Math", 4) != 0) return -1;
+
+    for (int id = 0; id < MATH_INTRINSIC_COUNT; id++) {
+        if (mathIntrinsics[id].arity == argCount && strcmp(mathIntrinsics[id].name, method->chars) == 0) {
+            return id;
+        }
+    }
+    return -1;
+}
+
 static void dot(bool canAssign) {
+    int receiverEnd = currentChunk()->count;
     consume(TOKEN_IDENTIFIER, "Expect property name after '.'.");
     uint16_t name = identifierConstant(&parser.previous);
 
@@ -538,6 +1202,22 @@ static void dot(bool canAssign) {
         emitShort(name);
     } else if (match(TOKEN_LEFT_PAREN)) {
         uint8_t argCount = argumentList();
+        ObjString* method = AS_STRING(currentChunk()->constants.values[name]);
+        int intrinsic = mathIntrinsic(receiverEnd, method, argCount);
+        if (intrinsic >= 0) {
+            emitByte(OP_MATH);
+            emitShort(name);
+            emitBytes(argCount, intrinsic);
+            return;
+        }
+
+        ObjFunction* function = inlineCandidate(&inlineMethods, method, argCount);
+        if (function != NULL) {
+            emitInlineCall(function, method, argCount);
+            return;
+        }
+
+        current->lastCall = currentChunk()->count;
         emitByte(OP_INVOKE);
         emitShort(name);
         emitByte(argCount);
@@ -609,7 +1289,7 @@ static void list(bool canAssign) {
     emitBytes(OP_LIST, elementCount); // Custom OP_LIST instruction
 }
 
-static void function(FunctionType type);
+static ObjFunction* function(FunctionType type);
 
 ParseRule rules[] = {
     [TOKEN_LEFT_PAREN]    = {grouping, call,   PREC_CALL},
@@ -620,6 +1300,7 @@ ParseRule rules[] = {
     [TOKEN_LEFT_BRACKET]  = {list,     index_, PREC_CALL},
     [TOKEN_COMMA]         = {NULL,     NULL,   PREC_NONE},
     [TOKEN_DOT]           = {NULL,     dot,    PREC_CALL},
+    [TOKEN_DOT_DOT]       = {NULL,     binary, PREC_RANGE},
     [TOKEN_MINUS]         = {unary,    binary, PREC_TERM},
     [TOKEN_PLUS]          = {NULL,     binary, PREC_TERM},
     [TOKEN_SEMICOLON]     = {NULL,     NULL,   PREC_NONE},
@@ -674,6 +1355,12 @@ ParseRule rules[] = {
     [TOKEN_OPERATOR]      = {NULL,     NULL,     PREC_NONE},
     [TOKEN_BREAK]         = {NULL,     NULL,     PREC_NONE},
     [TOKEN_CONTINUE]      = {NULL,     NULL,     PREC_NONE},
+    [TOKEN_CONST]         = {NULL,     NULL,     PREC_NONE},
+    [TOKEN_ENUM]          = {NULL,     NULL,     PREC_NONE},
+    [TOKEN_SWITCH]        = {NULL,     NULL,     PREC_NONE},
+    [TOKEN_CASE]          = {NULL,     NULL,     PREC_NONE},
+    [TOKEN_DEFAULT]       = {NULL,     NULL,     PREC_NONE},
+    [TOKEN_STRUCT]        = {NULL,     NULL,     PREC_NONE},
     [TOKEN_EOF]           = {NULL,     NULL,   PREC_NONE},
 };
 
@@ -686,11 +1373,13 @@ static void parsePrecedence(Precedence precedence) {
     }
 
     bool canAssign = precedence <= PREC_ASSIGNMENT;
+    int start = currentChunk()->count;
     prefixRule(canAssign);
 
     while (precedence <= getRule(parser.current.type)->precedence) {
         advance();
         ParseFn infixRule = getRule(parser.previous.type)->infix;
+        operandStart = start;
         infixRule(canAssign);
     }
 
@@ -733,6 +1422,8 @@ static void addLocal(Token name) {
     local->name = name;
     local->depth = -1;
     local->isCaptured = false;
+    local->sunk = 0;
+    local->fields = NULL;
 }
 
 static void declareVariable() {
@@ -766,6 +1457,11 @@ static uint16_t parseVariable(const char* errorMessage) {
     declareVariable();
     if (current->scopeDepth > 0) return 0;
 
+    Value constant;
+    if (tableGet(&compileConstants, copyString(parser.previous.start, parser.previous.length), &constant)) {
+        error("Already a constant with this name.");
+    }
+
     return identifierConstant(&parser.previous);
 }
 
@@ -879,7 +1575,7 @@ static void consumeTypeHint() {
 }
 
 
-static void function(FunctionType type) {
+static ObjFunction* function(FunctionType type) {
     Compiler compiler;
     initCompiler(&compiler, type);
 
@@ -924,6 +1620,7 @@ static void function(FunctionType type) {
         emitByte(compiler.upvalues[i].isLocal ? 1 : 0);
         emitByte(compiler.upvalues[i].index);
     }
+    return function;
 }
 
 static void staticMethod() {
@@ -944,10 +1641,12 @@ static void staticMethod() {
 static void method(uint16_t global){
     FunctionType type = TYPE_METHOD;
     if (parser.previous.length == 4 && memcmp(parser.previous.start, "init", 4) == 0) {
+        if (currentClass->isStruct) error("A struct can't have an initializer.");
         type = TYPE_INITIALIZER;
     }
                 
-    function(type);
+    ObjFunction* body = function(type);
+    if (type == TYPE_METHOD) registerInline(&inlineMethods, body);
 
     emitByte(OP_METHOD);
     emitShort(global);
@@ -993,6 +1692,16 @@ static void opOverload(){
         parser.current.length = 1;
         parser.current.type = TOKEN_IDENTIFIER;
     }
+    else if(check(TOKEN_PERCENT)){
+        parser.current.start = "%";
+        parser.current.length = 1;
+        parser.current.type = TOKEN_IDENTIFIER;
+    }
+    else if(check(TOKEN_INS)){
+        parser.current.start = "\\";
+        parser.current.length = 1;
+        parser.current.type = TOKEN_IDENTIFIER;
+    }
 }
 
 static Token syntheticToken(const char* text) {
@@ -1002,7 +1711,12 @@ static Token syntheticToken(const char* text) {
     return token;
 }
 
+#ifndef PRECISE_GC
 #include <gc.h>
+#endif
+
+static void classBody(Token className);
+static bool atTopLevel();
 
 static void classDeclaration() {
     consume(TOKEN_IDENTIFIER, "Expect class name.");
@@ -1016,6 +1730,7 @@ static void classDeclaration() {
 
     ClassCompiler classCompiler;
     classCompiler.hasSuperclass = false;
+    classCompiler.isStruct = false;
     classCompiler.enclosing = currentClass;
     currentClass = &classCompiler;
 
@@ -1036,6 +1751,17 @@ static void classDeclaration() {
         classCompiler.hasSuperclass = true;
     }
 
+    classBody(className);
+
+    if (classCompiler.hasSuperclass) {
+        endScope();
+    }
+
+    currentClass = currentClass->enclosing;
+}
+
+// Compiles the methods, operators and static members between the braces.
+static void classBody(Token className) {
     Chunk new;
     initChunk(&new);
     
@@ -1066,76 +1792,669 @@ static void classDeclaration() {
     
     consume(TOKEN_RIGHT_BRACE, "Expect '}' after class body.");
     emitByte(OP_POP);
+}
 
-    if (classCompiler.hasSuperclass) {
-        endScope();
-    }
+// Remembers a struct's fields so locals built from it can be sunk.
+static void registerStruct(Token name, ObjList* fields) {
+    ObjString* key = copyString(name.start, name.length);
+    Value existing;
+    tableSet(&compileStructs, key, tableGet(&compileStructs, key, &existing) ? NIL_VAL : OBJ_VAL(fields));
+}
+
+// `struct Vec2(x, y) { ... }` is a class whose instances hold exactly
+// these fields, in place of a field table. Vec2(1, 2) sets them once and
+// they can't be assigned afterwards. Two structs are equal when their
+// fields are.
+static void structDeclaration() {
+    consume(TOKEN_IDENTIFIER, "Expect struct name.");
+    Token structName = parser.previous;
+    uint16_t nameConstant = identifierConstant(&parser.previous);
+    declareVariable();
+
+    emitByte(OP_CLASS);
+    emitShort(nameConstant);
+
+    consume(TOKEN_LEFT_PAREN, "Expect '(' after struct name.");
+    ObjList* fields = newList();
+    do {
+        consume(TOKEN_IDENTIFIER, "Expect field name.");
+        if (fields->elements.count == 255) error("Can't have more than 255 fields.");
+        uint16_t field = identifierConstant(&parser.previous);
+        emitByte(OP_FIELD);
+        emitShort(field);
+        writeValueArray(&fields->elements, currentChunk()->constants.values[field]);
+    } while (match(TOKEN_COMMA));
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after struct fields.");
+    defineVariable(nameConstant);
+    if (atTopLevel()) registerStruct(structName, fields);
+
+    ClassCompiler classCompiler;
+    classCompiler.hasSuperclass = false;
+    classCompiler.isStruct = true;
+    classCompiler.enclosing = currentClass;
+    currentClass = &classCompiler;
+
+    classBody(structName);
 
     currentClass = currentClass->enclosing;
 }
 
 
+static bool atTopLevel() {
+    return current->type == TYPE_SCRIPT && current->scopeDepth == 0;
+}
+
 static void funDeclaration() {
     uint16_t global = parseVariable("Expect function name.");
     markInitialized();
-    function(TYPE_FUNCTION);
+    ObjFunction* body = function(TYPE_FUNCTION);
+    if (atTopLevel()) registerInline(&inlineFunctions, body);
     emitByte(OP_DISPATCH);
     defineVariable(global);
 }
 
-static void varDeclaration() {
-    uint16_t global = parseVariable("Expect variable name.");
-
-    if(match(TOKEN_COLON)) consumeTypeHint();
-
-    if (match(TOKEN_EQUAL)) {
-        expression();
-    } else {
-        emitByte(OP_NIL);
+// `var a, b = f();` takes the values f returns, or the elements of the
+// list it returns, one per variable.
+// Allocation sinking. A local initialized as `var p = Point(x, y);`, with
+// Point a struct declared at the top level, or as `var p = [x, y];` can
+// keep its fields in the slots after its own. Reads of p.x or p[0] become
+// local reads, and nothing is allocated unless p escapes. A struct can
+// escape once outside any loop, which builds it there. A list can't
+// escape, because a copy would lose its identity.
+
+// Which field the tokens after a sunk local read, counting from 1, or 0
+// when they aren't a read of one of its fields.
+static int sunkField(ObjList* fields, int count, Token* after) {
+    if (fields != NULL) {
+        if (after[0].type != TOKEN_DOT || after[1].type != TOKEN_IDENTIFIER) return 0;
+        if (after[2].type == TOKEN_LEFT_PAREN || after[2].type == TOKEN_EQUAL) return 0;
+        for (int i = 0; i < count; i++) {
+            ObjString* field = AS_STRING(fields->elements.values[i]);
+            if (field->length == after[1].length && memcmp(field->chars, after[1].start, field->length) == 0) {
+                return i + 1;
+            }
+        }
+        return 0;
     }
-    consume(TOKEN_SEMICOLON,
-            "Expect ';' after variable declaration.");
 
-    defineVariable(global);
+    if (after[0].type != TOKEN_LEFT_BRACKET || after[1].type != TOKEN_NUMBER ||
+        after[2].type != TOKEN_RIGHT_BRACKET || after[3].type == TOKEN_EQUAL) {
+        return 0;
+    }
+    double index = strtod(after[1].start, NULL);
+    return index >= 0 && index < count && index == (int)index ? (int)index + 1 : 0;
 }
 
-static void expressionStatement() {
-    expression();
-    consume(TOKEN_SEMICOLON, "Expect ';' after expression.");
-    emitByte(OP_POP);
+static bool declaredLocally(Token* name) {
+    for (Compiler* compiler = current; compiler != NULL; compiler = compiler->enclosing) {
+        for (int i = 0; i < compiler->localCount; i++) {
+            if (identifiersEqual(name, &compiler->locals[i].name)) return true;
+        }
+    }
+    return false;
 }
 
-static void forStatement() {
-    beginScope();
-    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
-
-    if (match(TOKEN_SEMICOLON)) {
-    } else if (match(TOKEN_VAR)) {
-        varDeclaration();
-    } else {
-        expressionStatement();
+// Counts the fields of a `Struct(...)` or `[...]` initializer that ends the
+// declaration, reading tokens from the scanner. Returns 0 for any other.
+// A bare name in a method may be a field of the receiver, so structs are
+// only sunk outside classes.
+static int scanInitializer(ObjList** fields) {
+    *fields = NULL;
+    if (parser.current.type == TOKEN_IDENTIFIER) {
+        Value value;
+        if (currentClass != NULL || declaredLocally(&parser.current) ||
+            !tableGet(&compileStructs, copyString(parser.current.start, parser.current.length), &value) ||
+            IS_NIL(value) || scanToken().type != TOKEN_LEFT_PAREN) {
+            return 0;
+        }
+        *fields = AS_LIST(value);
+    } else if (parser.current.type != TOKEN_LEFT_BRACKET) {
+        return 0;
     }
 
-    int loopStart = currentChunk()->count;
-    int exitJump = -1;
-
-    if (!match(TOKEN_SEMICOLON)) {
-        expression();
-        consume(TOKEN_SEMICOLON, "Expect ';' after condition.");
-        exitJump = emitJump(OP_JUMP_IF_FALSE);
-        emitByte(OP_POP);
+    int commas = 0;
+    int depth = 0;
+    bool empty = true;
+    for (;;) {
+        Token token = scanToken();
+        if (token.type == TOKEN_EOF || token.type == TOKEN_ERROR) return 0;
+        if (token.type == TOKEN_LEFT_PAREN || token.type == TOKEN_LEFT_BRACKET || token.type == TOKEN_LEFT_BRACE) {
+            depth++;
+        } else if (token.type == TOKEN_RIGHT_PAREN || token.type == TOKEN_RIGHT_BRACKET ||
+                   token.type == TOKEN_RIGHT_BRACE) {
+            if (depth-- == 0) break;
+        } else if (token.type == TOKEN_COMMA && depth == 0) {
+            commas++;
+        }
+        empty = false;
     }
+    if (empty || scanToken().type != TOKEN_SEMICOLON) return 0;
+    return commas + 1;
+}
 
-    int bodyJump = -1;
-    int incrementStart = -1;
-    int continueTarget;
-
-    if (!match(TOKEN_RIGHT_PAREN)) {
+static void scanBlock(Token first) {
+    blockTokenCount = 0;
+    int depth = 0;
+    for (Token token = first;; token = scanToken()) {
+        if (blockTokenCount + 4 >= blockTokenCapacity) {
+            int oldCapacity = blockTokenCapacity;
+            blockTokenCapacity = GROW_CAPACITY(oldCapacity);
+            blockTokens = GROW_ARRAY(Token, blockTokens, oldCapacity, blockTokenCapacity);
+        }
+        blockTokens[blockTokenCount++] = token;
+        if (token.type == TOKEN_EOF || token.type == TOKEN_ERROR) break;
+        if (token.type == TOKEN_LEFT_BRACE) depth++;
+        if (token.type == TOKEN_RIGHT_BRACE && depth-- == 0) break;
+    }
+    for (int i = 0; i < 4; i++) blockTokens[blockTokenCount + i].type = TOKEN_EOF;
+}
+
+// Finds the scanned token at the same place in the source as `first`,
+// scanning its block when it isn't there.
+static Token* blockTokensFrom(Token first) {
+    int low = 0;
+    int high = blockTokenCount - 1;
+    while (low <= high) {
+        int middle = (low + high) / 2;
+        uintptr_t start = (uintptr_t)blockTokens[middle].start;
+        if (start == (uintptr_t)first.start) return &blockTokens[middle];
+        if (start < (uintptr_t)first.start) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+    scanBlock(first);
+    return blockTokens;
+}
+
+// Checks the rest of the block for uses the sunk fields can't serve.
+// `looped` is set when the local already lives in a loop.
+static bool scanUses(Token* name, ObjList* fields, int count, bool looped) {
+    Token* tokens = blockTokensFrom(scanToken());
+    int reads = 0;
+    int escapes = 0;
+    int depth = 0;
+    for (int i = 0;; i++) {
+        switch (tokens[i].type) {
+            case TOKEN_EOF:
+            case TOKEN_ERROR:
+            case TOKEN_FUN:
+            case TOKEN_LAMBDA:
+            case TOKEN_CLASS:
+            case TOKEN_STRUCT:
+                return false;
+            case TOKEN_LEFT_BRACE:
+                depth++;
+                break;
+            case TOKEN_RIGHT_BRACE:
+                if (depth-- == 0) return reads > 0;
+                break;
+            case TOKEN_FOR:
+            case TOKEN_WHILE:
+                looped = true;
+                break;
+            case TOKEN_IDENTIFIER: {
+                if (!identifiersEqual(&tokens[i], name) || (i > 0 && tokens[i - 1].type == TOKEN_DOT)) break;
+                if ((i > 0 && tokens[i - 1].type == TOKEN_VAR) || tokens[i + 1].type == TOKEN_EQUAL) {
+                    return false;
+                } else if (sunkField(fields, count, &tokens[i + 1]) > 0) {
+                    reads++;
+                    i += fields != NULL ? 2 : 3;
+                } else if (fields == NULL || looped || ++escapes > 1) {
+                    return false;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+// Returns the number of fields the local being declared can be sunk into,
+// or 0 to allocate it as usual. A sunk struct takes one more slot after
+// its fields for the flag OP_SINK leaves.
+static int sinkableFields(Token* name, ObjList** fields, bool looped) {
+    Scanner* scanner = getScanner();
+    Scanner saved = *scanner;
+    int count = scanInitializer(fields);
+    if (count > 0 && (current->localCount + count + 1 >= UINT8_COUNT ||
+                      (*fields != NULL && count != (*fields)->elements.count) ||
+                      !scanUses(name, *fields, count, looped))) {
+        count = 0;
+    }
+    *scanner = saved;
+    return count;
+}
+
+// Compiles the initializer of a single local into its fields when it can
+// be sunk. OP_SINK checks at runtime that the struct is still the one
+// whose fields were counted. If it is, it pushes true and skips the call
+// after it. If not, the call builds the value as usual and the padding
+// after it fills the field slots, ending with false.
+static bool sinkInitializer(int count, bool looped) {
+    if (count != 1 || current->scopeDepth == 0) return false;
+
+    int slot = current->localCount - 1;
+    ObjList* fields;
+    int fieldCount = sinkableFields(&current->locals[slot].name, &fields, looped);
+    if (fieldCount == 0) return false;
+
+    if (fields != NULL) {
+        advance();
+        uint16_t name = identifierConstant(&parser.previous);
+        emitByte(OP_GET_GLOBAL);
+        emitShort(name);
+        consume(TOKEN_LEFT_PAREN, "Expect '(' after struct name.");
+        argumentList();
+        emitByte(OP_SINK);
+        emitShort(name);
+        emitByte(fieldCount);
+        emitBytes(OP_CALL, fieldCount);
+        for (int i = 0; i < fieldCount; i++) emitByte(OP_NIL);
+        emitByte(OP_FALSE);
+    } else {
+        advance();
+        emitByte(OP_NIL);
+        do {
+            expression();
+        } while (match(TOKEN_COMMA));
+        consume(TOKEN_RIGHT_BRACKET, "Expect ']' after list elements.");
+    }
+
+    current->locals[slot].sunk = fieldCount;
+    current->locals[slot].fields = fields;
+    for (int i = 0; i < fieldCount; i++) addLocal(syntheticToken(""));
+    if (fields != NULL) addLocal(syntheticToken(""));
+    return true;
+}
+
+// Reads a field of a sunk local from its slot, or builds the value where
+// it escapes. For a struct, OP_GET_SUNK does either when OP_SINK left
+// true, and skips the generic read of the local after it.
+static void sunkVariable(int slot) {
+    Local* local = &current->locals[slot];
+    Scanner* scanner = getScanner();
+    Scanner saved = *scanner;
+    Token after[4];
+    after[0] = parser.current;
+    for (int i = 1; i < 4; i++) after[i] = scanToken();
+    *scanner = saved;
+
+    int field = sunkField(local->fields, local->sunk, after);
+    if (local->fields == NULL) {
+        if (field > 0) {
+            for (int i = 3; i > 0; i--) advance();
+            emitBytes(OP_GET_LOCAL, slot + field);
+            return;
+        }
+        for (int i = 1; i <= local->sunk; i++) emitBytes(OP_GET_LOCAL, slot + i);
+        emitBytes(OP_LIST, local->sunk);
+        return;
+    }
+
+    emitByte(OP_GET_SUNK);
+    emitBytes(slot, local->sunk);
+    emitByte(field);
+    emitBytes(OP_GET_LOCAL, slot);
+    if (field > 0) {
+        advance();
+        advance();
+        emitByte(OP_GET_PROPERTY);
+        emitShort(identifierConstant(&parser.previous));
+    }
+}
+
+// `looped` is set for the initializer of a for loop, whose variable lives
+// through every iteration.
+static void varDeclaration(bool looped) {
+    uint16_t globals[UINT8_COUNT];
+    int count = 0;
+    do {
+        if (count == UINT8_COUNT - 1) {
+            error("Can't declare more than 255 variables at once.");
+            break;
+        }
+        globals[count++] = parseVariable("Expect variable name.");
+        if(match(TOKEN_COLON)) consumeTypeHint();
+    } while (match(TOKEN_COMMA));
+
+    int first = current->localCount - count;
+    if (match(TOKEN_EQUAL)) {
+        if (!sinkInitializer(count, looped)) {
+            expression();
+            if (count > 1) emitBytes(OP_UNPACK, count);
+        }
+    } else {
+        for (int i = 0; i < count; i++) emitByte(OP_NIL);
+    }
+    consume(TOKEN_SEMICOLON,
+            "Expect ';' after variable declaration.");
+
+    if (current->scopeDepth > 0) {
+        for (int i = first; i < current->localCount; i++) {
+            current->locals[i].depth = current->scopeDepth;
+        }
+        return;
+    }
+    for (int i = count - 1; i >= 0; i--) defineVariable(globals[i]);
+}
+
+static void constDeclaration() {
+    consume(TOKEN_IDENTIFIER, "Expect constant name.");
+    Token name = parser.previous;
+    if (!atTopLevel()) error("Constants must be declared at the top level.");
+
+    consume(TOKEN_EQUAL, "Expect '=' after constant name.");
+    int start = currentChunk()->count;
+    expression();
+    consume(TOKEN_SEMICOLON, "Expect ';' after constant declaration.");
+
+    Value value;
+    if (!constantSince(start, &value)) {
+        error("Constant initializer must be a constant expression.");
+        return;
+    }
+    dropConstant(start);
+
+    ObjString* key = copyString(name.start, name.length);
+    Value existing;
+    if (tableGet(&compileConstants, key, &existing)) {
+        errorAt(&name, "Already a constant with this name.");
+        return;
+    }
+    tableSet(&compileConstants, key, value);
+}
+
+static void enumDeclaration() {
+    consume(TOKEN_IDENTIFIER, "Expect enum name.");
+    Token name = parser.previous;
+    if (!atTopLevel()) error("Enums must be declared at the top level.");
+
+    tableSet(&compileEnums, copyString(name.start, name.length), NIL_VAL);
+    consume(TOKEN_LEFT_BRACE, "Expect '{' before enum body.");
+
+    double next = 0;
+    while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
+        consume(TOKEN_IDENTIFIER, "Expect enum member name.");
+        Token member = parser.previous;
+
+        if (match(TOKEN_EQUAL)) {
+            int start = currentChunk()->count;
+            expression();
+
+            Value value;
+            if (constantSince(start, &value) && IS_NUMBER(value)) {
+                next = AS_NUMBER(value);
+                dropConstant(start);
+            } else {
+                error("Enum value must be a constant number.");
+                rewindChunk(start);
+            }
+        }
+
+        tableSet(&compileConstants, enumMemberName(&name, &member), NUMBER_VAL(next++));
+        if (!match(TOKEN_COMMA)) break;
+    }
+
+    consume(TOKEN_RIGHT_BRACE, "Expect '}' after enum body.");
+}
+
+static void expressionStatement() {
+    expression();
+    consume(TOKEN_SEMICOLON, "Expect ';' after expression.");
+    emitByte(OP_POP);
+}
+
+// Compiles a statement that can never run and throws its code away.
+static void deadStatement() {
+    int start = currentChunk()->count;
+    int breakCount = loopDepth > 0 ? loopStack[loopDepth - 1].breakCount : 0;
+    int imports = importedCount;
+
+    statement();
+
+    rewindChunk(start);
+    if (loopDepth > 0) loopStack[loopDepth - 1].breakCount = breakCount;
+    importedCount = imports;
+}
+
+// True when the for clauses read 'var name in ...' or 'name in ...'.
+static bool forInAhead() {
+    Scanner saved = *getScanner();
+    Parser savedParser = parser;
+
+    match(TOKEN_VAR);
+    bool forIn = false;
+    if (match(TOKEN_IDENTIFIER)) {
+        forIn = check(TOKEN_IDENTIFIER) && parser.current.length == 2 &&
+                memcmp(parser.current.start, "in", 2) == 0;
+    }
+
+    *getScanner() = saved;
+    parser = savedParser;
+    return forIn;
+}
+
+static void invokeLocal(int slot, const char* method) {
+    emitBytes(OP_GET_LOCAL, (uint8_t)slot);
+    emitByte(OP_INVOKE);
+    emitShort(makeConstant(OBJ_VAL(copyString(method, (int)strlen(method)))));
+    emitByte(0);
+}
+
+// Lists, strings and numbers are walked by OP_FOR_ITER. Anything else takes
+// the fallback path through iterator(), hasNext() and next().
+static void forInStatement() {
+    match(TOKEN_VAR);
+    consume(TOKEN_IDENTIFIER, "Expect loop variable name.");
+    Token name = parser.previous;
+    advance(); // 'in'
+
+    beginScope();
+    expression();
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after for-in sequence.");
+
+    addLocal(syntheticToken("(sequence)"));
+    markInitialized();
+    int sequence = current->localCount - 1;
+
+    // The cursor is the next index, or true once iterator() has been called.
+    emitByte(OP_NIL);
+    addLocal(syntheticToken("(cursor)"));
+    markInitialized();
+
+    int loopStart = currentChunk()->count;
+    emitBytes(OP_FOR_ITER, (uint8_t)sequence);
+    int exitJump = currentChunk()->count;
+    emitShort(UINT16_MAX);
+    int fallbackJump = currentChunk()->count;
+    emitShort(UINT16_MAX);
+
+    int prevContinue = continueJumpOffset;
+    continueJumpOffset = loopStart;
+    beginLoop(); // break support
+
+    int bodyStart = currentChunk()->count;
+    beginScope();
+    addLocal(name);
+    markInitialized();
+    statement(); // loop body
+    endScope();
+    emitLoop(loopStart);
+
+    patchJump(fallbackJump);
+    emitBytes(OP_GET_LOCAL, (uint8_t)(sequence + 1));
+    int startJump = emitJump(OP_JUMP_IF_FALSE);
+    emitByte(OP_POP);
+    invokeLocal(sequence, "hasNext");
+    int doneJump = emitJump(OP_JUMP_IF_FALSE);
+    emitByte(OP_POP);
+    invokeLocal(sequence, "next");
+    emitLoop(bodyStart);
+
+    patchJump(startJump);
+    emitByte(OP_POP);
+    invokeLocal(sequence, "iterator");
+    emitBytes(OP_SET_LOCAL, (uint8_t)sequence);
+    emitByte(OP_POP);
+    emitByte(OP_TRUE);
+    emitBytes(OP_SET_LOCAL, (uint8_t)(sequence + 1));
+    emitByte(OP_POP);
+    emitLoop(loopStart);
+
+    patchJump(doneJump);
+    emitByte(OP_POP);
+
+    // Both OP_FOR_ITER offsets count from the end of the instruction,
+    // which is one operand past the exit offset.
+    patchJumpTo(exitJump, currentChunk()->count - 2);
+
+    continueJumpOffset = prevContinue;
+    endLoop(currentChunk()->count); // patch breaks
+    endScope();
+}
+
+// The parts of `for (...; i < limit; i = i + step)` that OP_FOR_STEP runs itself.
+typedef struct {
+    uint8_t slot;
+    uint8_t limitKind;   // 0 local, 1 constant, 2 global
+    uint16_t limit;
+    uint16_t step;
+    uint8_t compare;     // 0 <, 1 <=, 2 >, 3 >=
+} CountedLoop;
+
+// Matches `GET_LOCAL i; limit; LESS|GREATER [NOT]` over [start, end).
+static bool countedCondition(int start, int end, CountedLoop* loop) {
+    uint8_t* code = currentChunk()->code + start;
+    int length = end - start;
+    if (length < 5 || code[0] != OP_GET_LOCAL) return false;
+
+    loop->slot = code[1];
+    int at = 2;
+    switch (code[at]) {
+        case OP_GET_LOCAL:
+            loop->limitKind = 0;
+            loop->limit = code[at + 1];
+            at += 2;
+            break;
+        case OP_CONSTANT:
+            loop->limitKind = 1;
+            loop->limit = readShortAt(&code[at + 1]);
+            if (!IS_NUMBER(currentChunk()->constants.values[loop->limit])) return false;
+            at += 3;
+            break;
+        case OP_GET_GLOBAL:
+            loop->limitKind = 2;
+            loop->limit = readShortAt(&code[at + 1]);
+            at += 3;
+            break;
+        default:
+            return false;
+    }
+
+    if (at >= length || (code[at] != OP_LESS && code[at] != OP_GREATER)) return false;
+    bool negated = at + 2 == length && code[at + 1] == OP_NOT;
+    if (at + 1 != length && !negated) return false;
+
+    // `<=` is emitted as GREATER NOT and `>=` as LESS NOT.
+    if (code[at] == OP_LESS) loop->compare = negated ? 3 : 0;
+    else loop->compare = negated ? 1 : 2;
+    return true;
+}
+
+// Matches `GET_LOCAL i; CONSTANT step; ADD|SUBTRACT; SET_LOCAL i; POP` over [start, end).
+// The postfix `i++` form adds `CONSTANT 1; SUBTRACT` before the POP, which only
+// rebuilds the discarded old value and has no effect on a numeric counter.
+static bool countedIncrement(int start, int end, CountedLoop* loop) {
+    uint8_t* code = currentChunk()->code + start;
+    Value* constants = currentChunk()->constants.values;
+    int length = end - start;
+    if (length != 9 && length != 13) return false;
+    if (code[0] != OP_GET_LOCAL || code[1] != loop->slot || code[2] != OP_CONSTANT ||
+        (code[5] != OP_ADD && code[5] != OP_SUBTRACT) ||
+        code[6] != OP_SET_LOCAL || code[7] != loop->slot || code[length - 1] != OP_POP) return false;
+
+    if (length == 13 && (code[8] != OP_CONSTANT || !IS_NUMBER(constants[readShortAt(&code[9])]) ||
+                         (code[11] != OP_ADD && code[11] != OP_SUBTRACT))) return false;
+
+    Value step = constants[readShortAt(&code[3])];
+    if (!IS_NUMBER(step)) return false;
+
+    if (code[5] == OP_ADD) loop->step = readShortAt(&code[3]);
+    else loop->step = makeConstant(NUMBER_VAL(-AS_NUMBER(step)));
+    return true;
+}
+
+// Both targets are backward distances from the end of the 12-byte instruction.
+static void emitCountedLoop(CountedLoop* loop, int bodyStart, int incrementStart) {
+    int end = currentChunk()->count + 12;
+    if (end - bodyStart > UINT16_MAX) error("Loop body too large.");
+
+    emitBytes(OP_FOR_STEP, loop->slot);
+    emitByte(loop->limitKind);
+    emitShort(loop->limit);
+    emitShort(loop->step);
+    emitByte(loop->compare);
+    emitShort(end - bodyStart);
+    emitShort(end - incrementStart);
+}
+
+static void forStatement() {
+    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+    if (forInAhead()) {
+        forInStatement();
+        return;
+    }
+
+    beginScope();
+
+    if (match(TOKEN_SEMICOLON)) {
+    } else if (match(TOKEN_VAR)) {
+        varDeclaration(true);
+    } else {
+        expressionStatement();
+    }
+
+    int loopStart = currentChunk()->count;
+    int exitJump = -1;
+    int conditionStart = loopStart;
+    int conditionEnd = -1;
+    bool deadLoop = false;
+    int imports = importedCount;
+
+    if (!match(TOKEN_SEMICOLON)) {
+        expression();
+        consume(TOKEN_SEMICOLON, "Expect ';' after condition.");
+
+        Value condition;
+        if (constantSince(conditionStart, &condition)) {
+            dropConstant(conditionStart);
+            deadLoop = isFalseyConstant(condition);
+        } else {
+            conditionEnd = currentChunk()->count;
+            exitJump = emitJump(OP_JUMP_IF_FALSE);
+            emitByte(OP_POP);
+        }
+    }
+
+    int bodyJump = -1;
+    int incrementStart = -1;
+    int continueTarget;
+    CountedLoop loop;
+    bool counted = false;
+
+    if (!match(TOKEN_RIGHT_PAREN)) {
         bodyJump = emitJump(OP_JUMP);
         incrementStart = currentChunk()->count;
         expression();
         emitByte(OP_POP);
         consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
+
+        counted = exitJump != -1 &&
+                  countedCondition(conditionStart, conditionEnd, &loop) &&
+                  countedIncrement(incrementStart, currentChunk()->count, &loop);
         emitLoop(loopStart);
         loopStart = incrementStart;
         patchJump(bodyJump);
@@ -1148,18 +2467,36 @@ static void forStatement() {
     int prevContinue = continueJumpOffset;
     continueJumpOffset = continueTarget;
 
+    int bodyStart = currentChunk()->count;
     beginLoop(); // break support
     statement(); // loop body
-    emitLoop(loopStart);
 
-    if (exitJump != -1) {
+    if (counted) {
+        // The VM steps and tests the counter itself, leaving the increment
+        // and condition above for `continue` and non-numeric counters.
+        emitCountedLoop(&loop, bodyStart, incrementStart);
+        int skipExit = emitJump(OP_JUMP);
         patchJump(exitJump);
         emitByte(OP_POP);
+        patchJump(skipExit);
+    } else {
+        emitLoop(loopStart);
+
+        if (exitJump != -1) {
+            patchJump(exitJump);
+            emitByte(OP_POP);
+        }
     }
 
     continueJumpOffset = prevContinue;
 
     endLoop(currentChunk()->count); // patch breaks
+
+    // The condition is constant false, so only the initializer survives.
+    if (deadLoop) {
+        rewindChunk(conditionStart);
+        importedCount = imports;
+    }
     endScope();
 }
 
@@ -1174,9 +2511,22 @@ static void throwStatement() {
 
 static void ifStatement() {
     consume(TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
+    int conditionStart = currentChunk()->count;
     expression();
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
+    Value condition;
+    if (constantSince(conditionStart, &condition)) {
+        dropConstant(conditionStart);
+        bool taken = !isFalseyConstant(condition);
+
+        if (taken) statement(); else deadStatement();
+        if (match(TOKEN_ELSE)) {
+            if (taken) deadStatement(); else statement();
+        }
+        return;
+    }
+
     int thenJump = emitJump(OP_JUMP_IF_FALSE);
     emitByte(OP_POP);
     statement();
@@ -1212,6 +2562,41 @@ static void printlnStatement() {
     consume(TOKEN_SEMICOLON, "Expected ';'.");
 }
 
+// A call whose value is returned straight away can reuse the caller's
+// frame. The OP_RETURN after it still runs if the callee is native or the
+// call sits inside a try block.
+static void markTailCall() {
+    Chunk* chunk = currentChunk();
+    int offset = current->lastCall;
+    if (offset < 0) return;
+
+    uint8_t* code = &chunk->code[offset];
+    if (code[0] == OP_CALL && offset + 2 == chunk->count) {
+        code[0] = OP_TAIL_CALL;
+    } else if (code[0] == OP_INVOKE && offset + 4 == chunk->count) {
+        code[0] = OP_TAIL_INVOKE;
+    } else {
+        return;
+    }
+
+    // If that call falls back from an inlined body, the calls the body
+    // returns straight away are in tail position as well.
+    int guard = current->lastInline;
+    if (guard < 0) return;
+    int operand = guard + (chunk->code[guard] == OP_INLINE_GUARD ? 4 : 6);
+    if (operand + 2 + readShortAt(&chunk->code[operand]) != offset) return;
+
+    for (int at = operand + 2; at < offset;) {
+        uint8_t instruction = chunk->code[at];
+        int length = instruction == OP_PEEK || instruction == OP_INLINE_RETURN ? 2 : inlineLength(instruction);
+        if (chunk->code[at + length] == OP_INLINE_RETURN) {
+            if (instruction == OP_CALL) chunk->code[at] = OP_TAIL_CALL;
+            if (instruction == OP_INVOKE) chunk->code[at] = OP_TAIL_INVOKE;
+        }
+        at += length;
+    }
+}
+
 static void returnStatement() {
     if (current->type == TYPE_SCRIPT) {
         error("Can't return from top-level code.");
@@ -1225,7 +2610,20 @@ static void returnStatement() {
         }
 
         expression();
+        int count = 1;
+        while (match(TOKEN_COMMA)) {
+            if (count == UINT8_COUNT - 1) error("Can't return more than 255 values.");
+            expression();
+            count++;
+        }
         consume(TOKEN_SEMICOLON, "Expect ';' after return value.");
+
+        // Several values stay on the stack for the caller to unpack.
+        if (count > 1) {
+            emitBytes(OP_RETURN_VALUES, count);
+            return;
+        }
+        markTailCall();
         emitByte(OP_RETURN);
     }
 }
@@ -1243,6 +2641,22 @@ static void whileStatement() {
     expression(); // condition
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
+    Value condition;
+    if (constantSince(loopStart, &condition)) {
+        dropConstant(loopStart);
+
+        if (isFalseyConstant(condition)) {
+            deadStatement();
+        } else {
+            statement();
+            emitLoop(loopStart);
+        }
+
+        endLoop(currentChunk()->count);
+        continueJumpOffset = prevContinue;
+        return;
+    }
+
     int exitJump = emitJump(OP_JUMP_IF_FALSE);
     emitByte(OP_POP); // Pop condition result
 
@@ -1258,6 +2672,165 @@ static void whileStatement() {
     continueJumpOffset = prevContinue; // restore previous continue target
 }
 
+#define MAX_SWITCH_CASES 256
+
+typedef struct {
+    Value label;
+    int body;
+} SwitchCase;
+
+// Dispatch is emitted after the case bodies, so targets are backward
+// distances from the end of the instruction. A distance of 0 leaves the switch.
+static void emitSwitchTarget(int end, int body) {
+    int distance = body == -1 ? 0 : end - body;
+    if (distance > UINT16_MAX) {
+        error("Too much code to jump over.");
+    }
+    emitShort((uint16_t)distance);
+}
+
+// Integer labels that fill at least half of their range get a jump table.
+static bool denseSwitch(SwitchCase* cases, int count, int* min, int* span) {
+    if (count == 0) return false;
+
+    double lo = 0, hi = 0;
+    for (int i = 0; i < count; i++) {
+        if (!IS_NUMBER(cases[i].label)) return false;
+        double n = AS_NUMBER(cases[i].label);
+        if (n < INT32_MIN || n > INT32_MAX || n != (int)n) return false;
+        if (i == 0 || n < lo) lo = n;
+        if (i == 0 || n > hi) hi = n;
+    }
+
+    if (hi - lo + 1 > count * 2) return false;
+    *min = (int)lo;
+    *span = (int)(hi - lo) + 1;
+    return true;
+}
+
+static void emitSwitchDispatch(SwitchCase* cases, int count, int defaultBody) {
+    int min, span;
+
+    if (denseSwitch(cases, count, &min, &span)) {
+        int end = currentChunk()->count + 7 + span * 2;
+        emitByte(OP_SWITCH_TABLE);
+        emitShort(makeConstant(NUMBER_VAL(min)));
+        emitShort((uint16_t)span);
+        emitSwitchTarget(end, defaultBody);
+
+        for (int slot = 0; slot < span; slot++) {
+            int body = defaultBody;
+            for (int i = 0; i < count; i++) {
+                if (AS_NUMBER(cases[i].label) == min + slot) body = cases[i].body;
+            }
+            emitSwitchTarget(end, body);
+        }
+        return;
+    }
+
+    // Strings and sparse labels go in a hash table with at least twice as
+    // many slots as keys, probed linearly from switchKeyHash.
+    int capacity = 2;
+    while (capacity < count * 2) capacity *= 2;
+    uint16_t keys[MAX_SWITCH_CASES * 2];
+    int bodies[MAX_SWITCH_CASES * 2];
+    for (int slot = 0; slot < capacity; slot++) keys[slot] = SWITCH_EMPTY_SLOT;
+
+    for (int i = 0; i < count; i++) {
+        int constant = makeConstant(cases[i].label);
+        if (constant == SWITCH_EMPTY_SLOT) error("Too many constants in one chunk.");
+        int slot = switchKeyHash(cases[i].label) & (capacity - 1);
+        while (keys[slot] != SWITCH_EMPTY_SLOT) slot = (slot + 1) & (capacity - 1);
+        keys[slot] = (uint16_t)constant;
+        bodies[slot] = cases[i].body;
+    }
+
+    int end = currentChunk()->count + 5 + capacity * 4;
+    emitByte(OP_SWITCH_HASH);
+    emitShort((uint16_t)capacity);
+    emitSwitchTarget(end, defaultBody);
+
+    for (int slot = 0; slot < capacity; slot++) {
+        emitShort(keys[slot]);
+        emitSwitchTarget(end, keys[slot] == SWITCH_EMPTY_SLOT ? defaultBody : bodies[slot]);
+    }
+}
+
+static void switchStatement() {
+    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'switch'.");
+    expression();
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after switch value.");
+    consume(TOKEN_LEFT_BRACE, "Expect '{' before switch body.");
+
+    // The value waits on the stack while the case bodies are jumped over.
+    int dispatchJump = emitJump(OP_JUMP);
+
+    SwitchCase cases[MAX_SWITCH_CASES];
+    int caseCount = 0;
+    int exitJumps[MAX_SWITCH_CASES];
+    int exitCount = 0;
+    int defaultBody = -1;
+
+    beginLoop(); // break support
+    loopStack[loopDepth - 1].isSwitch = true;
+
+    while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
+        int body = currentChunk()->count;
+
+        if (match(TOKEN_DEFAULT)) {
+            if (defaultBody != -1) error("Switch can only have one default.");
+            defaultBody = body;
+        } else {
+            consume(TOKEN_CASE, "Expect 'case' or 'default' in switch.");
+            do {
+                int labelStart = currentChunk()->count;
+                expression();
+
+                Value label;
+                if (!constantSince(labelStart, &label)) {
+                    error("Case label must be a constant.");
+                    break;
+                }
+                dropConstant(labelStart);
+
+                for (int i = 0; i < caseCount; i++) {
+                    if (valuesEqual(cases[i].label, label)) error("Duplicate case label.");
+                }
+                if (caseCount == MAX_SWITCH_CASES) {
+                    error("Too many cases in switch.");
+                    break;
+                }
+                cases[caseCount].label = label;
+                cases[caseCount++].body = body;
+            } while (match(TOKEN_COMMA));
+        }
+        consume(TOKEN_COLON, "Expect ':' after case.");
+
+        beginScope();
+        while (!check(TOKEN_CASE) && !check(TOKEN_DEFAULT) &&
+               !check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
+            declaration();
+        }
+        endScope();
+
+        // Cases never fall through.
+        if (exitCount == MAX_SWITCH_CASES) {
+            error("Too many cases in switch.");
+            break;
+        }
+        exitJumps[exitCount++] = emitJump(OP_JUMP);
+    }
+    consume(TOKEN_RIGHT_BRACE, "Expect '}' after switch body.");
+
+    patchJump(dispatchJump);
+    emitSwitchDispatch(cases, caseCount, defaultBody);
+
+    for (int i = 0; i < exitCount; i++) {
+        patchJump(exitJumps[i]);
+    }
+    endLoop(currentChunk()->count); // patch breaks
+}
+
 static void tryCatchStatement() {
     int tryStart = currentChunk()->count;
 
@@ -1315,10 +2888,14 @@ static void synchronize() {
         if (parser.previous.type == TOKEN_SEMICOLON) return;
         switch (parser.current.type) {
             case TOKEN_CLASS:
+            case TOKEN_STRUCT:
             case TOKEN_FUN:
             case TOKEN_VAR:
+            case TOKEN_CONST:
+            case TOKEN_ENUM:
             case TOKEN_FOR:
             case TOKEN_IF:
+            case TOKEN_SWITCH:
             case TOKEN_WHILE:
             case TOKEN_PRINT:
             case TOKEN_RETURN:
@@ -1336,10 +2913,16 @@ static void synchronize() {
 static void declaration() {
     if (match(TOKEN_CLASS)) {
         classDeclaration();
+    } else if (match(TOKEN_STRUCT)) {
+        structDeclaration();
     } else if (match(TOKEN_FUN)) {
         funDeclaration();
     } else if (match(TOKEN_VAR)) {
-        varDeclaration();
+        varDeclaration(false);
+    } else if (match(TOKEN_CONST)) {
+        constDeclaration();
+    } else if (match(TOKEN_ENUM)) {
+        enumDeclaration();
     }
     else if(match(TOKEN_SEMICOLON)){
     } else {
@@ -1365,7 +2948,7 @@ void replaceDotsWithSlashes(char* str) {
 
 char* appendStrings(const char* a, const char* b) {
     size_t len = strlen(a) + strlen(b) + 1;
-    char* result = malloc(len);
+    char* result = arenaAlloc(len);
     strcpy(result, a);
     strcat(result, b);
     return result;
@@ -1377,7 +2960,7 @@ char* readFile(const char* path) {
     fseek(f, 0, SEEK_END);
     size_t size = ftell(f);
     rewind(f);
-    char* buffer = malloc(size + 1);
+    char* buffer = arenaAlloc(size + 1);
     fread(buffer, 1, size, f);
     buffer[size] = '\0';
     fclose(f);
@@ -1396,26 +2979,21 @@ char* buildPath(int depth, const char* modulePath) {
 }
 
 char* loadModuleFile(const char* fileName) {
-    char* modulePath = strdup(fileName);
+    char* modulePath = my_strdup(fileName);
     replaceDotsWithSlashes(modulePath);
 
     char* relativePath = appendStrings(modulePath, ".gem");
-    free(modulePath);
 
     // Try from current directory up to some limit (e.g., 10 levels)
     for (int depth = 0; depth < 10; depth++) {
         char* candidate = buildPath(depth, relativePath);
         if (fileExists(candidate)) {
-            char* source = readFile(candidate);
-            free(relativePath);
-            free(candidate);
-            return source;
+            return readFile(candidate);
         }
-        free(candidate);
+        arenaFree(candidate, strlen(candidate) + 1);
     }
 
     fprintf(stderr, "Module not found: %s\n", fileName);
-    free(relativePath);
     return NULL;
 }
 
@@ -1455,12 +3033,15 @@ static void emitJumpTo(uint8_t instruction, int target) {
 
 
 static void continueStatement() {
-    if (loopDepth == 0) {
+    int depth = loopDepth;
+    while (depth > 0 && loopStack[depth - 1].isSwitch) depth--;
+
+    if (depth == 0) {
         error("Cannot use 'continue' outside of a loop.");
         return;
     }
 
-    LoopContext* loop = &loopStack[loopDepth - 1];
+    LoopContext* loop = &loopStack[depth - 1];
 
     int localsToPop = current->localCount - loop->localCount;
     for (int i = 0; i < localsToPop; i++) {
@@ -1472,8 +3053,7 @@ static void continueStatement() {
 }
 
 char* getWindowText() {
-    char* buf = malloc(Window_gem_len + 1);
-    if (!buf) return NULL;
+    char* buf = arenaAlloc(Window_gem_len + 1);
 
     memcpy(buf, Window_gem, Window_gem_len);
     buf[Window_gem_len] = '\0';
@@ -1482,8 +3062,7 @@ char* getWindowText() {
 
 #include "GemMath.h"
 char* getMathText() {
-    char* buf = malloc(Math_gem_len + 1);
-    if (!buf) return NULL;
+    char* buf = arenaAlloc(Math_gem_len + 1);
 
     memcpy(buf, Math_gem, Math_gem_len);
     buf[Math_gem_len] = '\0';
@@ -1589,10 +3168,10 @@ static void statement() {
         importedFiles[importedCount++] = strdup(file);
         
         char* source;
-        if (memcmp(file, "Window", 6) == 0) {
+        if (strncmp(file, "Window", 6) == 0) {
             source = getWindowText();
         }
-        else if (memcmp(file, "Math", 4) == 0){
+        else if (strncmp(file, "Math", 4) == 0){
             source = getMathText();
         }
         else{
@@ -1622,7 +3201,6 @@ static void statement() {
         sc->line = prevLine;
         
         advance();
-        free(source);
     }
     else if (match(TOKEN_PRINTLN)) {
         printlnStatement();
@@ -1632,6 +3210,8 @@ static void statement() {
         forStatement();
     } else if (match(TOKEN_IF)) {
         ifStatement();
+    } else if (match(TOKEN_SWITCH)) {
+        switchStatement();
     }else if (match(TOKEN_BREAK)) {
         breakStatement();
     }else if (match(TOKEN_CONTINUE)) {
@@ -1664,7 +3244,6 @@ static void statement() {
    - preserves "string literals" and // comments
    - expands macros (simple textual macro replacement)
    - desugars ++/-- and +=, -=, *=, /=, %=
-   - desugars for(var x in expr) into a while iterator loop
    Compile: gcc -std=c11 preproc_macro_multiline.c -O2 -o preproc_macro_multiline
 */
 #include <stdio.h>
@@ -1673,15 +3252,13 @@ static void statement() {
 #include <ctype.h>
 #include <time.h>
 
-/* safe strdup/strndup */
-static char* my_strndup(const char* s, int n) {
-    char* p = malloc((size_t)n + 1);
-    if (!p) return NULL;
-    memcpy(p, s, (size_t)n);
-    p[n] = '\0';
-    return p;
+/* index just past the string literal opening at s[i]; a backslash
+   escapes the character after it, including another backslash */
+static int skip_string(const char* s, int i, int n) {
+    int j = i+1;
+    while (j < n && s[j] != '"') j += s[j] == '\\' ? 2 : 1;
+    return j < n ? j+1 : n;
 }
-static char* my_strdup(const char* s) { return my_strndup(s, (int)strlen(s)); }
 
 /* --- Macro table --- */
 typedef struct Macro {
@@ -1692,17 +3269,19 @@ typedef struct Macro {
     struct Macro* next;
 } Macro;
 
+// Macros stay defined for later compilations, so the table lives outside
+// the arena.
 static Macro* macros = NULL;
 
 void add_macro(const char* name, char** params, int param_count, const char* body) {
     Macro* m = malloc(sizeof(Macro));
-    m->name = my_strdup(name);
+    m->name = strdup(name);
     m->param_count = param_count;
     if (param_count > 0) {
         m->params = malloc(sizeof(char*) * param_count);
-        for (int i = 0; i < param_count; ++i) m->params[i] = my_strdup(params[i]);
+        for (int i = 0; i < param_count; ++i) m->params[i] = strdup(params[i]);
     } else m->params = NULL;
-    m->body = my_strdup(body);
+    m->body = strdup(body);
     m->next = macros;
     macros = m;
 }
@@ -1712,11 +3291,20 @@ Macro* find_macro(const char* name) {
     return NULL;
 }
 
+static char* ensure_capacity(char* out, size_t *out_cap, size_t need) {
+    if (*out_cap >= need) return out;
+    size_t newcap = *out_cap;
+    while (newcap < need) newcap *= 2;
+    out = arenaGrow(out, *out_cap, newcap);
+    *out_cap = newcap;
+    return out;
+}
+
 /* expand macro body by replacing parameter identifiers with argument strings */
 char* expand_macro_body(Macro* m, char** args, int argc) {
     if (m->param_count == 0) return my_strdup(m->body);
     size_t cap = strlen(m->body) * 4 + 16;
-    char* out = malloc(cap);
+    char* out = arenaAlloc(cap);
     size_t pos = 0;
     const char* s = m->body;
     while (*s) {
@@ -1727,18 +3315,18 @@ char* expand_macro_body(Macro* m, char** args, int argc) {
             char* ident = my_strndup(s, len);
             int repl = -1;
             for (int k = 0; k < m->param_count; ++k) if (strcmp(ident, m->params[k]) == 0) { repl = k; break; }
+            arenaFree(ident, (size_t)len + 1);
             if (repl >= 0 && repl < argc) {
                 size_t need = strlen(args[repl]);
-                if (pos + need + 1 >= cap) { cap = (cap + need) * 2; out = realloc(out, cap); }
+                out = ensure_capacity(out, &cap, pos + need + 1);
                 memcpy(out + pos, args[repl], need); pos += need;
             } else {
-                if (pos + len + 1 >= cap) { cap = (cap + len) * 2; out = realloc(out, cap); }
+                out = ensure_capacity(out, &cap, pos + len + 1);
                 memcpy(out + pos, s, len); pos += len;
             }
-            free(ident);
             s = p;
         } else {
-            if (pos + 2 >= cap) { cap *= 2; out = realloc(out, cap); }
+            out = ensure_capacity(out, &cap, pos + 2);
             out[pos++] = *s++;
         }
     }
@@ -1797,9 +3385,7 @@ static int forward_find_rhs_end(const char* s, int start_idx, int n) {
     while (i < n) {
         char c = s[i];
         if (c == '"') {
-            int j = i+1;
-            while (j < n) { if (s[j] == '"' && s[j-1] != '\\') { j++; break; } j++; }
-            i = j; continue;
+            i = skip_string(s, i, n); continue;
         }
         if (c == '(') { dp++; i++; continue; }
         if (c == ')') { if (dp>0) { dp--; i++; continue; } break; }
@@ -1814,21 +3400,11 @@ static int forward_find_rhs_end(const char* s, int start_idx, int n) {
     return end;
 }
 
-static char* ensure_capacity(char* out, size_t *out_cap, size_t need) {
-    if (*out_cap >= need) return out;
-    size_t newcap = *out_cap;
-    while (newcap < need) newcap *= 2;
-    char* p = realloc(out, newcap);
-    if (!p) return NULL;
-    *out_cap = newcap;
-    return p;
-}
-
 /* Step 1: strip macros and store them. Supports multiline macro bodies using backslash at line end. */
 char* strip_macros_and_build_table(const char* src) {
     int n = (int)strlen(src);
     size_t cap = (size_t)n + 16;
-    char* out = malloc(cap);
+    char* out = arenaAlloc(cap);
     size_t out_pos = 0;
     int i = 0;
     while (i < n) {
@@ -1850,7 +3426,7 @@ char* strip_macros_and_build_table(const char* src) {
                         int ps = p;
                         while (p < n && (isalnum((unsigned char)src[p]) || src[p] == '_')) p++;
                         if (p > ps) {
-                            params = realloc(params, sizeof(char*) * (param_count + 1));
+                            params = arenaGrow(params, sizeof(char*) * param_count, sizeof(char*) * (param_count + 1));
                             params[param_count++] = my_strndup(src + ps, p - ps);
                         }
                         while (p < n && isspace((unsigned char)src[p])) p++;
@@ -1861,7 +3437,7 @@ char* strip_macros_and_build_table(const char* src) {
                 while (p < n && isspace((unsigned char)src[p])) p++;
                 /* Read body, but support backslash-continuation */
                 size_t body_cap = 256;
-                char* body = malloc(body_cap);
+                char* body = arenaAlloc(body_cap);
                 size_t body_len = 0;
                 int cont = 1;
                 while (p < n && cont) {
@@ -1872,24 +3448,21 @@ char* strip_macros_and_build_table(const char* src) {
                     cont = 0;
                     if (line_end > line_start && src[line_end-1] == '\\') { cont = 1; line_end--; }
                     int addlen = line_end - line_start;
-                    if (body_len + addlen + 1 >= body_cap) { body_cap = (body_cap + addlen) * 2; body = realloc(body, body_cap); }
+                    body = ensure_capacity(body, &body_cap, body_len + addlen + 1);
                     memcpy(body + body_len, src + line_start, addlen); body_len += addlen;
                     if (cont) {
-                        if (body_len + 1 >= body_cap) { body_cap *= 2; body = realloc(body, body_cap); }
+                        body = ensure_capacity(body, &body_cap, body_len + 2);
                         body[body_len++] = ' ';
                     }
                     if (p < n && src[p] == '\n') p++;
                 }
-                if (body_len == 0) { free(body); body = my_strdup(""); }
-                else { body[body_len] = '\0'; body = realloc(body, body_len + 1); }
+                body[body_len] = '\0';
                 add_macro(name, params, param_count, body);
-                free(name); free(body);
-                if (params) { for (int q=0;q<param_count;q++) free(params[q]); free(params); }
                 i = p;
                 continue;
             }
         }
-        if (out_pos + 2 >= cap) { cap = cap * 2 + 16; out = realloc(out, cap); }
+        out = ensure_capacity(out, &cap, out_pos + 2);
         out[out_pos++] = src[i++];
     }
     out[out_pos] = '\0';
@@ -1899,16 +3472,15 @@ char* strip_macros_and_build_table(const char* src) {
 /* Step 2: expand macros (single pass) */
 char* expand_macros_once(const char* src) {
     int n = (int)strlen(src);
-    size_t cap = (size_t)n * 4 + 64;
-    char* out = malloc(cap);
+    size_t cap = (size_t)n + 64;
+    char* out = arenaAlloc(cap);
     size_t out_pos = 0;
     int i = 0;
     while (i < n) {
         if (src[i] == '"') {
-            int j = i+1;
-            while (j < n) { if (src[j] == '"' && src[j-1] != '\\') { j++; break; } j++; }
+            int j = skip_string(src, i, n);
             int slen = j - i;
-            if (out_pos + slen + 1 >= cap) { cap = (cap + slen) * 2; out = realloc(out, cap); }
+            out = ensure_capacity(out, &cap, out_pos + slen + 1);
             memcpy(out + out_pos, src + i, slen); out_pos += slen;
             i = j; continue;
         }
@@ -1916,7 +3488,7 @@ char* expand_macros_once(const char* src) {
             int j = i + 2;
             while (j < n && src[j] != '\n') j++;
             int clen = j - i;
-            if (out_pos + clen + 1 >= cap) { cap = (cap + clen) * 2; out = realloc(out, cap); }
+            out = ensure_capacity(out, &cap, out_pos + clen + 1);
             memcpy(out + out_pos, src + i, clen); out_pos += clen;
             i = j; continue;
         }
@@ -1925,12 +3497,13 @@ char* expand_macros_once(const char* src) {
             while (j < n && (isalnum((unsigned char)src[j]) || src[j] == '_')) j++;
             char* ident = my_strndup(src + i, j - i);
             Macro* m = find_macro(ident);
+            arenaFree(ident, (size_t)(j - i) + 1);
             if (m) {
                 if (m->param_count == 0) {
                     size_t len = strlen(m->body);
-                    if (out_pos + len + 1 >= cap) { cap = (cap + len) * 2; out = realloc(out, cap); }
+                    out = ensure_capacity(out, &cap, out_pos + len + 1);
                     memcpy(out + out_pos, m->body, len); out_pos += len;
-                    i = j; free(ident); continue;
+                    i = j; continue;
                 } else {
                     int k = j;
                     while (k < n && isspace((unsigned char)src[k])) k++;
@@ -1941,55 +3514,49 @@ char* expand_macros_once(const char* src) {
                         char** args = NULL; int argc = 0;
                         for (; k < n; k++) {
                             if (src[k] == '"') {
-                                int q = k+1; while (q < n) { if (src[q] == '"' && src[q-1] != '\\') { q++; break; } q++; }
-                                k = q - 1;
+                                k = skip_string(src, k, n) - 1;
                             } else if (src[k] == '(') depth++;
                             else if (src[k] == ')') {
                                 depth--;
                                 if (depth == 0) {
-                                    if (k > arg_start) {
-                                        args = realloc(args, sizeof(char*) * (argc + 1));
-                                        args[argc++] = my_strndup(src + arg_start, k - arg_start);
-                                    } else {
-                                        args = realloc(args, sizeof(char*) * (argc + 1));
-                                        args[argc++] = my_strdup("");
-                                    }
+                                    args = arenaGrow(args, sizeof(char*) * argc, sizeof(char*) * (argc + 1));
+                                    args[argc++] = my_strndup(src + arg_start, k - arg_start);
                                     k++;
                                     break;
                                 }
                             } else if (src[k] == ',' && depth == 1) {
-                                args = realloc(args, sizeof(char*) * (argc + 1));
+                                args = arenaGrow(args, sizeof(char*) * argc, sizeof(char*) * (argc + 1));
                                 args[argc++] = my_strndup(src + arg_start, k - arg_start);
                                 arg_start = k + 1;
                             }
                         }
                         char* expanded = expand_macro_body(m, args, argc);
                         size_t elen = strlen(expanded);
-                        if (out_pos + elen + 1 >= cap) { cap = (cap + elen) * 2; out = realloc(out, cap); }
+                        out = ensure_capacity(out, &cap, out_pos + elen + 1);
                         memcpy(out + out_pos, expanded, elen); out_pos += elen;
-                        free(expanded);
-                        for (int a=0;a<argc;a++) free(args[a]); free(args);
-                        i = k; free(ident); continue;
+                        i = k; continue;
                     }
                 }
             }
-            if (out_pos + (j - i) + 1 >= cap) { cap = (cap + (j-i)) * 2; out = realloc(out, cap); }
+            out = ensure_capacity(out, &cap, out_pos + (j - i) + 1);
             memcpy(out + out_pos, src + i, j - i); out_pos += j - i;
-            i = j; free(ident); continue;
+            i = j; continue;
         }
-        if (out_pos + 2 >= cap) { cap = cap * 2 + 16; out = realloc(out, cap); }
+        out = ensure_capacity(out, &cap, out_pos + 2);
         out[out_pos++] = src[i++];
     }
     out[out_pos] = '\0';
-    return out;
+    return arenaGrow(out, cap, out_pos + 1);
 }
 
-char* expand_macros(const char* src) {
-    char* curr = my_strdup(src);
+char* expand_macros(char* src) {
+    char* curr = src;
     for (int pass = 0; pass < 8; pass++) {
         char* next = expand_macros_once(curr);
-        if (strcmp(next, curr) == 0) { free(curr); return next; }
-        free(curr);
+        if (strcmp(next, curr) == 0) {
+            arenaFree(next, strlen(next) + 1);
+            return curr;
+        }
         curr = next;
     }
     return curr;
@@ -2001,8 +3568,8 @@ char* desugar_operators(const char* src) {
     int n = (int)strlen(src);
     if (n == 0) return my_strdup("");
 
-    size_t out_cap = (size_t)n * 8 + 64;
-    char* out = malloc(out_cap);
+    size_t out_cap = (size_t)n * 2 + 64;
+    char* out = arenaAlloc(out_cap);
     int i = 0;
     int last_emit = 0;
     size_t out_pos = 0;
@@ -2016,8 +3583,7 @@ char* desugar_operators(const char* src) {
                 memcpy(out + out_pos, src + last_emit, pre_len);
                 out_pos += pre_len;
             }
-            int j = i+1;
-            while (j < n) { if (src[j] == '"' && src[j-1] != '\\') { j++; break; } j++; }
+            int j = skip_string(src, i, n);
             int slen = j - i;
             out = ensure_capacity(out, &out_cap, out_pos + slen + 1);
             memcpy(out + out_pos, src + i, slen); out_pos += slen;
@@ -2063,7 +3629,8 @@ char* desugar_operators(const char* src) {
                     out = ensure_capacity(out, &out_cap, out_pos + needed + 1);
                     snprintf(out + out_pos, out_cap - out_pos, "(%s = %s %s (%s))", lhs, lhs, op, rhs);
                     out_pos += needed;
-                    free(lhs); free(rhs);
+                    arenaFree(rhs, strlen(rhs) + 1);
+                    arenaFree(lhs, strlen(lhs) + 1);
                     i = rhs_end + 1; last_emit = i; continue;
                 }
             }
@@ -2085,7 +3652,7 @@ char* desugar_operators(const char* src) {
                 int needed = snprintf(NULL,0,"((%s = %s + 1) - 1)", expr, expr);
                 out = ensure_capacity(out, &out_cap, out_pos + needed + 1);
                 snprintf(out + out_pos, out_cap - out_pos, "((%s = %s + 1) - 1)", expr, expr);
-                out_pos += needed; free(expr);
+                out_pos += needed; arenaFree(expr, strlen(expr) + 1);
                 i += 2; last_emit = i; continue;
             } else {
                 if (nxt != -1) {
@@ -2101,7 +3668,7 @@ char* desugar_operators(const char* src) {
                         int needed = snprintf(NULL,0,"(%s = %s + 1)", expr, expr);
                         out = ensure_capacity(out, &out_cap, out_pos + needed + 1);
                         snprintf(out + out_pos, out_cap - out_pos, "(%s = %s + 1)", expr, expr);
-                        out_pos += needed; free(expr);
+                        out_pos += needed; arenaFree(expr, strlen(expr) + 1);
                         i = expr_end + 1; last_emit = i; continue;
                     }
                 }
@@ -2125,7 +3692,7 @@ char* desugar_operators(const char* src) {
                 int needed = snprintf(NULL,0,"((%s = %s - 1) + 1)", expr, expr);
                 out = ensure_capacity(out, &out_cap, out_pos + needed + 1);
                 snprintf(out + out_pos, out_cap - out_pos, "((%s = %s - 1) + 1)", expr, expr);
-                out_pos += needed; free(expr);
+                out_pos += needed; arenaFree(expr, strlen(expr) + 1);
                 i += 2; last_emit = i; continue;
             } else {
                 if (nxt != -1) {
@@ -2141,7 +3708,7 @@ char* desugar_operators(const char* src) {
                         int needed = snprintf(NULL,0,"(%s = %s - 1)", expr, expr);
                         out = ensure_capacity(out, &out_cap, out_pos + needed + 1);
                         snprintf(out + out_pos, out_cap - out_pos, "(%s = %s - 1)", expr, expr);
-                        out_pos += needed; free(expr);
+                        out_pos += needed; arenaFree(expr, strlen(expr) + 1);
                         i = expr_end + 1; last_emit = i; continue;
                     }
                 }
@@ -2162,343 +3729,29 @@ char* desugar_operators(const char* src) {
     return out;
 }
 
-/* Insert or merge these helper functions into your preprocessor module. */
-/* (my_strndup / my_strdup already exist in your posted code; keep them.) */
-
-/* helper checks/parsers used by the desugaring routine */
-static int is_token_for(const char* s, int i, int n) {
-    if (i+3 > n) return 0;
-    if (s[i] != 'f' || s[i+1] != 'o' || s[i+2] != 'r') return 0;
-    if (i>0 && (isalnum((unsigned char)s[i-1]) || s[i-1]=='_' )) return 0;
-    int j = i+3;
-    if (j < n && (isalnum((unsigned char)s[j]) || s[j]=='_')) return 0;
-    return 1;
-}
-static int parse_ident_end(const char* s, int idx, int n) {
-    int j = idx;
-    if (j < n && (isalpha((unsigned char)s[j]) || s[j]=='_')) {
-        j++;
-        while (j < n && (isalnum((unsigned char)s[j]) || s[j]=='_')) j++;
-        return j;
-    }
-    return -1;
-}
-static int find_next_nonspace_at_or_after(const char* s, int idx, int n) {
-    int p = idx;
-    while (p < n && isspace((unsigned char)s[p])) p++;
-    return (p < n) ? p : -1;
-}
-static int find_matching_paren(const char* s, int idx, int n) {
-    if (idx>=n || s[idx] != '(') return -1;
-    int i = idx+1;
-    int depth = 1;
-    while (i < n) {
-        char c = s[i];
-        if (c == '"') { /* skip string "..." */
-            i++;
-            while (i < n) { if (s[i] == '"' && s[i-1] != '\\') { i++; break; } i++; }
-            continue;
-        } else if (c == '\'') { /* skip '...' */
-            i++;
-            while (i < n) { if (s[i] == '\'' && s[i-1] != '\\') { i++; break; } i++; }
-            continue;
-        } else if (c == '(') { depth++; i++; continue; }
-        else if (c == ')') { depth--; i++; if (depth==0) return i; continue; }
-        else i++;
-    }
-    return -1;
-}
-static int find_matching_brace(const char* s, int idx, int n) {
-    if (idx>=n || s[idx] != '{') return -1;
-    int i = idx+1;
-    int depth = 1;
-    while (i < n) {
-        char c = s[i];
-        if (c == '"') { i++; while (i < n) { if (s[i] == '"' && s[i-1] != '\\') { i++; break; } i++; } continue; }
-        else if (c == '\'') { i++; while (i < n) { if (s[i] == '\'' && s[i-1] != '\\') { i++; break; } i++; } continue; }
-        else if (c == '{') { depth++; i++; continue; }
-        else if (c == '}') { depth--; i++; if (depth==0) return i; continue; }
-        else i++;
-    }
-    return -1;
-}
-static char* slice(const char* s, int start, int end) {
-    if (end <= start) return my_strdup("");
-    return my_strndup(s + start, end - start);
-}
-
-static int find_statement_end(const char* s, int idx, int n) {
-    /* Find the end of a single statement starting at idx.
-       We stop at the first semicolon that's not inside parens/braces/strings.
-       If there's no semicolon, return -1. */
-    int i = idx;
-    int pdepth = 0;
-    int bdepth = 0;
-    while (i < n) {
-        char c = s[i];
-        if (c == '"') { i++; while (i < n) { if (s[i] == '"' && s[i-1] != '\\') { i++; break; } i++; } continue; }
-        else if (c == '\'') { i++; while (i < n) { if (s[i] == '\'' && s[i-1] != '\\') { i++; break; } i++; } continue; }
-        else if (c == '(') { pdepth++; i++; continue; }
-        else if (c == ')') { if (pdepth>0) pdepth--; i++; continue; }
-        else if (c == '{') { bdepth++; i++; continue; }
-        else if (c == '}') { if (bdepth>0) bdepth--; i++; continue; }
-        else if (c == ';' && pdepth==0 && bdepth==0) { return i+1; }
-        else i++;
-    }
-    return -1;
-}
-
-/* For-in desugaring pass */
-static unsigned long for_in_counter = 0;
-static void seed_for_in() {
-    static int seeded = 0;
-    if (!seeded) {
-        seeded = 1;
-        srand((unsigned int)(time(NULL) ^ (uintptr_t)&for_in_counter));
-    }
-}
-
-/* create unique iter name */
-static char* make_iter_name() {
-    seed_for_in();
-    unsigned long c = ++for_in_counter;
-    unsigned int r = (unsigned int)rand();
-    char buf[64];
-    snprintf(buf, sizeof(buf), "__iter_%lu_%u", c, r);
-    return my_strdup(buf);
-}
-
-/* main desugaring function that replaces for(var id in expr) stmt_or_block */
-static int iter_counter = 0;
-
-// Skip whitespace
-static void skip_ws(const char** p) {
-    while (isspace(**p)) (*p)++;
-}
-
-// Extract block or single statement body
-static char* extract_block(const char** p) {
-    skip_ws(p);
-    if (**p == '{') {
-        int depth = 0;
-        const char* start = *p;
-        while (**p) {
-            if (**p == '{') depth++;
-            else if (**p == '}') {
-                depth--;
-                if (depth == 0) {
-                    (*p)++;
-                    break;
-                }
-            }
-            (*p)++;
-        }
-        size_t len = *p - start;
-        char* block = malloc(len + 1);
-        memcpy(block, start, len);
-        block[len] = '\0';
-        return block;
-    } else {
-        // Single statement body until semicolon or newline
-        const char* start = *p;
-        while (**p && **p != ';' && **p != '\n') (*p)++;
-        if (**p == ';') (*p)++;
-        size_t len = *p - start;
-        char* body = malloc(len + 1);
-        memcpy(body, start, len);
-        body[len] = '\0';
-        return body;
-    }
-}
-
-// Main transformation
-static char* process_for_in(const char* src) {
-    const char* p = src;
-    size_t out_cap = strlen(src) * 3;
-    char* out = calloc(1, out_cap);
-
-    while (*p) {
-        const char* match = strstr(p, "for");
-        if (!match) {
-            strcat(out, p);
-            break;
-        }
-        strncat(out, p, match - p);
-        p = match + 3;
-        skip_ws(&p);
-
-        if (*p != '(') {
-            strcat(out, "for");
-            continue;
-        }
-
-        const char* lp = ++p;
-        skip_ws(&lp);
-
-        int has_var = 0;
-        if (strncmp(lp, "var", 3) == 0) {
-            has_var = 1;
-            lp += 3;
-        }
-
-        skip_ws(&lp);
-        const char* name_start = lp;
-        while (*lp && (isalnum(*lp) || *lp == '_')) lp++;
-        char varname[64];
-        strncpy(varname, name_start, lp - name_start);
-        varname[lp - name_start] = 0;
-
-        skip_ws(&lp);
-        if (strncmp(lp, "in", 2) != 0) {
-            strcat(out, "for(");
-            continue;
-        }
-        lp += 2;
-        skip_ws(&lp);
-
-        const char* expr_start = lp;
-        int paren_depth = 1;
-        while (*lp && paren_depth > 0) {
-            if (*lp == '(') paren_depth++;
-            else if (*lp == ')') paren_depth--;
-            lp++;
-        }
-
-        size_t expr_len = (lp - expr_start) - 1;
-        char expr[256];
-        strncpy(expr, expr_start, expr_len);
-        expr[expr_len] = 0;
-
-        skip_ws(&lp);
-        const char* body_start = lp;
-        char* body = extract_block(&lp);
-
-        iter_counter++;
-        char itername[64];
-        sprintf(itername, "__iter_%d", iter_counter);
-
-        char expansion[2048];
-        snprintf(expansion, sizeof(expansion),
-            "{var %s = (%s).iterator();for(;%s.hasNext();){var %s = %s.next();%s}}",
-            itername, expr, itername, varname, itername, body);
-
-        strcat(out, expansion);
-        free(body);
-        p = lp;
-    }
-    return out;
-}
-
-bool has_for_in(const char* code) {
-    bool in_single = false;
-    bool in_double = false;
-    bool in_line_comment = false;
-    bool in_block_comment = false;
-    bool escaped = false;
-
-    size_t len = strlen(code);
-    for (size_t i = 0; i < len; i++) {
-        char c = code[i];
-        char n = (i + 1 < len) ? code[i + 1] : '\0';
-
-        if (in_line_comment) {
-            if (c == '\n') in_line_comment = false;
-            continue;
-        }
-
-        if (in_block_comment) {
-            if (c == '*' && n == '/') {
-                in_block_comment = false;
-                i++;
-            }
-            continue;
-        }
-
-        if (in_single) {
-            if (!escaped && c == '\'') in_single = false;
-            escaped = (c == '\\' && !escaped);
-            continue;
-        }
-
-        if (in_double) {
-            if (!escaped && c == '"') in_double = false;
-            escaped = (c == '\\' && !escaped);
-            continue;
-        }
-
-        // Entering comment or string
-        if (c == '/' && n == '/') {
-            in_line_comment = true;
-            i++;
-            continue;
-        } else if (c == '/' && n == '*') {
-            in_block_comment = true;
-            i++;
-            continue;
-        } else if (c == '\'') {
-            in_single = true;
-            escaped = false;
-            continue;
-        } else if (c == '"') {
-            in_double = true;
-            escaped = false;
-            continue;
-        }
-
-        // Detect "for(... in ...)"
-        if (c == 'f' && strncmp(&code[i], "for", 3) == 0 && !isalnum(code[i + 3])) {
-            const char *p = &code[i + 3];
-            while (*p && isspace(*p)) p++;
-            if (*p == '(') {
-                const char *q = p + 1;
-                while (*q && *q != ')') q++;
-                if (*q == ')') {
-                    char temp[256];
-                    size_t l = q - &code[i] + 1;
-                    if (l >= sizeof(temp)) l = sizeof(temp) - 1;
-                    strncpy(temp, &code[i], l);
-                    temp[l] = '\0';
-                    if (strstr(temp, " in ")) {
-                        return true;
-                    }
-                }
-            }
-        }
-    }
-    return false;
-}
-
 /* Top-level preprocessor */
 char* preprocessor(const char* src) {
     char* without = strip_macros_and_build_table(src);
     char* expanded = expand_macros(without);
-    free(without);
-
-    char* desugared_ops = desugar_operators(expanded);
-    free(expanded);
-
-    char* desugared_for = process_for_in(desugared_ops);
-    free(desugared_ops);
-
-    
-    while(has_for_in(desugared_for)){
-        char* temp = process_for_in(desugared_for);
-        free(desugared_for);
-        desugared_for = temp;
-    }
-
-    //printf(desugared_for);
-    
-    return desugared_for;
+    return desugar_operators(expanded);
 }
 
 Value preprocessorNative(Thread* ctx, int argCount, Value* args)
 {
-    return OBJ_VAL(newString(preprocessor(AS_CSTRING(args[0])),
-                             strlen(preprocessor(AS_CSTRING(args[0])))));
+    beginArena();
+    char* processed = preprocessor(AS_CSTRING(args[0]));
+    // The compiler that called us unescapes string literals itself, so
+    // the text is copied out of the arena as is.
+    int length = (int)strlen(processed);
+    char* chars = ALLOCATE_ATOMIC(char, length + 1);
+    memcpy(chars, processed, length + 1);
+    ObjString* result = newString(chars, length);
+    endArena();
+    return OBJ_VAL(result);
 }
 
 void compileImport(const char* source) {
+    beginArena();
     source = preprocessor(source);
     //printf(source);
     initScanner(source);
@@ -2511,12 +3764,16 @@ void compileImport(const char* source) {
     while (!match(TOKEN_EOF)) {
         declaration();
     }
+    endArena();
 }
 
 ObjFunction* compile(const char* source) {
+    if (compileDepth++ == 0) initCompileTables();
+    beginArena();
     source = preprocessor(source);
     //printf(source);
     initScanner(source);
+    blockTokenCount = 0;
     Compiler compiler;
     initCompiler(&compiler, TYPE_SCRIPT);
 
@@ -2531,12 +3788,19 @@ ObjFunction* compile(const char* source) {
     }
 
     ObjFunction* function = endCompiler();
+    endArena();
+    blockTokenCount = 0;
+    if (--compileDepth == 0) freeCompileTables();
     return parser.hadError ? NULL : function;
 }
 
+// The tables above only hold entries while a compile() runs.
 void markCompilerRoots() {
-    Compiler* compiler = current;
-    while (compiler != NULL) {
-        compiler = compiler->enclosing;
-    }
+#ifdef PRECISE_GC
+    markTable(&compileConstants);
+    markTable(&compileEnums);
+    markTable(&compileStructs);
+    markTable(&inlineFunctions);
+    markTable(&inlineMethods);
+#endif
 }
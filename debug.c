@@ -86,6 +86,95 @@ static int tryInstruction(Chunk* chunk, int offset) {
 }
 
 
+static int switchTableInstruction(Chunk* chunk, int offset) {
+    uint16_t constant = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+    uint16_t count = (uint16_t)((chunk->code[offset + 3] << 8) | chunk->code[offset + 4]);
+    int end = offset + 7 + count * 2;
+    double base = AS_NUMBER(chunk->constants.values[constant]);
+
+    printf("%-16s %4d from %g\n", "OP_SWITCH_TABLE", count, base);
+    for (int i = -1; i < count; i++) {
+        int entry = offset + 7 + i * 2;
+        uint16_t distance = (uint16_t)((chunk->code[entry] << 8) | chunk->code[entry + 1]);
+        if (i == -1) printf("%04d      |                     default -> %d\n", entry, end - distance);
+        else printf("%04d      |                     %g -> %d\n", entry, base + i, end - distance);
+    }
+    return end;
+}
+
+static int switchHashInstruction(Chunk* chunk, int offset) {
+    uint16_t count = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+    int end = offset + 5 + count * 4;
+    uint16_t distance = (uint16_t)((chunk->code[offset + 3] << 8) | chunk->code[offset + 4]);
+
+    printf("%-16s %4d\n", "OP_SWITCH_HASH", count);
+    printf("%04d      |                     default -> %d\n", offset + 3, end - distance);
+    for (int entry = offset + 5; entry < end; entry += 4) {
+        uint16_t constant = (uint16_t)((chunk->code[entry] << 8) | chunk->code[entry + 1]);
+        if (constant == SWITCH_EMPTY_SLOT) continue;
+        distance = (uint16_t)((chunk->code[entry + 2] << 8) | chunk->code[entry + 3]);
+        printf("%04d      |                     '", entry);
+        printValue(chunk->constants.values[constant]);
+        printf("' -> %d\n", end - distance);
+    }
+    return end;
+}
+
+
+static int forIterInstruction(Chunk* chunk, int offset) {
+    uint8_t slot = chunk->code[offset + 1];
+    uint16_t exit = (uint16_t)((chunk->code[offset + 2] << 8) | chunk->code[offset + 3]);
+    uint16_t fallback = (uint16_t)((chunk->code[offset + 4] << 8) | chunk->code[offset + 5]);
+    printf("%-16s %4d exit -> %d, fallback -> %d\n", "OP_FOR_ITER", slot,
+           offset + 6 + exit, offset + 6 + fallback);
+    return offset + 6;
+}
+
+static int forStepInstruction(Chunk* chunk, int offset) {
+    static const char* limits[] = {"local", "constant", "global"};
+    static const char* compares[] = {"<", "<=", ">", ">="};
+    uint8_t slot = chunk->code[offset + 1];
+    uint8_t kind = chunk->code[offset + 2];
+    uint16_t limit = (uint16_t)((chunk->code[offset + 3] << 8) | chunk->code[offset + 4]);
+    uint16_t step = (uint16_t)((chunk->code[offset + 5] << 8) | chunk->code[offset + 6]);
+    uint8_t compare = chunk->code[offset + 7];
+    uint16_t body = (uint16_t)((chunk->code[offset + 8] << 8) | chunk->code[offset + 9]);
+    uint16_t increment = (uint16_t)((chunk->code[offset + 10] << 8) | chunk->code[offset + 11]);
+    printf("%-16s %4d %s %s %d step '", "OP_FOR_STEP", slot, compares[compare], limits[kind], limit);
+    printValue(chunk->constants.values[step]);
+    printf("' body -> %d, increment -> %d\n", offset + 12 - body, offset + 12 - increment);
+    return offset + 12;
+}
+
+static int getSunkInstruction(Chunk* chunk, int offset) {
+    uint8_t slot = chunk->code[offset + 1];
+    uint8_t count = chunk->code[offset + 2];
+    uint8_t field = chunk->code[offset + 3];
+    int hit = offset + 4 + (field > 0 ? 5 : 2);
+    printf("%-16s %4d (%d fields) field %d, hit -> %d\n", "OP_GET_SUNK", slot, count, field, hit);
+    return offset + 4;
+}
+
+static int inlineGuardInstruction(Chunk* chunk, int offset) {
+    uint8_t argCount = chunk->code[offset + 1];
+    int operand = offset + 2;
+    if (chunk->code[offset] == OP_INLINE_INVOKE_GUARD) {
+        uint16_t name = (uint16_t)((chunk->code[operand] << 8) | chunk->code[operand + 1]);
+        printf("%-16s (%d args) %4d '", "OP_INLINE_INVOKE_GUARD", argCount, name);
+        printValue(chunk->constants.values[name]);
+        printf("'");
+        operand += 2;
+    } else {
+        printf("%-16s (%d args)", "OP_INLINE_GUARD", argCount);
+    }
+    uint16_t function = (uint16_t)((chunk->code[operand] << 8) | chunk->code[operand + 1]);
+    uint16_t fallback = (uint16_t)((chunk->code[operand + 2] << 8) | chunk->code[operand + 3]);
+    printf(" %4d '", function);
+    printValue(chunk->constants.values[function]);
+    printf("' fallback -> %d\n", operand + 4 + fallback);
+    return operand + 4;
+}
+
 int disassembleInstruction(Chunk* chunk, int offset) {
     printf("%04d ", offset);
 
@@ -154,6 +243,8 @@ int disassembleInstruction(Chunk* chunk, int offset) {
             return jumpInstruction("OP_LOOP", -1, chunk, offset);
         case OP_CALL:
             return byteInstruction("OP_CALL", chunk, offset);
+        case OP_TAIL_CALL:
+            return byteInstruction("OP_TAIL_CALL", chunk, offset);
         case OP_CLOSURE: {
             offset++;
             uint16_t constant = (uint16_t)((chunk->code[offset++] << 8) | chunk->code[offset++]);
@@ -188,6 +279,8 @@ int disassembleInstruction(Chunk* chunk, int offset) {
             return constantInstruction("OP_METHOD", chunk, offset);
         case OP_INVOKE:
             return invokeInstruction("OP_INVOKE", chunk, offset);
+        case OP_TAIL_INVOKE:
+            return invokeInstruction("OP_TAIL_INVOKE", chunk, offset);
         case OP_INHERIT:
             return simpleInstruction("OP_INHERIT", offset);
         case OP_GET_SUPER:
@@ -238,6 +331,50 @@ int disassembleInstruction(Chunk* chunk, int offset) {
         case OP_EXPORT_UPVALUE:
             return exportUpvalueInstruction("OP_EXPORT_UPVALUE", chunk, offset);
 
+        case OP_SWITCH_TABLE:
+            return switchTableInstruction(chunk, offset);
+
+        case OP_SWITCH_HASH:
+            return switchHashInstruction(chunk, offset);
+
+        case OP_FOR_ITER:
+            return forIterInstruction(chunk, offset);
+
+        case OP_RANGE:
+            return simpleInstruction("OP_RANGE", offset);
+
+        case OP_FOR_STEP:
+            return forStepInstruction(chunk, offset);
+
+        case OP_INLINE_GUARD:
+        case OP_INLINE_INVOKE_GUARD:
+            return inlineGuardInstruction(chunk, offset);
+
+        case OP_PEEK:
+            return byteInstruction("OP_PEEK", chunk, offset);
+
+        case OP_INLINE_RETURN:
+            return byteInstruction("OP_INLINE_RETURN", chunk, offset);
+
+        case OP_MATH:
+            // The trailing intrinsic number follows from the name.
+            return invokeInstruction("OP_MATH", chunk, offset) + 1;
+
+        case OP_RETURN_VALUES:
+            return byteInstruction("OP_RETURN_VALUES", chunk, offset);
+
+        case OP_UNPACK:
+            return byteInstruction("OP_UNPACK", chunk, offset);
+
+        case OP_FIELD:
+            return constantInstruction("OP_FIELD", chunk, offset);
+
+        case OP_SINK:
+            return invokeInstruction("OP_SINK", chunk, offset);
+
+        case OP_GET_SUNK:
+            return getSunkInstruction(chunk, offset);
+
         default:
             printf("Unknown opcode %d\n", instruction);
             return offset + 1;
@@ -1,4 +1,7 @@
+#ifndef PRECISE_GC
 #include <gc.h>
+#endif
+#include "memory.h"
 #include "object.h"
 #include "value.h"
 #include "chunk.h"
@@ -14,6 +17,7 @@
 #define NilType      2
 #define NumType      3
 #define BoolType     4
+#define FunctionRefType 6
 
 // ---------------------------
 // File read helpers
@@ -47,16 +51,33 @@ static double readDouble() {
 static Value deserialize_value();
 static ObjFunction* deserialize_function();
 
+// Functions in the order they were read, so a FunctionRefType can name an
+// earlier one by index instead of carrying another copy.
+static ObjFunction** functions;
+static int functionCount;
+static int functionCapacity;
+
+static void rememberFunction(ObjFunction* func) {
+    if (functionCount == functionCapacity) {
+        int oldCapacity = functionCapacity;
+        functionCapacity = GROW_CAPACITY(oldCapacity);
+        functions = GROW_ARRAY(ObjFunction*, functions, oldCapacity, functionCapacity);
+    }
+    functions[functionCount++] = func;
+}
+
 static ObjString* deserialize_string() {
     int length = readInt();
-    char* chars = GC_MALLOC(length + 1);
+    char* chars = ALLOCATE_ATOMIC(char, length + 1);
 
     for (int i = 0; i < length; i++)
         chars[i] = (char)readByte();
 
     chars[length] = '\0';
 
-    return copyString(chars, length); 
+    ObjString* string = copyString(chars, length);
+    FREE_ARRAY(char, chars, length + 1);
+    return string;
 }
 
 // ---------------------------
@@ -91,6 +112,14 @@ static Value deserialize_value() {
             ObjFunction* fn = deserialize_function();
             return OBJ_VAL(fn);
         }
+        case FunctionRefType: {
+            int index = readInt();
+            if (index < 0 || index >= functionCount) {
+                printf("Invalid function reference %d\n", index);
+                return NIL_VAL;
+            }
+            return OBJ_VAL(functions[index]);
+        }
         case NumType:
             return NUMBER_VAL(readDouble());
         case BoolType:
@@ -105,6 +134,7 @@ static Value deserialize_value() {
 
 static ObjFunction* deserialize_function() {
     ObjFunction* func = newFunction();
+    rememberFunction(func);
 
     uint8_t next = readByte();
     if (next == NilType) {
@@ -146,6 +176,10 @@ ObjFunction* deserialize(const char* filename) {
         printf("Expected FunctionType, got %d\n", type);
         return NULL;
     }
+
+    functions = NULL;
+    functionCount = 0;
+    functionCapacity = 0;
     
     ObjFunction* fn = deserialize_function();
     fclose(file);
@@ -4,11 +4,21 @@
 #include "memory.h"
 #include "object.h"
 #include <string.h>
+#ifndef PRECISE_GC
+#include <gc.h>
+#endif
 
 ObjFunction* deserialize_function(ObjInstance* func);
 static Value deserialize_value(Value v);
 static void deserialize_chunk(Chunk* chunk, ObjInstance* cobj);
 
+// Function instances already converted, so a function that appears in
+// several constant tables becomes a single ObjFunction.
+static ObjInstance** seenInstances;
+static ObjFunction** seenFunctions;
+static int seenCount;
+static int seenCapacity;
+
 /* Look up globals["function"] and deserialize it.
  * Returns NULL if the lookup or type is missing (no runtime errors).
  */
@@ -22,6 +32,7 @@ ObjFunction* getCompiledBytecode() {
         return NULL;
     }
 
+    seenCount = 0;
     return deserialize_function(AS_INSTANCE(funVal));
 }
 
@@ -104,8 +115,21 @@ static void deserialize_chunk(Chunk* chunk, ObjInstance* cobj) {
 ObjFunction* deserialize_function(ObjInstance* func) {
     if (!func) return NULL;
 
+    for (int i = 0; i < seenCount; i++) {
+        if (seenInstances[i] == func) return seenFunctions[i];
+    }
+
     ObjFunction* f = newFunction();
 
+    if (seenCount == seenCapacity) {
+        int oldCapacity = seenCapacity;
+        seenCapacity = GROW_CAPACITY(oldCapacity);
+        seenInstances = GROW_ARRAY(ObjInstance*, seenInstances, oldCapacity, seenCapacity);
+        seenFunctions = GROW_ARRAY(ObjFunction*, seenFunctions, oldCapacity, seenCapacity);
+    }
+    seenInstances[seenCount] = func;
+    seenFunctions[seenCount++] = f;
+
     Value tmp;
 
     /* name */
@@ -26,7 +26,7 @@ Value readNative(Thread* ctx, int argCount, Value* args) {
         perror("lseek");
         return NIL_VAL;
     }
-    char* buffer = (char*)GC_MALLOC(size + 1);
+    char* buffer = ALLOCATE_ATOMIC(char, size + 1);
     if (!buffer) {
         runtimeErrorCtx(ctx, vm.accessErrorClass, "Not enough memory to read file.");
         return NIL_VAL;
@@ -1,3 +1,4 @@
+#include "memory.h"
 #include "object.h"
 #include "value.h"
 #include "vm.h"
@@ -12,7 +13,9 @@
 #include <stdio.h>     // perror()
 #endif
 
+#ifndef PRECISE_GC
 #include <gc.h>
+#endif
 
 Value writeByteNative(Thread* ctx, int argCount, Value* args);
 Value writeNative(Thread* ctx, int argCount, Value* args);
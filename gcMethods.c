@@ -0,0 +1,95 @@
+#include "memory.h"
+#include "value.h"
+#include "vm.h"
+
+// Statics of the global `gc` class. Pause times are in milliseconds and
+// sizes in bytes.
+
+static Value gcCollectNative(Thread* ctx, int argCount, Value* args) {
+    gcCollect();
+    return NIL_VAL;
+}
+
+static Value gcCollectionsNative(Thread* ctx, int argCount, Value* args) {
+    GCStats stats;
+    gcStats(&stats);
+    return NUMBER_VAL((double)stats.collections);
+}
+
+static Value gcLastPauseNative(Thread* ctx, int argCount, Value* args) {
+    GCStats stats;
+    gcStats(&stats);
+    return NUMBER_VAL(stats.lastPause);
+}
+
+static Value gcMaxPauseNative(Thread* ctx, int argCount, Value* args) {
+    GCStats stats;
+    gcStats(&stats);
+    return NUMBER_VAL(stats.maxPause);
+}
+
+static Value gcTotalPauseNative(Thread* ctx, int argCount, Value* args) {
+    GCStats stats;
+    gcStats(&stats);
+    return NUMBER_VAL(stats.totalPause);
+}
+
+static Value gcHeapSizeNative(Thread* ctx, int argCount, Value* args) {
+    GCStats stats;
+    gcStats(&stats);
+    return NUMBER_VAL((double)stats.heapSize);
+}
+
+static Value gcFreeBytesNative(Thread* ctx, int argCount, Value* args) {
+    GCStats stats;
+    gcStats(&stats);
+    return NUMBER_VAL((double)stats.freeBytes);
+}
+
+static Value gcTotalBytesNative(Thread* ctx, int argCount, Value* args) {
+    GCStats stats;
+    gcStats(&stats);
+    return NUMBER_VAL((double)stats.totalBytes);
+}
+
+// Bytes allocated by the calling thread.
+static Value gcAllocatedNative(Thread* ctx, int argCount, Value* args) {
+    return NUMBER_VAL((double)gcThreadAllocated());
+}
+
+// Quotas in bytes, 0 for none. The thread quota is the calling thread's,
+// and setting it also sets it for threads started afterwards.
+static Value gcHeapQuotaNative(Thread* ctx, int argCount, Value* args) {
+    return NUMBER_VAL((double)gcHeapQuota());
+}
+
+static Value gcSetHeapQuotaNative(Thread* ctx, int argCount, Value* args) {
+    gcSetHeapQuota(AS_NUMBER(args[0]) > 0 ? (size_t)AS_NUMBER(args[0]) : 0);
+    return NIL_VAL;
+}
+
+static Value gcThreadQuotaNative(Thread* ctx, int argCount, Value* args) {
+    return NUMBER_VAL((double)gcThreadQuota());
+}
+
+static Value gcSetThreadQuotaNative(Thread* ctx, int argCount, Value* args) {
+    gcSetThreadQuota(AS_NUMBER(args[0]) > 0 ? (size_t)AS_NUMBER(args[0]) : 0);
+    return NIL_VAL;
+}
+
+static const NativeDef gcNatives[] = {
+    {"collect", gcCollectNative, 0},
+    {"collections", gcCollectionsNative, 0},
+    {"lastPause", gcLastPauseNative, 0},
+    {"maxPause", gcMaxPauseNative, 0},
+    {"totalPause", gcTotalPauseNative, 0},
+    {"heapSize", gcHeapSizeNative, 0},
+    {"freeBytes", gcFreeBytesNative, 0},
+    {"totalBytes", gcTotalBytesNative, 0},
+    {"allocated", gcAllocatedNative, 0},
+    {"heapQuota", gcHeapQuotaNative, 0},
+    {"setHeapQuota", gcSetHeapQuotaNative, 1, {NATIVE_NUMBER}},
+    {"threadQuota", gcThreadQuotaNative, 0},
+    {"setThreadQuota", gcSetThreadQuotaNative, 1, {NATIVE_NUMBER}},
+    {NULL},
+};
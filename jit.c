@@ -0,0 +1,1035 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#ifndef PRECISE_GC
+#include <gc.h>
+#endif
+
+#include "jit.h"
+#include "chunk.h"
+#include "memory.h"
+
+static pthread_mutex_t jitLock = PTHREAD_MUTEX_INITIALIZER;
+static JitCode* compiledFunctions = NULL;
+
+#ifdef JIT_SUPPORTED
+#include <sys/mman.h>
+
+// Native code keeps the thread in rbx, the frame in r12, its slots in r13
+// and a cached copy of ctx->stackTop in r15. The cache is written back
+// before every helper call and reloaded afterwards.
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+#define CTX   RBX
+#define FRAME R12
+#define SLOTS R13
+#define TOP   R15
+
+enum { CC_E = 0x4, CC_NE = 0x5, CC_BE = 0x6, CC_A = 0x7, CC_P = 0xA, CC_ALWAYS = -1 };
+
+#define VALUE_SIZE    ((int32_t)sizeof(Value))
+#define VALUE_PAYLOAD ((int32_t)offsetof(Value, as))
+
+typedef struct {
+    int at;       // Position of the rel32 to patch.
+    int target;   // Bytecode offset it jumps to.
+} Fixup;
+
+typedef struct {
+    ObjFunction* function;
+    uint8_t* code;
+    int count;
+    int capacity;
+
+    Fixup* jumps;
+    int jumpCount;
+    int jumpCapacity;
+    Fixup* bailouts;
+    int bailoutCount;
+    int bailoutCapacity;
+
+    uint32_t* entries;
+    int epilogue;
+    int frameExit;
+    bool failed;
+} Assembler;
+
+static void emit(Assembler* as, uint8_t byte) {
+    if (as->failed) return;
+    if (as->count == as->capacity) {
+        int capacity = as->capacity < 256 ? 256 : as->capacity * 2;
+        uint8_t* code = realloc(as->code, capacity);
+        if (code == NULL) {
+            as->failed = true;
+            return;
+        }
+        as->code = code;
+        as->capacity = capacity;
+    }
+    as->code[as->count++] = byte;
+}
+
+static void emit32(Assembler* as, uint32_t value) {
+    for (int i = 0; i < 4; i++) emit(as, (uint8_t)(value >> (i * 8)));
+}
+
+static void emit64(Assembler* as, uint64_t value) {
+    for (int i = 0; i < 8; i++) emit(as, (uint8_t)(value >> (i * 8)));
+}
+
+static void addFixup(Assembler* as, Fixup** fixups, int* count, int* capacity, int target) {
+    if (*count == *capacity) {
+        *capacity = *capacity < 16 ? 16 : *capacity * 2;
+        Fixup* grown = realloc(*fixups, sizeof(Fixup) * *capacity);
+        if (grown == NULL) {
+            as->failed = true;
+            return;
+        }
+        *fixups = grown;
+    }
+    (*fixups)[(*count)++] = (Fixup){as->count - 4, target};
+}
+
+static void patch32(Assembler* as, int at, int target) {
+    if (as->failed) return;
+    int32_t distance = target - (at + 4);
+    memcpy(as->code + at, &distance, 4);
+}
+
+// ---------------------
+// Instruction encoding
+// ---------------------
+static void rex(Assembler* as, bool wide, int reg, int base) {
+    uint8_t prefix = 0x40 | (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((base & 8) ? 1 : 0);
+    if (prefix != 0x40) emit(as, prefix);
+}
+
+// [base + disp32] with `reg` in the ModRM reg field.
+static void memory(Assembler* as, int reg, int base, int32_t disp) {
+    emit(as, 0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP) emit(as, 0x24);
+    emit32(as, (uint32_t)disp);
+}
+
+static void load64(Assembler* as, int reg, int base, int32_t disp) {
+    rex(as, true, reg, base);
+    emit(as, 0x8B);
+    memory(as, reg, base, disp);
+}
+
+static void load32(Assembler* as, int reg, int base, int32_t disp) {
+    rex(as, false, reg, base);
+    emit(as, 0x8B);
+    memory(as, reg, base, disp);
+}
+
+static void store64(Assembler* as, int base, int32_t disp, int reg) {
+    rex(as, true, reg, base);
+    emit(as, 0x89);
+    memory(as, reg, base, disp);
+}
+
+static void storeType(Assembler* as, int base, int32_t disp, ValueType type) {
+    rex(as, false, 0, base);
+    emit(as, 0xC7);
+    memory(as, 0, base, disp);
+    emit32(as, type);
+}
+
+static void compareType(Assembler* as, int base, int32_t disp, ValueType type) {
+    rex(as, false, 0, base);
+    emit(as, 0x83);
+    memory(as, 7, base, disp);
+    emit(as, (uint8_t)type);
+}
+
+static void moveImmediate(Assembler* as, int reg, uint64_t value) {
+    rex(as, true, 0, reg);
+    emit(as, 0xB8 + (reg & 7));
+    emit64(as, value);
+}
+
+static void moveRegister(Assembler* as, int dst, int src) {
+    rex(as, true, src, dst);
+    emit(as, 0x89);
+    emit(as, 0xC0 | ((src & 7) << 3) | (dst & 7));
+}
+
+static void addImmediate(Assembler* as, int reg, int32_t value) {
+    rex(as, true, 0, reg);
+    emit(as, 0x81);
+    emit(as, 0xC0 | (reg & 7));
+    emit32(as, (uint32_t)value);
+}
+
+// movsd xmm, [base + disp]
+static void loadDouble(Assembler* as, int xmm, int base, int32_t disp) {
+    emit(as, 0xF2);
+    rex(as, false, xmm, base);
+    emit(as, 0x0F);
+    emit(as, 0x10);
+    memory(as, xmm, base, disp);
+}
+
+// movsd [base + disp], xmm
+static void storeDouble(Assembler* as, int base, int32_t disp, int xmm) {
+    emit(as, 0xF2);
+    rex(as, false, xmm, base);
+    emit(as, 0x0F);
+    emit(as, 0x11);
+    memory(as, xmm, base, disp);
+}
+
+// movq xmm, rax
+static void moveToDouble(Assembler* as, int xmm) {
+    emit(as, 0x66);
+    emit(as, 0x48);
+    emit(as, 0x0F);
+    emit(as, 0x6E);
+    emit(as, 0xC0 | (xmm << 3));
+}
+
+// A scalar double operation between xmm0..xmm7 registers.
+static void doubleOp(Assembler* as, uint8_t prefix, uint8_t op, int dst, int src) {
+    emit(as, prefix);
+    emit(as, 0x0F);
+    emit(as, op);
+    emit(as, 0xC0 | (dst << 3) | src);
+}
+
+#define ADDSD_OP 0x58
+#define MULSD_OP 0x59
+#define SUBSD_OP 0x5C
+#define DIVSD_OP 0x5E
+
+#define ADDSD(as, dst, src)   doubleOp(as, 0xF2, ADDSD_OP, dst, src)
+#define DIVSD(as, dst, src)   doubleOp(as, 0xF2, DIVSD_OP, dst, src)
+#define UCOMISD(as, a, b)     doubleOp(as, 0x66, 0x2E, a, b)
+#define XORPD(as, dst, src)   doubleOp(as, 0x66, 0x57, dst, src)
+
+static void callAddress(Assembler* as, void* function) {
+    moveImmediate(as, RAX, (uint64_t)(uintptr_t)function);
+    emit(as, 0xFF);
+    emit(as, 0xD0);
+}
+
+// test al, al
+static void testResult(Assembler* as) {
+    emit(as, 0x84);
+    emit(as, 0xC0);
+}
+
+// Emits a jump with an unpatched rel32 and returns where it sits.
+static int jump(Assembler* as, int condition) {
+    if (condition == CC_ALWAYS) {
+        emit(as, 0xE9);
+    } else {
+        emit(as, 0x0F);
+        emit(as, 0x80 + condition);
+    }
+    emit32(as, 0);
+    return as->count - 4;
+}
+
+static void bindHere(Assembler* as, int at) {
+    patch32(as, at, as->count);
+}
+
+static void jumpTo(Assembler* as, int condition, int native) {
+    patch32(as, jump(as, condition), native);
+}
+
+static void jumpToBytecode(Assembler* as, int condition, int target) {
+    jump(as, condition);
+    addFixup(as, &as->jumps, &as->jumpCount, &as->jumpCapacity, target);
+}
+
+// Leaves native code so the interpreter runs the instruction at `offset`.
+static void bailout(Assembler* as, int condition, int offset) {
+    jump(as, condition);
+    addFixup(as, &as->bailouts, &as->bailoutCount, &as->bailoutCapacity, offset);
+}
+
+// ---------------------
+// Stack helpers
+// ---------------------
+static void syncStack(Assembler* as) {
+    store64(as, CTX, offsetof(Thread, stackTop), TOP);
+}
+
+static void reloadStack(Assembler* as) {
+    load64(as, TOP, CTX, offsetof(Thread, stackTop));
+}
+
+static void setIp(Assembler* as, int offset) {
+    moveImmediate(as, RAX, (uint64_t)(uintptr_t)(as->function->chunk.code + offset));
+    store64(as, FRAME, offsetof(CallFrame, ip), RAX);
+}
+
+static void copyValue(Assembler* as, int dstBase, int32_t dst, int srcBase, int32_t src) {
+    load64(as, RAX, srcBase, src);
+    load64(as, RCX, srcBase, src + 8);
+    store64(as, dstBase, dst, RAX);
+    store64(as, dstBase, dst + 8, RCX);
+}
+
+static void pushConstant(Assembler* as, Value value) {
+    uint64_t payload = 0;
+    switch (value.type) {
+        case VAL_BOOL:   payload = AS_BOOL(value) ? 1 : 0; break;
+        case VAL_NIL:    payload = 0; break;
+        case VAL_NUMBER: memcpy(&payload, &value.as.number, sizeof(double)); break;
+        case VAL_OBJ:    payload = (uint64_t)(uintptr_t)AS_OBJ(value); break;
+    }
+    storeType(as, TOP, 0, value.type);
+    moveImmediate(as, RAX, payload);
+    store64(as, TOP, VALUE_PAYLOAD, RAX);
+    addImmediate(as, TOP, VALUE_SIZE);
+}
+
+static void guardNumber(Assembler* as, int32_t disp, int offset) {
+    compareType(as, TOP, disp, VAL_NUMBER);
+    bailout(as, CC_NE, offset);
+}
+
+// Leaves ecx = 1 when the value on top of the stack is falsey.
+static void falsey(Assembler* as) {
+    emit(as, 0x31); emit(as, 0xC9);                 // xor ecx, ecx
+    load32(as, RAX, TOP, -VALUE_SIZE);
+    emit(as, 0x83); emit(as, 0xF8); emit(as, VAL_NIL);
+    int isNil = jump(as, CC_E);
+    emit(as, 0x83); emit(as, 0xF8); emit(as, VAL_BOOL);
+    int notBool = jump(as, CC_NE);
+    rex(as, false, 0, TOP);
+    emit(as, 0x80);                                 // cmp byte [top - 8], 0
+    memory(as, 7, TOP, -VALUE_SIZE + VALUE_PAYLOAD);
+    emit(as, 0);
+    int isFalse = jump(as, CC_E);
+    int done = jump(as, CC_ALWAYS);
+
+    bindHere(as, notBool);
+    emit(as, 0x83); emit(as, 0xF8); emit(as, VAL_NUMBER);
+    int notNumber = jump(as, CC_NE);
+    loadDouble(as, 0, TOP, -VALUE_SIZE + VALUE_PAYLOAD);
+    XORPD(as, 1, 1);
+    UCOMISD(as, 0, 1);
+    int unordered = jump(as, CC_P);
+    int nonZero = jump(as, CC_NE);
+
+    bindHere(as, isNil);
+    bindHere(as, isFalse);
+    emit(as, 0xB9); emit32(as, 1);                  // mov ecx, 1
+    bindHere(as, done);
+    bindHere(as, notNumber);
+    bindHere(as, unordered);
+    bindHere(as, nonZero);
+}
+
+static void storeBool(Assembler* as, int32_t disp, int reg) {
+    storeType(as, TOP, disp, VAL_BOOL);
+    store64(as, TOP, disp + VALUE_PAYLOAD, reg);
+}
+
+// Both operands must be numbers; the result replaces the left one.
+static void arithmetic(Assembler* as, uint8_t op, int offset) {
+    guardNumber(as, -2 * VALUE_SIZE, offset);
+    guardNumber(as, -VALUE_SIZE, offset);
+    loadDouble(as, 0, TOP, -2 * VALUE_SIZE + VALUE_PAYLOAD);
+    loadDouble(as, 1, TOP, -VALUE_SIZE + VALUE_PAYLOAD);
+    doubleOp(as, 0xF2, op, 0, 1);
+    storeDouble(as, TOP, -2 * VALUE_SIZE + VALUE_PAYLOAD, 0);
+    addImmediate(as, TOP, -VALUE_SIZE);
+}
+
+// ucomisd with `first` and `second` chosen so that "above" means true and
+// an unordered comparison (NaN) comes out false.
+static void comparison(Assembler* as, int first, int second, int offset) {
+    guardNumber(as, -2 * VALUE_SIZE, offset);
+    guardNumber(as, -VALUE_SIZE, offset);
+    loadDouble(as, 0, TOP, -2 * VALUE_SIZE + VALUE_PAYLOAD);
+    loadDouble(as, 1, TOP, -VALUE_SIZE + VALUE_PAYLOAD);
+    UCOMISD(as, first, second);
+    emit(as, 0x0F); emit(as, 0x97); emit(as, 0xC0); // seta al
+    emit(as, 0x0F); emit(as, 0xB6); emit(as, 0xC0); // movzx eax, al
+    storeBool(as, -2 * VALUE_SIZE, RAX);
+    addImmediate(as, TOP, -VALUE_SIZE);
+}
+
+// Calls a helper that always finishes the instruction.
+static void plainHelper(Assembler* as, void* helper) {
+    syncStack(as);
+    callAddress(as, helper);
+    reloadStack(as);
+}
+
+// Calls a helper that either finishes the instruction or leaves the stack
+// untouched for the interpreter to take over.
+static void guardedHelper(Assembler* as, void* helper, int offset) {
+    syncStack(as);
+    callAddress(as, helper);
+    reloadStack(as);
+    testResult(as);
+    bailout(as, CC_E, offset);
+}
+
+// Calls a helper that may push or pop frames. It returns false once
+// frame->ip no longer points after the instruction.
+static void callingHelper(Assembler* as, void* helper) {
+    syncStack(as);
+    callAddress(as, helper);
+    testResult(as);
+    jumpTo(as, CC_E, as->frameExit);
+    reloadStack(as);
+}
+
+static uint16_t readShort(uint8_t* code) {
+    return (uint16_t)((code[0] << 8) | code[1]);
+}
+
+static int instructionLength(Chunk* chunk, int offset) {
+    uint8_t* code = &chunk->code[offset];
+    switch (code[0]) {
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_PEEK:
+        case OP_INLINE_RETURN:
+        case OP_RETURN_VALUES:
+        case OP_UNPACK:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_LIST:
+        case OP_TRY:
+            return 2;
+        case OP_CONSTANT:
+        case OP_DEFINE_GLOBAL:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_CLASS:
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_METHOD:
+        case OP_GET_SUPER:
+        case OP_STATIC_VAR:
+        case OP_STATIC_METHOD:
+        case OP_FIELD:
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+            return 3;
+        case OP_INVOKE:
+        case OP_TAIL_INVOKE:
+        case OP_SUPER_INVOKE:
+        case OP_EXPORT_LOCAL:
+        case OP_EXPORT_UPVALUE:
+        case OP_CONSTANT_LONG:
+        case OP_SINK:
+        case OP_GET_SUNK:
+            return 4;
+        case OP_CLOSURE: {
+            ObjFunction* function = AS_FUNCTION(chunk->constants.values[readShort(code + 1)]);
+            return 3 + function->upvalueCount * 2;
+        }
+        case OP_SWITCH_TABLE: return 7 + readShort(code + 3) * 2;
+        case OP_SWITCH_HASH:  return 5 + readShort(code + 1) * 4;
+        case OP_FOR_ITER:     return 6;
+        case OP_MATH:         return 5;
+        case OP_INLINE_GUARD: return 6;
+        case OP_INLINE_INVOKE_GUARD: return 8;
+        case OP_FOR_STEP:     return 12;
+        default:              return 1;
+    }
+}
+
+static void prologue(Assembler* as) {
+    emit(as, 0x55);                                   // push rbp
+    emit(as, 0x48); emit(as, 0x89); emit(as, 0xE5);   // mov rbp, rsp
+    emit(as, 0x53);                                   // push rbx
+    emit(as, 0x41); emit(as, 0x54);                   // push r12
+    emit(as, 0x41); emit(as, 0x55);                   // push r13
+    emit(as, 0x41); emit(as, 0x56);                   // push r14
+    emit(as, 0x41); emit(as, 0x57);                   // push r15
+    addImmediate(as, RSP, -8);                        // keep rsp 16-byte aligned
+    moveRegister(as, CTX, RDI);
+    moveRegister(as, FRAME, RSI);
+    load64(as, SLOTS, FRAME, offsetof(CallFrame, slots));
+    reloadStack(as);
+    emit(as, 0xFF); emit(as, 0xE2);                   // jmp rdx
+}
+
+static void epilogue(Assembler* as) {
+    as->epilogue = as->count;
+    addImmediate(as, RSP, 8);
+    emit(as, 0x41); emit(as, 0x5F);                   // pop r15
+    emit(as, 0x41); emit(as, 0x5E);                   // pop r14
+    emit(as, 0x41); emit(as, 0x5D);                   // pop r13
+    emit(as, 0x41); emit(as, 0x5C);                   // pop r12
+    emit(as, 0x5B);                                   // pop rbx
+    emit(as, 0x5D);                                   // pop rbp
+    emit(as, 0xC3);                                   // ret
+
+    as->frameExit = as->count;
+    emit(as, 0xB8); emit32(as, JIT_FRAME_CHANGED);    // mov eax, JIT_FRAME_CHANGED
+    jumpTo(as, CC_ALWAYS, as->epilogue);
+}
+
+// Every bailout target gets a stub that records its ip and leaves.
+static void bailoutStubs(Assembler* as, int length) {
+    int* stubs = malloc(sizeof(int) * (length + 1));
+    if (stubs == NULL) {
+        as->failed = true;
+        return;
+    }
+    for (int i = 0; i <= length; i++) stubs[i] = -1;
+
+    int common = as->count;
+    store64(as, FRAME, offsetof(CallFrame, ip), RAX);
+    syncStack(as);
+    emit(as, 0xB8); emit32(as, JIT_BAILOUT);          // mov eax, JIT_BAILOUT
+    jumpTo(as, CC_ALWAYS, as->epilogue);
+
+    for (int i = 0; i < as->bailoutCount; i++) {
+        Fixup* fixup = &as->bailouts[i];
+        if (stubs[fixup->target] == -1) {
+            stubs[fixup->target] = as->count;
+            moveImmediate(as, RAX, (uint64_t)(uintptr_t)(as->function->chunk.code + fixup->target));
+            jumpTo(as, CC_ALWAYS, common);
+        }
+        patch32(as, fixup->at, stubs[fixup->target]);
+    }
+    free(stubs);
+}
+
+// Keeps --profile-hot loop counts exact once a loop runs natively.
+static void countBackedgeNative(Assembler* as, int offset) {
+    if (!vm.profileHot) return;
+    moveImmediate(as, RAX, (uint64_t)(uintptr_t)&as->function->chunk.backedges[offset]);
+    emit(as, 0xF0); emit(as, 0xFF); emit(as, 0x00);   // lock inc dword [rax]
+}
+
+// Hands a hot loop back to the interpreter when a collection is waiting
+// or an allocation crossed a quota, so the thread stops at the loop's next
+// back edge.
+static void pollCollector(Assembler* as, int target) {
+#ifdef PRECISE_GC
+    moveImmediate(as, RAX, (uint64_t)(uintptr_t)&vm.gcRequested);
+    emit(as, 0x80); emit(as, 0x38); emit(as, 0x00);   // cmp byte [rax], 0
+    bailout(as, CC_NE, target);
+#endif
+    emit(as, 0x80); emit(as, 0xBB);                   // cmp byte [rbx + disp32], 0
+    emit32(as, (uint32_t)offsetof(Thread, quotaCheck));
+    emit(as, 0x00);
+    bailout(as, CC_NE, target);
+}
+
+static void forStep(Assembler* as, uint8_t* code, int end) {
+    Value* constants = as->function->chunk.constants.values;
+    int32_t counter = code[1] * VALUE_SIZE;
+    uint8_t kind = code[2];
+    uint16_t operand = readShort(code + 3);
+    Value step = constants[readShort(code + 5)];
+    uint8_t compare = code[7];
+    int body = end - readShort(code + 8);
+    int increment = end - readShort(code + 10);
+
+    int limitBase = SLOTS;
+    int32_t limit = operand * VALUE_SIZE;
+    if (kind == 1 && !IS_NUMBER(constants[operand])) {
+        jumpToBytecode(as, CC_ALWAYS, increment);
+        return;
+    }
+    if (kind == 2) {
+        // The global is copied just above the stack top and read from there.
+        moveRegister(as, RDI, FRAME);
+        moveImmediate(as, RSI, (uint64_t)(uintptr_t)AS_STRING(constants[operand]));
+        moveRegister(as, RDX, TOP);
+        callAddress(as, jitLoadGlobal);
+        testResult(as);
+        jumpToBytecode(as, CC_E, increment);
+        limitBase = TOP;
+        limit = 0;
+    }
+
+    compareType(as, SLOTS, counter, VAL_NUMBER);
+    jumpToBytecode(as, CC_NE, increment);
+    if (kind != 1) {
+        compareType(as, limitBase, limit, VAL_NUMBER);
+        jumpToBytecode(as, CC_NE, increment);
+    }
+
+    uint64_t bits;
+    memcpy(&bits, &step.as.number, sizeof(double));
+    loadDouble(as, 0, SLOTS, counter + VALUE_PAYLOAD);
+    moveImmediate(as, RAX, bits);
+    moveToDouble(as, 1);
+    ADDSD(as, 0, 1);
+    storeDouble(as, SLOTS, counter + VALUE_PAYLOAD, 0);
+
+    if (kind == 1) {
+        memcpy(&bits, &constants[operand].as.number, sizeof(double));
+        moveImmediate(as, RAX, bits);
+        moveToDouble(as, 1);
+    } else {
+        loadDouble(as, 1, limitBase, limit + VALUE_PAYLOAD);
+    }
+
+    // xmm0 holds the next counter value and xmm1 the limit.
+    int loops;
+    switch (compare) {
+        case 0:  UCOMISD(as, 1, 0); loops = CC_A; break;   // next < limit
+        case 1:  UCOMISD(as, 0, 1); loops = CC_BE; break;  // !(next > limit)
+        case 2:  UCOMISD(as, 0, 1); loops = CC_A; break;   // next > limit
+        default: UCOMISD(as, 1, 0); loops = CC_BE; break;  // !(next < limit)
+    }
+
+    int exits = jump(as, loops == CC_A ? CC_BE : CC_A);
+    countBackedgeNative(as, end);
+    pollCollector(as, body);
+    jumpToBytecode(as, CC_ALWAYS, body);
+    bindHere(as, exits);
+}
+
+// Translates one instruction. Returns false if it was left to the interpreter.
+static bool translate(Assembler* as, int offset, int length) {
+    uint8_t* code = &as->function->chunk.code[offset];
+    Value* constants = as->function->chunk.constants.values;
+    int end = offset + length;
+
+    switch (code[0]) {
+        case OP_CONSTANT:
+            pushConstant(as, constants[readShort(code + 1)]);
+            return true;
+        case OP_NIL:   pushConstant(as, NIL_VAL); return true;
+        case OP_TRUE:  pushConstant(as, BOOL_VAL(true)); return true;
+        case OP_FALSE: pushConstant(as, BOOL_VAL(false)); return true;
+        case OP_POP:
+            addImmediate(as, TOP, -VALUE_SIZE);
+            return true;
+        case OP_GET_LOCAL:
+            copyValue(as, TOP, 0, SLOTS, code[1] * VALUE_SIZE);
+            addImmediate(as, TOP, VALUE_SIZE);
+            return true;
+        case OP_SET_LOCAL:
+            copyValue(as, SLOTS, code[1] * VALUE_SIZE, TOP, -VALUE_SIZE);
+            return true;
+        case OP_PEEK:
+            copyValue(as, TOP, 0, TOP, -(code[1] + 1) * VALUE_SIZE);
+            addImmediate(as, TOP, VALUE_SIZE);
+            return true;
+        case OP_INLINE_RETURN:
+            copyValue(as, TOP, -(code[1] + 2) * VALUE_SIZE, TOP, -VALUE_SIZE);
+            addImmediate(as, TOP, -(code[1] + 1) * VALUE_SIZE);
+            return true;
+        case OP_INLINE_GUARD:
+            moveRegister(as, RDI, CTX);
+            moveImmediate(as, RSI, (uint64_t)(uintptr_t)AS_FUNCTION(constants[readShort(code + 2)]));
+            moveImmediate(as, RDX, code[1]);
+            plainHelper(as, jitInlineGuard);
+            testResult(as);
+            jumpToBytecode(as, CC_E, end + readShort(code + 4));
+            return true;
+        case OP_INLINE_INVOKE_GUARD:
+            moveRegister(as, RDI, CTX);
+            moveImmediate(as, RSI, (uint64_t)(uintptr_t)AS_STRING(constants[readShort(code + 2)]));
+            moveImmediate(as, RDX, (uint64_t)(uintptr_t)AS_FUNCTION(constants[readShort(code + 4)]));
+            moveImmediate(as, RCX, code[1]);
+            plainHelper(as, jitInlineInvokeGuard);
+            testResult(as);
+            jumpToBytecode(as, CC_E, end + readShort(code + 6));
+            return true;
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+            load64(as, RDX, FRAME, offsetof(CallFrame, closure));
+            load64(as, RDX, RDX, offsetof(ObjClosure, upvalues));
+            load64(as, RDX, RDX, code[1] * (int32_t)sizeof(ObjUpvalue*));
+            load64(as, RDX, RDX, offsetof(ObjUpvalue, location));
+            if (code[0] == OP_GET_UPVALUE) {
+                copyValue(as, TOP, 0, RDX, 0);
+                addImmediate(as, TOP, VALUE_SIZE);
+            } else {
+                copyValue(as, RDX, 0, TOP, -VALUE_SIZE);
+#ifdef PRECISE_GC
+                moveRegister(as, RDI, FRAME);
+                moveImmediate(as, RSI, code[1]);
+                plainHelper(as, jitUpvalueBarrier);
+#endif
+            }
+            return true;
+        case OP_JUMP:
+            jumpToBytecode(as, CC_ALWAYS, end + readShort(code + 1));
+            return true;
+        case OP_LOOP:
+            countBackedgeNative(as, end);
+            pollCollector(as, end - readShort(code + 1));
+            jumpToBytecode(as, CC_ALWAYS, end - readShort(code + 1));
+            return true;
+        case OP_JUMP_IF_FALSE:
+            falsey(as);
+            emit(as, 0x85); emit(as, 0xC9);           // test ecx, ecx
+            jumpToBytecode(as, CC_NE, end + readShort(code + 1));
+            return true;
+        case OP_NOT:
+            falsey(as);
+            storeBool(as, -VALUE_SIZE, RCX);
+            return true;
+        case OP_NEGATE:
+            guardNumber(as, -VALUE_SIZE, offset);
+            load64(as, RAX, TOP, -VALUE_SIZE + VALUE_PAYLOAD);
+            emit(as, 0x48); emit(as, 0x0F); emit(as, 0xBA); emit(as, 0xF8); emit(as, 63); // btc rax, 63
+            store64(as, TOP, -VALUE_SIZE + VALUE_PAYLOAD, RAX);
+            return true;
+        case OP_ADD:      arithmetic(as, ADDSD_OP, offset); return true;
+        case OP_SUBTRACT: arithmetic(as, SUBSD_OP, offset); return true;
+        case OP_MULTIPLY: arithmetic(as, MULSD_OP, offset); return true;
+        case OP_DIVIDE:   arithmetic(as, DIVSD_OP, offset); return true;
+        case OP_MOD:
+        case OP_INS:
+            guardNumber(as, -2 * VALUE_SIZE, offset);
+            guardNumber(as, -VALUE_SIZE, offset);
+            loadDouble(as, 0, TOP, -2 * VALUE_SIZE + VALUE_PAYLOAD);
+            loadDouble(as, 1, TOP, -VALUE_SIZE + VALUE_PAYLOAD);
+            if (code[0] == OP_MOD) {
+                callAddress(as, (void*)fmod);
+            } else {
+                DIVSD(as, 0, 1);
+                emit(as, 0xF2); emit(as, 0x0F); emit(as, 0x2C); emit(as, 0xC0); // cvttsd2si eax, xmm0
+                emit(as, 0xF2); emit(as, 0x0F); emit(as, 0x2A); emit(as, 0xC0); // cvtsi2sd xmm0, eax
+            }
+            storeDouble(as, TOP, -2 * VALUE_SIZE + VALUE_PAYLOAD, 0);
+            addImmediate(as, TOP, -VALUE_SIZE);
+            return true;
+        case OP_LESS:    comparison(as, 1, 0, offset); return true;
+        case OP_GREATER: comparison(as, 0, 1, offset); return true;
+        case OP_EQUAL: {
+            compareType(as, TOP, -2 * VALUE_SIZE, VAL_NUMBER);
+            int slowLeft = jump(as, CC_NE);
+            compareType(as, TOP, -VALUE_SIZE, VAL_NUMBER);
+            int slowRight = jump(as, CC_NE);
+            loadDouble(as, 0, TOP, -2 * VALUE_SIZE + VALUE_PAYLOAD);
+            loadDouble(as, 1, TOP, -VALUE_SIZE + VALUE_PAYLOAD);
+            UCOMISD(as, 0, 1);
+            emit(as, 0x0F); emit(as, 0x94); emit(as, 0xC0); // sete al
+            emit(as, 0x0F); emit(as, 0x9B); emit(as, 0xC1); // setnp cl
+            emit(as, 0x20); emit(as, 0xC8);                 // and al, cl
+            emit(as, 0x0F); emit(as, 0xB6); emit(as, 0xC0); // movzx eax, al
+            storeBool(as, -2 * VALUE_SIZE, RAX);
+            addImmediate(as, TOP, -VALUE_SIZE);
+            int done = jump(as, CC_ALWAYS);
+
+            bindHere(as, slowLeft);
+            bindHere(as, slowRight);
+            moveRegister(as, RDI, CTX);
+            plainHelper(as, jitEqual);
+            bindHere(as, done);
+            return true;
+        }
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_PROPERTY:
+            moveRegister(as, RDI, CTX);
+            moveRegister(as, RSI, FRAME);
+            moveImmediate(as, RDX, (uint64_t)(uintptr_t)AS_STRING(constants[readShort(code + 1)]));
+            guardedHelper(as, code[0] == OP_GET_GLOBAL ? (void*)jitGetGlobal :
+                              code[0] == OP_SET_GLOBAL ? (void*)jitSetGlobal : (void*)jitGetProperty,
+                          offset);
+            return true;
+        case OP_SET_PROPERTY:
+            moveRegister(as, RDI, CTX);
+            moveImmediate(as, RSI, (uint64_t)(uintptr_t)AS_STRING(constants[readShort(code + 1)]));
+            guardedHelper(as, jitSetProperty, offset);
+            return true;
+        case OP_SINK:
+            moveRegister(as, RDI, CTX);
+            moveImmediate(as, RSI, (uint64_t)(uintptr_t)AS_STRING(constants[readShort(code + 1)]));
+            moveImmediate(as, RDX, code[3]);
+            plainHelper(as, jitSink);
+            testResult(as);
+            jumpToBytecode(as, CC_NE, end + 3 + code[3]);
+            return true;
+        case OP_GET_SUNK: {
+            rex(as, false, 0, SLOTS);
+            emit(as, 0x80);                             // cmp byte [flag], 0
+            memory(as, 7, SLOTS, (code[1] + code[2] + 1) * VALUE_SIZE + VALUE_PAYLOAD);
+            emit(as, 0);
+            int generic = jump(as, CC_E);
+            if (code[3] > 0) {
+                copyValue(as, TOP, 0, SLOTS, (code[1] + code[3]) * VALUE_SIZE);
+                addImmediate(as, TOP, VALUE_SIZE);
+                jumpToBytecode(as, CC_ALWAYS, end + 5);
+            } else {
+                moveRegister(as, RDI, CTX);
+                moveRegister(as, RSI, FRAME);
+                moveImmediate(as, RDX, code[1]);
+                moveImmediate(as, RCX, code[2]);
+                plainHelper(as, jitBuildSunk);
+                jumpToBytecode(as, CC_ALWAYS, end + 2);
+            }
+            bindHere(as, generic);
+            return true;
+        }
+        case OP_GET_INDEX:
+            if (code[1] == OP_GET_PROPERTY) {
+                moveRegister(as, RDI, CTX);
+                moveImmediate(as, RSI, (uint64_t)(uintptr_t)AS_STRING(constants[readShort(code + 2)]));
+                plainHelper(as, jitGetIndexField);
+                emit(as, 0x83); emit(as, 0xF8); emit(as, INDEX_BAILOUT);  // cmp eax, INDEX_BAILOUT
+                bailout(as, CC_E, offset);
+                emit(as, 0x83); emit(as, 0xF8); emit(as, INDEX_FIELD);    // cmp eax, INDEX_FIELD
+                jumpToBytecode(as, CC_E, end + 3);
+                return true;
+            }
+            moveRegister(as, RDI, CTX);
+            guardedHelper(as, jitGetIndex, offset);
+            return true;
+        case OP_SET_INDEX:
+            moveRegister(as, RDI, CTX);
+            guardedHelper(as, jitSetIndex, offset);
+            return true;
+        case OP_LIST:
+            moveRegister(as, RDI, CTX);
+            moveImmediate(as, RSI, code[1]);
+            plainHelper(as, jitList);
+            return true;
+        case OP_CLOSE_UPVALUE:
+            moveRegister(as, RDI, CTX);
+            plainHelper(as, jitCloseUpvalue);
+            return true;
+        case OP_FOR_ITER: {
+            moveRegister(as, RDI, CTX);
+            moveRegister(as, RSI, FRAME);
+            moveImmediate(as, RDX, code[1]);
+            plainHelper(as, jitForIter);
+            emit(as, 0x83); emit(as, 0xF8); emit(as, ITER_DONE);      // cmp eax, ITER_DONE
+            jumpToBytecode(as, CC_E, end + readShort(code + 2));
+            emit(as, 0x83); emit(as, 0xF8); emit(as, ITER_CUSTOM);    // cmp eax, ITER_CUSTOM
+            jumpToBytecode(as, CC_E, end + readShort(code + 4));
+            return true;
+        }
+        case OP_FOR_STEP:
+            forStep(as, code, end);
+            return true;
+        case OP_RETURN:
+            moveRegister(as, RDI, CTX);
+            moveRegister(as, RSI, FRAME);
+            guardedHelper(as, jitReturn, offset);
+            jumpTo(as, CC_ALWAYS, as->frameExit);
+            return true;
+        case OP_RETURN_VALUES:
+            moveRegister(as, RDI, CTX);
+            moveRegister(as, RSI, FRAME);
+            moveImmediate(as, RDX, code[1]);
+            guardedHelper(as, jitReturnValues, offset);
+            jumpTo(as, CC_ALWAYS, as->frameExit);
+            return true;
+        case OP_CALL:
+        case OP_TAIL_CALL:
+            setIp(as, end);
+            moveRegister(as, RDI, CTX);
+            moveRegister(as, RSI, FRAME);
+            moveImmediate(as, RDX, code[1]);
+            callingHelper(as, code[0] == OP_CALL ? (void*)jitCall : (void*)jitTailCall);
+            return true;
+        case OP_MATH: {
+            moveRegister(as, RDI, CTX);
+            moveImmediate(as, RSI, code[4]);
+            moveImmediate(as, RDX, code[3]);
+            plainHelper(as, jitMath);
+            testResult(as);
+            int done = jump(as, CC_NE);
+
+            setIp(as, end);
+            moveRegister(as, RDI, CTX);
+            moveRegister(as, RSI, FRAME);
+            moveImmediate(as, RDX, (uint64_t)(uintptr_t)AS_STRING(constants[readShort(code + 1)]));
+            moveImmediate(as, RCX, code[3]);
+            callingHelper(as, jitInvoke);
+            bindHere(as, done);
+            return true;
+        }
+        case OP_INVOKE:
+        case OP_TAIL_INVOKE:
+        case OP_SUPER_INVOKE: {
+            void* helper = code[0] == OP_INVOKE ? (void*)jitInvoke
+                         : code[0] == OP_TAIL_INVOKE ? (void*)jitTailInvoke
+                         : (void*)jitSuperInvoke;
+            setIp(as, end);
+            moveRegister(as, RDI, CTX);
+            moveRegister(as, RSI, FRAME);
+            moveImmediate(as, RDX, (uint64_t)(uintptr_t)AS_STRING(constants[readShort(code + 1)]));
+            moveImmediate(as, RCX, code[3]);
+            callingHelper(as, helper);
+            return true;
+        }
+        default:
+            // Exceptions, printing and declarations stay interpreted.
+            bailout(as, CC_ALWAYS, offset);
+            return false;
+    }
+}
+
+static void freeAssembler(Assembler* as) {
+    free(as->code);
+    free(as->jumps);
+    free(as->bailouts);
+}
+
+static JitCode* assemble(ObjFunction* function) {
+    Chunk* chunk = &function->chunk;
+    if (chunk->backedges == NULL) initBackedges(chunk);
+    Assembler as = {0};
+    as.function = function;
+    as.entries = malloc(sizeof(uint32_t) * (chunk->count + 1));
+    if (as.entries == NULL) return NULL;
+    for (int i = 0; i <= chunk->count; i++) as.entries[i] = JIT_NO_ENTRY;
+
+    int compiled = 0;
+    int interpreted = 0;
+
+    prologue(&as);
+    epilogue(&as);
+    for (int offset = 0; offset < chunk->count;) {
+        int length = instructionLength(chunk, offset);
+        as.entries[offset] = (uint32_t)as.count;
+        if (translate(&as, offset, length)) compiled++;
+        else interpreted++;
+        offset += length;
+    }
+    bailoutStubs(&as, chunk->count);
+
+    for (int i = 0; i < as.jumpCount; i++) {
+        Fixup* fixup = &as.jumps[i];
+        if (fixup->target < 0 || fixup->target > chunk->count ||
+            as.entries[fixup->target] == JIT_NO_ENTRY) {
+            as.failed = true;
+            break;
+        }
+        patch32(&as, fixup->at, (int)as.entries[fixup->target]);
+    }
+
+    if (as.failed) {
+        free(as.entries);
+        freeAssembler(&as);
+        return NULL;
+    }
+
+    size_t page = 4096;
+    size_t mapped = ((size_t)as.count + page - 1) & ~(page - 1);
+    uint8_t* code = mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        free(as.entries);
+        freeAssembler(&as);
+        return NULL;
+    }
+    memcpy(code, as.code, as.count);
+    if (mprotect(code, mapped, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, mapped);
+        free(as.entries);
+        freeAssembler(&as);
+        return NULL;
+    }
+
+#ifdef PRECISE_GC
+    JitCode* jit = malloc(sizeof(JitCode));
+#else
+    JitCode* jit = GC_MALLOC_UNCOLLECTABLE(sizeof(JitCode));
+#endif
+    jit->function = function;
+    jit->code = code;
+    jit->mapped = mapped;
+    jit->length = as.count;
+    jit->entries = as.entries;
+    jit->compiled = compiled;
+    jit->interpreted = interpreted;
+    jit->runs = 0;
+    jit->bailouts = 0;
+
+    freeAssembler(&as);
+    return jit;
+}
+#endif
+
+// Marks functions the JIT gave up on so they are not compiled again.
+static JitCode unavailable = {0};
+
+JitCode* jitCompile(ObjFunction* function) {
+#ifdef JIT_SUPPORTED
+    pthread_mutex_lock(&jitLock);
+    JitCode* jit = function->jit;
+    if (jit == NULL) {
+        jit = assemble(function);
+        if (jit == NULL) {
+            jit = &unavailable;
+        } else {
+            jit->next = compiledFunctions;
+            compiledFunctions = jit;
+        }
+        function->jit = jit;
+    }
+    pthread_mutex_unlock(&jitLock);
+    return jit;
+#else
+    function->jit = &unavailable;
+    return &unavailable;
+#endif
+}
+
+void jitRun(Thread* ctx) {
+    for (;;) {
+        GC_SAFEPOINT();
+        CallFrame* frame = &ctx->frames[ctx->frameCount - 1];
+        ObjFunction* function = frame->closure->function;
+        JitCode* jit = function->jit;
+
+        if (jit == NULL) {
+            if (__atomic_load_n(&function->chunk.calls, __ATOMIC_RELAXED) < JIT_THRESHOLD) return;
+            jit = jitCompile(function);
+        }
+        if (jit->code == NULL) return;
+
+        uint32_t entry = jit->entries[frame->ip - function->chunk.code];
+        if (entry == JIT_NO_ENTRY) return;
+
+        jit->runs++;
+        JitEntry run = (JitEntry)jit->code;
+        if (run(ctx, frame, jit->code + entry) == JIT_BAILOUT) {
+            jit->bailouts++;
+            return;
+        }
+    }
+}
+
+// On-stack replacement. Native code keeps the interpreter's frame layout
+// and every instruction start is an entry point, so a frame sitting on a
+// hot loop header can jump straight into the compiled loop.
+void jitEnterLoop(Thread* ctx) {
+    ObjFunction* function = ctx->frames[ctx->frameCount - 1].closure->function;
+    if (function->jit == NULL) jitCompile(function);
+    jitRun(ctx);
+}
+
+void jitPrintStats() {
+    pthread_mutex_lock(&jitLock);
+    fprintf(stderr, "%-24s %9s %9s %9s %9s %10s %10s\n", "function",
+            "bytecode", "native", "compiled", "interp", "entries", "bailouts");
+    for (JitCode* jit = compiledFunctions; jit != NULL; jit = jit->next) {
+        ObjFunction* function = jit->function;
+        fprintf(stderr, "%-24s %9d %9zu %9d %9d %10llu %10llu\n",
+                function->name == NULL ? "<script>" : function->name->chars,
+                function->chunk.count, jit->length, jit->compiled, jit->interpreted,
+                (unsigned long long)jit->runs, (unsigned long long)jit->bailouts);
+    }
+    pthread_mutex_unlock(&jitLock);
+}
+
+#ifdef PRECISE_GC
+// Compiled code embeds its constants, so compiled functions are never freed.
+void markJitRoots() {
+    for (JitCode* jit = compiledFunctions; jit != NULL; jit = jit->next) {
+        markObject((Obj*)jit->function);
+    }
+}
+#endif
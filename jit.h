@@ -0,0 +1,94 @@
+#ifndef gem_jit_h
+#define gem_jit_h
+
+#include "common.h"
+#include "object.h"
+#include "vm.h"
+
+// The baseline JIT translates a function's bytecode to x86-64 one
+// instruction at a time, keeping the interpreter's stack and frame layout.
+// Anything it does not translate jumps back to the interpreter.
+#if defined(__x86_64__) && !defined(_WIN32) && !defined(NAN_BOXING)
+#define JIT_SUPPORTED
+#endif
+
+// Calls, or iterations of a single loop, before a function is compiled.
+#define JIT_THRESHOLD 1000
+
+#define JIT_NO_ENTRY UINT32_MAX
+
+// What the native code did before handing control back.
+typedef enum {
+    JIT_BAILOUT,        // frame->ip is an instruction the interpreter must run.
+    JIT_FRAME_CHANGED,  // A call, return or throw switched frames.
+} JitStatus;
+
+// How OP_FOR_ITER advanced a built-in sequence.
+typedef enum {
+    ITER_NEXT,    // The next element was pushed.
+    ITER_DONE,    // The sequence is exhausted.
+    ITER_CUSTOM,  // Not a built-in sequence; use iterator().
+} IterStep;
+
+// How OP_GET_INDEX read an element when OP_GET_PROPERTY follows it.
+typedef enum {
+    INDEX_BAILOUT,  // The interpreter must run the index.
+    INDEX_ELEMENT,  // The element was pushed.
+    INDEX_FIELD,    // A packed list's field was pushed; skip the property.
+} IndexRead;
+
+typedef JitStatus (*JitEntry)(Thread* ctx, CallFrame* frame, uint8_t* target);
+
+typedef struct JitCode {
+    ObjFunction* function;
+    uint8_t* code;
+    size_t mapped;
+    size_t length;
+    uint32_t* entries;     // Native offset for each bytecode offset.
+    int compiled;          // Instructions translated to native code.
+    int interpreted;       // Instructions left to the interpreter.
+    uint64_t runs;
+    uint64_t bailouts;
+    struct JitCode* next;
+} JitCode;
+
+JitCode* jitCompile(ObjFunction* function);
+void jitRun(Thread* ctx);
+void jitEnterLoop(Thread* ctx);
+void jitPrintStats();
+#ifdef PRECISE_GC
+void markJitRoots();
+#endif
+
+// Helpers called from native code. They live in vm.c next to the
+// interpreter code they share. A false result means the interpreter
+// should run the instruction, or that the frame has changed for calls.
+bool jitGetGlobal(Thread* ctx, CallFrame* frame, ObjString* name);
+bool jitLoadGlobal(CallFrame* frame, ObjString* name, Value* out);
+bool jitSetGlobal(Thread* ctx, CallFrame* frame, ObjString* name);
+bool jitGetProperty(Thread* ctx, CallFrame* frame, ObjString* name);
+bool jitSetProperty(Thread* ctx, ObjString* name);
+bool jitSink(Thread* ctx, ObjString* name, int count);
+void jitBuildSunk(Thread* ctx, CallFrame* frame, int slot, int count);
+bool jitGetIndex(Thread* ctx);
+IndexRead jitGetIndexField(Thread* ctx, ObjString* name);
+bool jitSetIndex(Thread* ctx);
+void jitEqual(Thread* ctx);
+void jitList(Thread* ctx, int count);
+void jitCloseUpvalue(Thread* ctx);
+IterStep jitForIter(Thread* ctx, CallFrame* frame, int slot);
+bool jitReturn(Thread* ctx, CallFrame* frame);
+bool jitReturnValues(Thread* ctx, CallFrame* frame, int count);
+bool jitCall(Thread* ctx, CallFrame* frame, int argCount);
+bool jitInvoke(Thread* ctx, CallFrame* frame, ObjString* name, int argCount);
+bool jitTailCall(Thread* ctx, CallFrame* frame, int argCount);
+bool jitTailInvoke(Thread* ctx, CallFrame* frame, ObjString* name, int argCount);
+bool jitInlineGuard(Thread* ctx, ObjFunction* expected, int argCount);
+bool jitInlineInvokeGuard(Thread* ctx, ObjString* name, ObjFunction* expected, int argCount);
+bool jitMath(Thread* ctx, int id, int argCount);
+bool jitSuperInvoke(Thread* ctx, CallFrame* frame, ObjString* name, int argCount);
+#ifdef PRECISE_GC
+void jitUpvalueBarrier(CallFrame* frame, int slot);
+#endif
+
+#endif
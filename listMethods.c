@@ -1,3 +1,7 @@
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
 #include "memory.h"
 #include "value.h"
 #include "vm.h"
@@ -24,53 +28,28 @@ static Value listIteratorNative(Thread* ctx, int argCount, Value* args) {
 }
 
 static Value listAppendNative(Thread* ctx, int argCount, Value* args) {
-    if (argCount != 1) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "No method append for arity %d.", argCount);
-        return NIL_VAL;
-    }
+    ObjList* list = (ObjList*)AS_OBJ(args[-1]);
+    if (appendPacked(list, args[0])) return OBJ_VAL(list);
 
-    ObjList* list = AS_LIST(args[-1]);
+    list = AS_LIST(args[-1]);
     writeValueArray(&list->elements, args[0]);
     return OBJ_VAL(list);
 }
 
 static Value listPeekNative(Thread* ctx, int argCount, Value* args){
-    if (argCount != 0) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "No method append for arity %d.", argCount);
-        return NIL_VAL;
-    }
-
     ObjList* list = AS_LIST(args[-1]);
     return list->elements.values[list->elements.count - 1];
 }
 
 static Value listLengthNative(Thread* ctx, int argCount, Value* args) {
-    if (argCount != 0) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "No method length for arity %d.", argCount);
-        return NIL_VAL;
-    }
+    PackedStructs* packed = packedStructs((ObjList*)AS_OBJ(args[-1]));
+    if (packed != NULL) return NUMBER_VAL(packedLength(packed));
 
     ObjList* list = AS_LIST(args[-1]);
     return NUMBER_VAL(list->elements.count);
 }
 
 static Value listGetNative(Thread* ctx, int argCount, Value* args) {
-    if (argCount != 1) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "No method get for arity %d.", argCount);
-        return NIL_VAL;
-    }
-
-    if (!IS_NUMBER(args[0])) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "get: expected (Number) but got (%s).",
-                     getValueTypeName(args[0]));
-        return NIL_VAL;
-    }
-
     ObjList* list = AS_LIST(args[-1]);
     int index = (int)AS_NUMBER(args[0]);
     if (index < 0 || index >= list->elements.count) {
@@ -84,19 +63,6 @@ static Value listGetNative(Thread* ctx, int argCount, Value* args) {
 }
 
 static Value listSetNative(Thread* ctx, int argCount, Value* args) {
-    if (argCount != 2) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "No method set for arity %d.", argCount);
-        return NIL_VAL;
-    }
-
-    if (!IS_NUMBER(args[0])) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "set: expected (Number, Any) but got (%s, %s).",
-                     getValueTypeName(args[0]), getValueTypeName(args[1]));
-        return NIL_VAL;
-    }
-
     ObjList* list = AS_LIST(args[-1]);
     int index = (int)AS_NUMBER(args[0]);
     if (index < 0 || index >= list->elements.count) {
@@ -107,16 +73,11 @@ static Value listSetNative(Thread* ctx, int argCount, Value* args) {
     }
 
     list->elements.values[index] = args[1];
+    ARRAY_BARRIER(&list->elements, args[1]);
     return args[1];
 }
 
 static Value listPopNative(Thread* ctx, int argCount, Value* args) {
-    if (argCount != 0) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "No method pop for arity %d.", argCount);
-        return NIL_VAL;
-    }
-
     ObjList* list = AS_LIST(args[-1]);
     if (list->elements.count == 0) {
         runtimeErrorCtx(ctx, vm.indexErrorClass, "pop: empty list.");
@@ -128,19 +89,6 @@ static Value listPopNative(Thread* ctx, int argCount, Value* args) {
 }
 
 static Value listInsertNative(Thread* ctx, int argCount, Value* args) {
-    if (argCount != 2) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "No method insert for arity %d.", argCount);
-        return NIL_VAL;
-    }
-
-    if (!IS_NUMBER(args[0])) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "insert: expected (Number, Any) but got (%s, %s).",
-                     getValueTypeName(args[0]), getValueTypeName(args[1]));
-        return NIL_VAL;
-    }
-
     ObjList* list = AS_LIST(args[-1]);
     int index = (int)AS_NUMBER(args[0]);
     if (index < 0 || index > list->elements.count) {
@@ -163,29 +111,18 @@ static Value listInsertNative(Thread* ctx, int argCount, Value* args) {
     }
 
     list->elements.values[index] = args[1];
+    ARRAY_BARRIER(&list->elements, args[1]);
     list->elements.count++;
     return args[1];
 }
 
 static Value listClearNative(Thread* ctx, int argCount, Value* args) {
-    if (argCount != 0) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "No method clear for arity %d.", argCount);
-        return NIL_VAL;
-    }
-
     ObjList* list = AS_LIST(args[-1]);
     list->elements.count = 0;
     return NIL_VAL;
 }
 
 static Value listContainsNative(Thread* ctx, int argCount, Value* args) {
-    if (argCount != 1) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "No method contains for arity %d.", argCount);
-        return NIL_VAL;
-    }
-
     ObjList* list = AS_LIST(args[-1]);
     Value target = args[0];
 
@@ -199,19 +136,6 @@ static Value listContainsNative(Thread* ctx, int argCount, Value* args) {
 }
 
 static Value listRemoveNative(Thread* ctx, int argCount, Value* args) {
-    if (argCount != 1) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "No method remove for arity %d.", argCount);
-        return NIL_VAL;
-    }
-
-    if (!IS_NUMBER(args[0])) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "remove: expected (Number) but got (%s).",
-                     getValueTypeName(args[0]));
-        return NIL_VAL;
-    }
-
     ObjList* list = AS_LIST(args[-1]);
     int index = (int)AS_NUMBER(args[0]);
     if (index < 0 || index >= list->elements.count) {
@@ -335,3 +259,79 @@ static Value listSortNative(Thread* ctx, int argCount, Value* args) {
     return OBJ_VAL(list);
 }
 
+// The text `+` gives a value next to a string, or NULL for other types.
+static const char* joinText(Value value, char* buffer, size_t size, int* length) {
+    if (IS_STRING(value)) {
+        *length = AS_STRING(value)->length;
+        return AS_STRING(value)->chars;
+    }
+    const char* text;
+    if (IS_NUMBER(value)) {
+        *length = snprintf(buffer, size, "%.14g", AS_NUMBER(value));
+        return buffer;
+    }
+    if (IS_BOOL(value)) text = AS_BOOL(value) ? "true" : "false";
+    else if (IS_NIL(value)) text = "nil";
+    else return NULL;
+    *length = (int)strlen(text);
+    return text;
+}
+
+// Measures the elements first, so the result is copied once instead of
+// once per `+`.
+static Value listJoinNative(Thread* ctx, int argCount, Value* args) {
+    ObjList* list = AS_LIST(args[-1]);
+    ObjString* separator = AS_STRING(args[0]);
+    char buffer[32];
+
+    size_t length = 0;
+    for (int i = 0; i < list->elements.count; i++) {
+        int elementLength;
+        if (joinText(list->elements.values[i], buffer, sizeof(buffer), &elementLength) == NULL) {
+            runtimeErrorCtx(ctx, vm.typeErrorClass,
+                         "join: can't join %s at index %d.",
+                         getValueTypeName(list->elements.values[i]), i);
+            return NIL_VAL;
+        }
+        length += elementLength;
+        if (i > 0) length += separator->length;
+    }
+    if (length > INT_MAX) {
+        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass, "join: result is too long.");
+        return NIL_VAL;
+    }
+
+    char* chars = ALLOCATE_ATOMIC(char, length + 1);
+    char* end = chars;
+    for (int i = 0; i < list->elements.count; i++) {
+        if (i > 0) {
+            memcpy(end, separator->chars, separator->length);
+            end += separator->length;
+        }
+        int elementLength;
+        const char* text = joinText(list->elements.values[i], buffer, sizeof(buffer), &elementLength);
+        memcpy(end, text, elementLength);
+        end += elementLength;
+    }
+    *end = '\0';
+    return OBJ_VAL(newString(chars, (int)length));
+}
+
+static const NativeDef listMethods[] = {
+    {"append", listAppendNative, 1, {NATIVE_ANY}},
+    {"add", listAppendNative, 1, {NATIVE_ANY}},
+    {"push", listAppendNative, 1, {NATIVE_ANY}},
+    {"length", listLengthNative, 0},
+    {"get", listGetNative, 1, {NATIVE_NUMBER}},
+    {"set", listSetNative, 2, {NATIVE_NUMBER, NATIVE_ANY}},
+    {"pop", listPopNative, 0},
+    {"insert", listInsertNative, 2, {NATIVE_NUMBER, NATIVE_ANY}},
+    {"clear", listClearNative, 0},
+    {"contains", listContainsNative, 1, {NATIVE_ANY}},
+    {"remove", listRemoveNative, 1, {NATIVE_NUMBER}},
+    {"sort", listSortNative, NATIVE_VARIADIC},
+    {"iterator", listIteratorNative, 0},
+    {"peek", listPeekNative, 0},
+    {"join", listJoinNative, 1, {NATIVE_STRING}},
+    {NULL},
+};
@@ -4,17 +4,23 @@
 
 #include "chunk.h"
 #include "compiler.h"
+#include "memory.h"
 #include "GemError.h"
 #include "GemIterator.h"
 #include "GemFile.h"
+#include "GemStringBuilder.h"
 #include "vm.h"
+#include "jit.h"
+#include "profile.h"
 
 #include <signal.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <setjmp.h>
 #include <pthread.h>
+#ifndef PRECISE_GC
 #include <gc.h>
+#endif
 #define TB_IMPL
 #include "termbox2.h"
 #include "serialize.h"
@@ -531,6 +537,15 @@ char* getFileText() {
     return buf;
 }
 
+char* getStringBuilderText() {
+    char* buf = malloc(StringBuilder_gem_len + 1);
+    if (!buf) return NULL;
+
+    memcpy(buf, StringBuilder_gem, StringBuilder_gem_len);
+    buf[StringBuilder_gem_len] = '\0';
+    return buf;
+}
+
 #include "deserializeMemory.h"
 // This macro embeds a binary file into the executable.
 #ifndef INCBIN_H
@@ -566,10 +581,95 @@ ObjFunction* loadSourceCompiler() {
     return deserialize_from_memory(SourceCompiler_start, size);
 }
 
+// Reads a byte count such as 512K, 64M or 2G. Returns false if the text
+// isn't one.
+static bool parseSize(const char* text, size_t* size) {
+    char* end;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (end == text) return false;
+
+    switch (*end) {
+        case 'k': case 'K': value <<= 10; end++; break;
+        case 'm': case 'M': value <<= 20; end++; break;
+        case 'g': case 'G': value <<= 30; end++; break;
+    }
+    if (*end != '\0') return false;
+    *size = (size_t)value;
+    return true;
+}
+
+static bool parseCount(const char* text, unsigned long* count) {
+    char* end;
+    *count = strtoul(text, &end, 10);
+    return end != text && *end == '\0';
+}
+
+// Applies one "--gc-..." flag or GEM_GC_... variable. `name` is the part
+// after the prefix, with dashes.
+static bool applyGCOption(GCOptions* options, const char* name, const char* value) {
+    unsigned long count;
+    if (strcmp(name, "initial-heap") == 0) return value != NULL && parseSize(value, &options->initialHeap);
+    if (strcmp(name, "max-heap") == 0) return value != NULL && parseSize(value, &options->maxHeap);
+    if (strcmp(name, "heap-quota") == 0) return value != NULL && parseSize(value, &options->heapQuota);
+    if (strcmp(name, "thread-quota") == 0) return value != NULL && parseSize(value, &options->threadQuota);
+    if (strcmp(name, "free-space-divisor") == 0) {
+        return value != NULL && parseCount(value, &options->freeSpaceDivisor);
+    }
+    if (strcmp(name, "markers") == 0) {
+        if (value == NULL || !parseCount(value, &count)) return false;
+        options->markers = (int)count;
+        return true;
+    }
+    if (strcmp(name, "incremental") == 0) {
+        options->incremental = value == NULL || strcmp(value, "0") != 0;
+        return true;
+    }
+    return false;
+}
+
+// The collector starts before anything else, so its settings are read
+// ahead of the other flags: first the environment, then any --gc- flags
+// before the script name, which win.
+static void readGCOptions(GCOptions* options, int argc, const char* argv[]) {
+    static const struct { const char* variable; const char* name; } variables[] = {
+        {"GEM_GC_INITIAL_HEAP", "initial-heap"},
+        {"GEM_GC_MAX_HEAP", "max-heap"},
+        {"GEM_GC_FREE_SPACE_DIVISOR", "free-space-divisor"},
+        {"GEM_GC_MARKERS", "markers"},
+        {"GEM_GC_INCREMENTAL", "incremental"},
+        {"GEM_GC_HEAP_QUOTA", "heap-quota"},
+        {"GEM_GC_THREAD_QUOTA", "thread-quota"},
+    };
+    for (size_t i = 0; i < sizeof(variables) / sizeof(variables[0]); i++) {
+        const char* value = getenv(variables[i].variable);
+        if (value != NULL && !applyGCOption(options, variables[i].name, value)) {
+            fprintf(stderr, "Invalid %s: %s\n", variables[i].variable, value);
+            exit(64);
+        }
+    }
+
+    for (int i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (strncmp(argv[i], "--gc-", 5) != 0) continue;
+
+        char name[64];
+        const char* equals = strchr(argv[i], '=');
+        size_t length = equals != NULL ? (size_t)(equals - argv[i] - 5) : strlen(argv[i] + 5);
+        if (length >= sizeof(name)) length = sizeof(name) - 1;
+        memcpy(name, argv[i] + 5, length);
+        name[length] = '\0';
+
+        if (!applyGCOption(options, name, equals != NULL ? equals + 1 : NULL)) {
+            fprintf(stderr, "Invalid option: %s\n", argv[i]);
+            exit(64);
+        }
+    }
+}
+
 int main(int argc, const char* argv[]) {
-    GC_set_warn_proc(NULL);
-    GC_INIT();
-    GC_allow_register_threads();
+    GCOptions gcOptions = {0};
+    readGCOptions(&gcOptions, argc, argv);
+    initGC(&gcOptions);
+
     int runRepl = 1;
     const char* scriptPath = NULL;
 
@@ -590,8 +690,23 @@ int main(int argc, const char* argv[]) {
             printf("  -h, --help       Show this help message.\n");
             printf("  -v, --version    Show version info.\n");
             printf("  -s, --show           Show the bytecode generated.\n");
-            printf("  -r, --raw            Turns off the garbage collector.\n");
+            printf("  -r, --raw            Compile with the bootstrapped Gem compiler.\n");
             printf("  -c, --compile        Does not run the code, only checks for valid compilation.\n");
+            printf("      --jit            Compile hot functions to native code (default).\n");
+            printf("      --no-jit         Only use the interpreter.\n");
+            printf("      --jit-stats      Print per-function JIT statistics on exit.\n");
+            printf("      --profile-hot    Print the most called functions and loops on exit.\n");
+            printf("      --profile-heap[=SIZE]  Print the top allocation sites and live objects on\n");
+            printf("                       exit, sampling every SIZE bytes (default 64K).\n");
+            printf("      --gc-initial-heap=SIZE      Start with a heap of SIZE bytes (K, M, G suffixes).\n");
+            printf("      --gc-max-heap=SIZE          Never grow the heap past SIZE bytes.\n");
+            printf("      --gc-free-space-divisor=N   Collect more often for a higher N.\n");
+            printf("      --gc-incremental            Collect incrementally, in shorter pauses.\n");
+            printf("      --gc-markers=N              Mark with N parallel threads.\n");
+            printf("      --gc-heap-quota=SIZE        Raise MemoryError once the heap holds SIZE bytes.\n");
+            printf("      --gc-thread-quota=SIZE      Raise MemoryError once a thread may hold SIZE bytes.\n");
+            printf("  Each --gc- option can also be set with a GEM_GC_ variable, such as\n");
+            printf("  GEM_GC_MAX_HEAP=512M. The flags win.\n");
             return 0;
         } else if (strcmp(arg, "--version") == 0 || strcmp(arg, "-v") == 0) {
             printf("gem version 1.6.7\n");
@@ -605,6 +720,29 @@ int main(int argc, const char* argv[]) {
         }
         else if (strcmp(arg, "--zip") == 0 || strcmp(arg, "-z") == 0) {
             vm.zip = true;
+        } else if (strcmp(arg, "--jit") == 0) {
+#ifdef JIT_SUPPORTED
+            vm.jit = true;
+#else
+            fprintf(stderr, "The JIT is not available on this platform.\n");
+#endif
+        } else if (strcmp(arg, "--no-jit") == 0) {
+            vm.jit = false;
+        } else if (strcmp(arg, "--jit-stats") == 0) {
+            atexit(jitPrintStats);
+        } else if (strcmp(arg, "--profile-hot") == 0) {
+            vm.profileHot = true;
+            atexit(printHotProfile);
+        } else if (strcmp(arg, "--profile-heap") == 0 || strncmp(arg, "--profile-heap=", 15) == 0) {
+            size_t interval = 0;
+            if (arg[14] == '=' && !parseSize(arg + 15, &interval)) {
+                fprintf(stderr, "Invalid option: %s\n", arg);
+                return 64;
+            }
+            startHeapProfile(interval);
+            atexit(printHeapProfile);
+        } else if (strncmp(arg, "--gc-", 5) == 0) {
+            // Already applied by readGCOptions().
         } else if (arg[0] == '-') {
             fprintf(stderr, "Unknown option: %s\n", arg);
             return 64;
@@ -625,6 +763,7 @@ int main(int argc, const char* argv[]) {
     interpret(getErrorText());
     interpret(getIteratorText());
     interpret(getFileText());
+    interpret(getStringBuilderText());
     //interpret(getWindowText());
     //interpret(getMathText());
 
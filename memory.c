@@ -2,7 +2,10 @@
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
+#include <time.h>
+#ifndef PRECISE_GC
 #include <gc.h>
+#endif
 
 #include "memory.h"
 #include "compiler.h"
@@ -15,58 +18,668 @@
 
 #define GC_HEAP_GROW_FACTOR 1.3
 
-void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
-/*
-    vm.bytesAllocated += newSize - oldSize;
+// Bytes a thread allocates before it adds them to the heap's count.
+#define QUOTA_BATCH (64 * 1024)
 
+static _Thread_local size_t threadAllocated = 0;
+static _Thread_local size_t unflushed = 0;
 
-    if (newSize > oldSize) {
-#ifdef DEBUG_STRESS_GC
-        collectGarbage();
-#endif
-        if (pthread_self() == vm.main && vm.gcEnabled)
-            if (vm.bytesAllocated > vm.nextGC) {
-                collectGarbage();
-                printf("gc triggered %d", vm.nextGC);
-            }
+static struct {
+    size_t heap;
+    size_t thread;  // For threads started from now on.
+} quotas;
+
+static _Thread_local Thread* quotaThread = NULL;
+static _Thread_local size_t threadQuota = 0;
+
+// What the thread quota is charged against. A thread can't hold more than
+// the heap does, so once it sees that another full collection has finished
+// the count drops to the heap in use if it was higher. It starts again
+// from 0 after the quota fires.
+static atomic_size_t fullCollections;
+static _Thread_local size_t quotaAllocated = 0;
+static _Thread_local size_t quotaEpoch = 0;
+
+// Stop-the-world pauses, in milliseconds. Only the collecting thread
+// writes them.
+static struct {
+    size_t collections;
+    double started;
+    double last;
+    double max;
+    double total;
+} pauses;
+
+static double nowMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+static void pauseStarted() {
+    pauses.started = nowMs();
+}
+
+static void pauseEnded() {
+    double pause = nowMs() - pauses.started;
+    pauses.collections++;
+    pauses.last = pause;
+    pauses.total += pause;
+    if (pause > pauses.max) pauses.max = pause;
+}
+
+size_t gcThreadAllocated() {
+    return threadAllocated;
+}
+
+void gcBindThread(Thread* ctx) {
+    quotaThread = ctx;
+    threadQuota = __atomic_load_n(&quotas.thread, __ATOMIC_RELAXED);
+}
+
+Thread* gcCurrentThread() {
+    return quotaThread;
+}
+
+size_t gcHeapQuota() {
+    return quotas.heap;
+}
+
+void gcSetHeapQuota(size_t bytes) {
+    quotas.heap = bytes;
+}
+
+size_t gcThreadQuota() {
+    return threadQuota;
+}
+
+// Threads started afterwards get the same quota.
+void gcSetThreadQuota(size_t bytes) {
+    threadQuota = bytes;
+    __atomic_store_n(&quotas.thread, bytes, __ATOMIC_RELAXED);
+}
+
+static void fullCollectionEnded() {
+    atomic_fetch_add_explicit(&fullCollections, 1, memory_order_relaxed);
+}
+
+static size_t heapInUse();
+
+static bool overThreadQuota() {
+    size_t epoch = atomic_load_explicit(&fullCollections, memory_order_relaxed);
+    if (epoch != quotaEpoch) {
+        quotaEpoch = epoch;
+        size_t inUse = heapInUse();
+        if (quotaAllocated > inUse) quotaAllocated = inUse;
     }
+    return threadQuota > 0 && quotaAllocated > threadQuota;
+}
 
+// Fills in the MemoryError message for a thread over its quota, which
+// starts counting again so the program can catch it and carry on.
+static bool threadQuotaExceeded(char* message, size_t size) {
+    if (!overThreadQuota()) return false;
+    snprintf(message, size, "Thread may hold %zu bytes, over its quota of %zu.",
+             quotaAllocated, threadQuota);
+    quotaAllocated = 0;
+    return true;
+}
 
-    if (newSize == 0) {
-        free(pointer);
-        return NULL;
+static void flushAllocations(size_t bytes);
+
+// The slow part runs once per batch.
+static void countAllocation(size_t bytes) {
+    threadAllocated += bytes;
+    quotaAllocated += bytes;
+    unflushed += bytes;
+    if (unflushed < QUOTA_BATCH) return;
+
+    flushAllocations(unflushed);
+    unflushed = 0;
+    if (quotaThread == NULL) return;
+    if (overThreadQuota() || (quotas.heap > 0 && heapInUse() > quotas.heap)) {
+        quotaThread->quotaCheck = true;
     }
+}
+
+#ifndef PRECISE_GC
+
+// Boehm keeps its own count of the heap, so batches only prompt a look at
+// it.
+static void flushAllocations(size_t bytes) {
+    (void)bytes;
+}
+
+static size_t heapInUse() {
+    return GC_get_heap_size() - GC_get_free_bytes();
+}
 
+void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
+    if (newSize == 0) return NULL;
+    if (newSize > oldSize) countAllocation(newSize - oldSize);
+    if (pointer == NULL) return GC_MALLOC(newSize);
     void* result = GC_REALLOC(pointer, newSize);
     if (result == NULL) exit(1);
     return result;
-*/
+}
 
+// Atomic blocks are neither scanned nor cleared, so the caller fills
+// them. GC_REALLOC keeps a block's kind when it grows it.
+void* reallocateAtomic(void* pointer, size_t oldSize, size_t newSize) {
     if (newSize == 0) return NULL;
-    if (pointer == NULL) return GC_MALLOC(newSize);
+    if (newSize > oldSize) countAllocation(newSize - oldSize);
+    if (pointer == NULL) return GC_MALLOC_ATOMIC(newSize);
     void* result = GC_REALLOC(pointer, newSize);
     if (result == NULL) exit(1);
     return result;
 }
-/*
+
+static _Thread_local void** objectCache = NULL;
+
+void useObjectCache(Thread* ctx) {
+    objectCache = ctx->objectCache;
+}
+
+// GC_malloc_many returns a batch of cleared objects, linked through their
+// first word, for a single trip through the allocator lock. Threads that
+// allocate at the same time then only meet there once per batch. The main
+// thread has no context and allocates directly.
+void* allocateObjectMemory(size_t size) {
+    size_t sizeClass = (size - 1) / OBJECT_CACHE_GRANULE;
+    if (objectCache == NULL || sizeClass >= OBJECT_CACHE_CLASSES) {
+        return reallocate(NULL, 0, size);
+    }
+
+    void** list = &objectCache[sizeClass];
+    if (*list == NULL) {
+        *list = GC_malloc_many((sizeClass + 1) * OBJECT_CACHE_GRANULE);
+        if (*list == NULL) exit(1);
+    }
+    void* object = *list;
+    *list = GC_NEXT(object);
+    GC_NEXT(object) = NULL;
+    countAllocation(size);
+    return object;
+}
+
+// Boehm calls this with its lock held, so it only takes the time and
+// counts full collections for the thread quota.
+static void onCollectionEvent(GC_EventType event) {
+    if (event == GC_EVENT_PRE_STOP_WORLD) pauseStarted();
+    if (event == GC_EVENT_POST_START_WORLD) pauseEnded();
+    if (event == GC_EVENT_END) fullCollectionEnded();
+}
+
+void initGC(const GCOptions* options) {
+    // Boehm only reads the marker count while it starts up.
+    if (options->markers > 0) GC_set_markers_count(options->markers);
+    GC_set_warn_proc(NULL);
+    GC_INIT();
+    GC_allow_register_threads();
+
+    if (options->freeSpaceDivisor > 0) GC_set_free_space_divisor(options->freeSpaceDivisor);
+    if (options->initialHeap > 0) GC_expand_hp(options->initialHeap);
+    if (options->maxHeap > 0) GC_set_max_heap_size(options->maxHeap);
+    if (options->incremental) GC_enable_incremental();
+    GC_set_on_collection_event(onCollectionEvent);
+    quotas.heap = options->heapQuota;
+    quotas.thread = options->threadQuota;
+}
+
+void gcCollect() {
+    GC_gcollect();
+}
+
+// A heap or thread still over its quota after a full collection is really
+// over it.
+bool gcOverQuota(char* message, size_t size) {
+    if (overThreadQuota()) GC_gcollect();
+    if (threadQuotaExceeded(message, size)) return true;
+    if (quotas.heap == 0 || heapInUse() <= quotas.heap) return false;
+
+    GC_gcollect();
+    size_t inUse = heapInUse();
+    if (inUse <= quotas.heap) return false;
+    snprintf(message, size, "Heap of %zu bytes is over its quota of %zu.", inUse, quotas.heap);
+    return true;
+}
+
+void gcStats(GCStats* stats) {
+    stats->collections = pauses.collections;
+    stats->lastPause = pauses.last;
+    stats->maxPause = pauses.max;
+    stats->totalPause = pauses.total;
+    stats->heapSize = GC_get_heap_size();
+    stats->freeBytes = GC_get_free_bytes();
+    stats->totalBytes = GC_get_total_bytes();
+}
+
+#else
+
+#include <stdatomic.h>
+
+#include "jit.h"
+#include "profile.h"
+
+// A precise, generational collector that never moves objects. New objects
+// start young, on the list of the thread that made them. A minor
+// collection traces from the roots and the remembered set, frees the young
+// objects it didn't reach and promotes the rest to the old list. Old
+// objects keep their mark bit between collections, so the mark bit is also
+// the generation: tracing stops at them, and the write barrier only
+// remembers stores of unmarked objects. A major collection clears the old
+// marks and traces everything.
+//
+// Collections only start at safepoints: back edges and calls in the
+// interpreter, and loop back edges in compiled code. Every other thread is
+// parked at one or blocked in a join, so natives and the compiler can hold
+// objects in C variables without rooting them.
+
+// Bytes allocated between minor collections, and the old generation a
+// program may build before its first major one.
+#define GC_NURSERY_SIZE (4 * 1024 * 1024)
+#define GC_FIRST_MAJOR (16 * 1024 * 1024)
+
+typedef enum {
+    REMEMBERED_TABLE,
+    REMEMBERED_ARRAY,
+} RememberedKind;
+
+typedef struct {
+    RememberedKind kind;
+    void* target;
+} Remembered;
+
+// The collector's state for one thread. Only that thread touches it
+// between collections.
+typedef struct Mutator {
+    Obj** young;              // Objects allocated since the last collection.
+    int youngCount;
+    int youngCapacity;
+    Obj** remembered;         // Old objects given young references since then.
+    int rememberedCount;
+    int rememberedCapacity;
+    Remembered* containers;   // Tables and arrays outside any object given them.
+    int containerCount;
+    void** containerSet;      // The same containers, hashed by address.
+    int containerCapacity;
+    int containerSetCapacity;
+    void** freed;             // Blocks another thread may still be reading.
+    int freedCount;
+    int freedCapacity;
+    Thread* ctx;
+    bool exited;
+    struct Mutator* next;
+} Mutator;
+
+typedef struct {
+    ObjThread* thread;
+    bool pinned;
+} ThreadRoot;
+
+static pthread_mutex_t gcLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gcChanged = PTHREAD_COND_INITIALIZER;
+static pthread_key_t mutatorKey;
+static _Thread_local Mutator* mutator = NULL;
+
+static struct {
+    Mutator* mutators;
+    Obj** old;
+    int oldCount;
+    int oldCapacity;
+    ThreadRoot* threads;
+    int threadCount;
+    int threadCapacity;
+
+    Obj** gray;
+    int grayCount;
+    int grayCapacity;
+
+    atomic_size_t allocated;  // Bytes allocated since the last collection.
+    size_t live;              // Bytes held by the old generation.
+    size_t marked;            // Bytes traced by the current collection.
+    size_t nextMajor;
+    size_t totalBytes;
+    bool collecting;
+    bool forceMajor;
+    bool census;              // Counting live objects for --profile-heap.
+
+    size_t nurserySize;
+    size_t maxHeap;
+    double growFactor;
+
+    // Threads using the heap, less those blocked in a join. A collection
+    // waits until every other one is parked.
+    int running;
+    int parked;
+    bool stopping;
+} heap;
+
+static void* growBuffer(void* buffer, int* capacity, size_t size) {
+    *capacity = GROW_CAPACITY(*capacity);
+    buffer = realloc(buffer, size * *capacity);
+    if (buffer == NULL) {
+        fprintf(stderr, "Not enough memory for GC.\n");
+        exit(1);
+    }
+    return buffer;
+}
+
+static Mutator* currentMutator() {
+    if (mutator != NULL) return mutator;
+
+    mutator = calloc(1, sizeof(Mutator));
+    if (mutator == NULL) {
+        fprintf(stderr, "Not enough memory for GC.\n");
+        exit(1);
+    }
+    pthread_mutex_lock(&gcLock);
+    mutator->next = heap.mutators;
+    heap.mutators = mutator;
+    pthread_mutex_unlock(&gcLock);
+    return mutator;
+}
+
+static void flushAllocations(size_t bytes) {
+    size_t allocated = atomic_fetch_add_explicit(&heap.allocated, bytes,
+                                                 memory_order_relaxed) + bytes;
+    if (allocated > heap.nurserySize ||
+        (heap.maxHeap > 0 && heap.live + allocated > heap.maxHeap)) {
+        vm.gcRequested = true;
+    }
+    // Only a major collection shows whether the old generation is still
+    // over the quota, or how much a thread over its own could still hold.
+    // The thread reaches it before gcOverQuota().
+    if ((quotas.heap > 0 && heap.live + allocated > quotas.heap) || overThreadQuota()) {
+        heap.forceMajor = true;
+        vm.gcRequested = true;
+    }
+}
+
+static size_t heapInUse() {
+    return heap.live + atomic_load_explicit(&heap.allocated, memory_order_relaxed);
+}
+
+// Threads share lists and tables without locking, so a block that is
+// replaced or freed outside a collection is kept until the next one, when
+// nobody can still be reading it.
+static void release(void* pointer) {
+    if (pointer == NULL) return;
+    if (heap.collecting) {
+        free(pointer);
+        return;
+    }
+
+    Mutator* self = currentMutator();
+    if (self->freedCount == self->freedCapacity) {
+        self->freed = growBuffer(self->freed, &self->freedCapacity, sizeof(void*));
+    }
+    self->freed[self->freedCount++] = pointer;
+}
+
+static void* resize(void* pointer, size_t oldSize, size_t newSize, bool clear) {
+    if (newSize == 0) {
+        release(pointer);
+        return NULL;
+    }
+    if (pointer == NULL) oldSize = 0;
+    if (newSize <= oldSize) return pointer;
+
+    countAllocation(newSize - oldSize);
+#ifdef DEBUG_STRESS_GC
+    vm.gcRequested = true;
+#endif
+    void* result = malloc(newSize);
+    if (result == NULL) exit(1);
+    if (oldSize > 0) memcpy(result, pointer, oldSize);
+    if (clear) memset((char*)result + oldSize, 0, newSize - oldSize);
+    release(pointer);
+    return result;
+}
+
+// Blocks start zeroed, as they did under the conservative collector.
+void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
+    return resize(pointer, oldSize, newSize, true);
+}
+
+void* reallocateAtomic(void* pointer, size_t oldSize, size_t newSize) {
+    return resize(pointer, oldSize, newSize, false);
+}
+
+// malloc already keeps per-thread caches of small blocks.
+void* allocateObjectMemory(size_t size) {
+    return reallocate(NULL, 0, size);
+}
+
+// Objects carry no list link, so the generations are arrays of pointers.
+void trackObject(Obj* object) {
+    Mutator* self = currentMutator();
+    if (self->youngCount == self->youngCapacity) {
+        self->young = growBuffer(self->young, &self->youngCapacity, sizeof(Obj*));
+    }
+    self->young[self->youngCount++] = object;
+}
+
+// ---------------------
+// Threads and safepoints
+// ---------------------
+static void threadExited(void* data) {
+    Mutator* self = data;
+    pthread_mutex_lock(&gcLock);
+    if (self->ctx != NULL) self->ctx->finished = true;
+    self->exited = true;
+    heap.running--;
+    pthread_cond_broadcast(&gcChanged);
+    pthread_mutex_unlock(&gcLock);
+}
+
+// There is one marker and no incremental mode, so those options are
+// ignored. The initial heap is how far the old generation may grow before
+// the first major collection, and the divisor sets how far it may grow
+// past the live data after each one.
+void initGC(const GCOptions* options) {
+    pthread_key_create(&mutatorKey, threadExited);
+    heap.nurserySize = GC_NURSERY_SIZE;
+    heap.nextMajor = options->initialHeap > 0 ? options->initialHeap : GC_FIRST_MAJOR;
+    heap.maxHeap = options->maxHeap;
+    heap.growFactor = options->freeSpaceDivisor > 0
+        ? 1.0 + 1.0 / options->freeSpaceDivisor
+        : GC_HEAP_GROW_FACTOR;
+    heap.running = 1;  // The main thread.
+    quotas.heap = options->heapQuota;
+    quotas.thread = options->threadQuota;
+    currentMutator();
+}
+
+// Runs a major collection now. Natives call this between instructions,
+// which is a safepoint.
+void gcCollect() {
+    heap.forceMajor = true;
+    vm.gcRequested = true;
+    gcSafepoint();
+}
+
+bool gcOverQuota(char* message, size_t size) {
+    if (threadQuotaExceeded(message, size)) return true;
+    size_t inUse = heapInUse();
+    if (quotas.heap == 0 || inUse <= quotas.heap) return false;
+    snprintf(message, size, "Heap of %zu bytes is over its quota of %zu.", inUse, quotas.heap);
+    return true;
+}
+
+void gcStats(GCStats* stats) {
+    size_t allocated = atomic_load_explicit(&heap.allocated, memory_order_relaxed);
+    stats->collections = pauses.collections;
+    stats->lastPause = pauses.last;
+    stats->maxPause = pauses.max;
+    stats->totalPause = pauses.total;
+    stats->heapSize = heap.live + allocated;
+    stats->freeBytes = 0;  // Freed memory goes back to malloc.
+    stats->totalBytes = heap.totalBytes + allocated;
+}
+
+void gcThreadStart(Thread* ctx) {
+    gcEndBlocking();
+    currentMutator()->ctx = ctx;
+    pthread_setspecific(mutatorKey, mutator);
+}
+
+void gcBeginBlocking() {
+    pthread_mutex_lock(&gcLock);
+    heap.running--;
+    pthread_cond_broadcast(&gcChanged);
+    pthread_mutex_unlock(&gcLock);
+}
+
+void gcEndBlocking() {
+    pthread_mutex_lock(&gcLock);
+    while (heap.stopping) pthread_cond_wait(&gcChanged, &gcLock);
+    heap.running++;
+    pthread_mutex_unlock(&gcLock);
+}
+
+void gcSafepoint() {
+    pthread_mutex_lock(&gcLock);
+    if (heap.stopping) {
+        heap.parked++;
+        pthread_cond_broadcast(&gcChanged);
+        while (heap.stopping) pthread_cond_wait(&gcChanged, &gcLock);
+        heap.parked--;
+        pthread_mutex_unlock(&gcLock);
+        return;
+    }
+    if (!vm.gcRequested) {
+        pthread_mutex_unlock(&gcLock);
+        return;
+    }
+
+    heap.stopping = true;
+    pauseStarted();
+    while (heap.parked < heap.running - 1) pthread_cond_wait(&gcChanged, &gcLock);
+    pthread_mutex_unlock(&gcLock);
+
+    collectGarbage();
+    pauseEnded();
+
+    pthread_mutex_lock(&gcLock);
+    vm.gcRequested = false;
+    heap.stopping = false;
+    pthread_cond_broadcast(&gcChanged);
+    pthread_mutex_unlock(&gcLock);
+}
+
+void gcAddThread(ObjThread* thread, bool pinned) {
+    pthread_mutex_lock(&gcLock);
+    if (heap.threadCount == heap.threadCapacity) {
+        heap.threads = growBuffer(heap.threads, &heap.threadCapacity, sizeof(ThreadRoot));
+    }
+    heap.threads[heap.threadCount++] = (ThreadRoot){thread, pinned};
+    pthread_mutex_unlock(&gcLock);
+}
+
+// The context is freed right away. Only the joining thread can reach it,
+// and waiting for a collection would keep every sort comparison's stack.
+void gcReleaseThread(ObjThread* thread) {
+    pthread_mutex_lock(&gcLock);
+    for (int i = 0; i < heap.threadCount; i++) {
+        if (heap.threads[i].thread == thread) {
+            heap.threads[i] = heap.threads[--heap.threadCount];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&gcLock);
+
+    free(thread->ctx);
+    thread->ctx = NULL;
+}
+
+// ---------------------
+// Write barrier
+// ---------------------
+// A container goes in the remembered set once per collection however many
+// stores it takes, so a minor collection marks it once. Objects carry a flag
+// for that. A table or array inside an object remembers the object, and
+// nothing at all while the object is young, since a minor collection traces
+// young objects anyway. The few outside any object are kept in a hash set.
+void rememberObject(Obj* object) {
+    if (!object->isMarked || object->isRemembered) return;
+    object->isRemembered = true;
+
+    Mutator* self = currentMutator();
+    if (self->rememberedCount == self->rememberedCapacity) {
+        self->remembered = growBuffer(self->remembered, &self->rememberedCapacity,
+                                      sizeof(Obj*));
+    }
+    self->remembered[self->rememberedCount++] = object;
+}
+
+static bool addToContainerSet(Mutator* self, void* target) {
+    int mask = self->containerSetCapacity - 1;
+    int index = (int)(((uintptr_t)target >> 3) * 2654435761u) & mask;
+    while (self->containerSet[index] != NULL) {
+        if (self->containerSet[index] == target) return false;
+        index = (index + 1) & mask;
+    }
+    self->containerSet[index] = target;
+    return true;
+}
+
+static void growContainerSet(Mutator* self) {
+    free(self->containerSet);
+    self->containerSetCapacity = self->containerSetCapacity < 16 ? 16 :
+                                 self->containerSetCapacity * 2;
+    self->containerSet = calloc(self->containerSetCapacity, sizeof(void*));
+    if (self->containerSet == NULL) {
+        fprintf(stderr, "Not enough memory for GC.\n");
+        exit(1);
+    }
+    for (int i = 0; i < self->containerCount; i++) {
+        addToContainerSet(self, self->containers[i].target);
+    }
+}
+
+static void rememberContainer(RememberedKind kind, void* target) {
+    Mutator* self = currentMutator();
+    if ((self->containerCount + 1) * 2 > self->containerSetCapacity) growContainerSet(self);
+    if (!addToContainerSet(self, target)) return;
+
+    if (self->containerCount == self->containerCapacity) {
+        self->containers = growBuffer(self->containers, &self->containerCapacity,
+                                      sizeof(Remembered));
+    }
+    self->containers[self->containerCount++] = (Remembered){kind, target};
+}
+
+// Interned strings are weak, so their table is never a root.
+void rememberTable(Table* table) {
+    if (table->owner != NULL) {
+        rememberObject(table->owner);
+    } else if (table != &vm.strings) {
+        rememberContainer(REMEMBERED_TABLE, table);
+    }
+}
+
+void rememberArray(ValueArray* array) {
+    if (array->owner != NULL) {
+        rememberObject(array->owner);
+    } else {
+        rememberContainer(REMEMBERED_ARRAY, array);
+    }
+}
+
+// ---------------------
+// Marking
+// ---------------------
 void markObject(Obj* object) {
     if (object == NULL) return;
     if (object->isMarked) return;
 
     object->isMarked = true;
 
-    if (vm.grayCapacity < vm.grayCount + 1) {
-        vm.grayCapacity = GROW_CAPACITY(vm.grayCapacity);
-        vm.grayStack = (Obj**)realloc(vm.grayStack,
-                                      sizeof(Obj*) * vm.grayCapacity);
-
-        if (vm.grayStack == NULL) {
-            fprintf(stderr, "Not enough memory for GC.\n");
-            exit(1);
-        }
+    if (heap.grayCount == heap.grayCapacity) {
+        heap.gray = growBuffer(heap.gray, &heap.grayCapacity, sizeof(Obj*));
     }
-
-    vm.grayStack[vm.grayCount++] = object;
+    heap.gray[heap.grayCount++] = object;
 
 #ifdef DEBUG_LOG_GC
     printf("%p mark ", (void*)object);
@@ -85,71 +698,158 @@ static void markArray(ValueArray* array) {
     }
 }
 
-static void blackenObject(Obj* object) {
+static void markThread(Thread* ctx) {
+    for (Value* slot = ctx->stack; slot < ctx->stackTop; slot++) {
+        markValue(*slot);
+    }
+
+    for (int i = 0; i < ctx->frameCount; i++) {
+        CallFrame* frame = &ctx->frames[i];
+        markObject((Obj*)frame->closure);
+        markObject((Obj*)frame->klass);
+        markObject((Obj*)frame->receiver);
+    }
+
+    for (ObjUpvalue* upvalue = ctx->openUpvalues; upvalue != NULL; upvalue = upvalue->next) {
+        markObject((Obj*)upvalue);
+    }
+
+    if (ctx->namespace != NULL) markTable(ctx->namespace);
+    for (int i = 0; i < ctx->returnCount; i++) {
+        markValue(ctx->returnValues[i]);
+    }
+}
+
+static size_t tableSize(Table* table) {
+    return sizeof(Entry) * table->capacity;
+}
+
+// Marks what an object refers to and returns the bytes it holds.
+static size_t blackenObject(Obj* object) {
 #ifdef DEBUG_LOG_GC
     printf("%p blacken ", (void*)object);
     printValue(OBJ_VAL(object));
     printf("\n");
 #endif
     switch (object->type) {
-        case OBJ_NATIVE:
-        case OBJ_STRING:
-            break;
-        case OBJ_UPVALUE:
-            markValue(((ObjUpvalue*)object)->closed);
-            break;
+        case OBJ_STRING: {
+            ObjString* string = (ObjString*)object;
+            markObject((Obj*)string->instance);
+            return sizeof(ObjString) + string->length + 1;
+        }
         case OBJ_FUNCTION: {
             ObjFunction* function = (ObjFunction*)object;
             markObject((Obj*)function->name);
             markArray(&function->chunk.constants);
-            break;
+            return sizeof(ObjFunction) +
+                   (sizeof(uint8_t) + sizeof(int)) * function->chunk.capacity +
+                   sizeof(Value) * function->chunk.constants.capacity;
         }
+        case OBJ_NATIVE:
+            return sizeof(ObjNative);
         case OBJ_CLOSURE: {
             ObjClosure* closure = (ObjClosure*)object;
             markObject((Obj*)closure->function);
+            markObject((Obj*)closure->klass);
             for (int i = 0; i < closure->upvalueCount; i++) {
                 markObject((Obj*)closure->upvalues[i]);
             }
-            break;
+            return sizeof(ObjClosure) + sizeof(ObjUpvalue*) * closure->upvalueCount;
         }
+        case OBJ_UPVALUE:
+            markValue(((ObjUpvalue*)object)->closed);
+            return sizeof(ObjUpvalue);
         case OBJ_CLASS: {
             ObjClass* klass = (ObjClass*)object;
             markObject((Obj*)klass->name);
             markTable(&klass->methods);
             markTable(&klass->staticMethods);
             markTable(&klass->staticVars);
-            break;
+            markObject((Obj*)klass->superclass);
+            for (int i = 0; i < klass->fieldCount; i++) {
+                markObject((Obj*)klass->fieldNames[i]);
+            }
+            for (int i = 0; i < OPERATOR_COUNT; i++) {
+                markObject((Obj*)klass->operators[i]);
+            }
+            return sizeof(ObjClass) + tableSize(&klass->methods) +
+                   tableSize(&klass->staticMethods) + tableSize(&klass->staticVars) +
+                   sizeof(ObjString*) * klass->fieldCount;
         }
         case OBJ_INSTANCE: {
             ObjInstance* instance = (ObjInstance*)object;
             markObject((Obj*)instance->klass);
             markTable(&instance->fields);
-            break;
+            for (int i = 0; i < instance->klass->fieldCount; i++) {
+                markValue(instance->values[i]);
+            }
+            return sizeof(ObjInstance) + sizeof(Value) * instance->klass->fieldCount +
+                   tableSize(&instance->fields);
         }
         case OBJ_BOUND_METHOD: {
             ObjBoundMethod* method = (ObjBoundMethod*)object;
             markObject((Obj*)method->name);
+            markValue(method->receiver);
             for (int i = 0; i < 10; i++) {
-                if (method->method[i] != NULL)
-                    markObject((Obj*)method->method[i]);
+                markObject((Obj*)method->method[i]);
             }
-            break;
+            return sizeof(ObjBoundMethod);
+        }
+        case OBJ_BOUND_NATIVE: {
+            ObjBoundNative* bound = (ObjBoundNative*)object;
+            markValue(bound->receiver);
+            markObject((Obj*)bound->native);
+            return sizeof(ObjBoundNative);
         }
         case OBJ_LIST: {
             ObjList* list = (ObjList*)object;
             markArray(&list->elements);
-            break;
+            markObject((Obj*)list->instance);
+            size_t size = sizeof(ObjList) + sizeof(Value) * list->elements.capacity;
+            PackedStructs* packed = list->packed;
+            if (packed != NULL) {
+                markObject((Obj*)packed->klass);
+                markArray(&packed->fields);
+                size += sizeof(PackedStructs) + sizeof(Value) * packed->fields.capacity;
+            }
+            return size;
         }
+        case OBJ_RANGE:
+            markObject((Obj*)((ObjRange*)object)->instance);
+            return sizeof(ObjRange);
         case OBJ_MULTI_DISPATCH: {
             ObjMultiDispatch* method = (ObjMultiDispatch*)object;
             markObject((Obj*)method->name);
             for (int i = 0; i < 10; i++) {
-                if (method->closures[i] != NULL)
-                    markObject((Obj*)method->closures[i]);
+                markObject((Obj*)method->closures[i]);
             }
-            break;
+            return sizeof(ObjMultiDispatch);
+        }
+        case OBJ_IMAGE:
+            markObject((Obj*)((ObjImage*)object)->instance);
+            return sizeof(ObjImage);
+        case OBJ_THREAD: {
+            ObjThread* thread = (ObjThread*)object;
+            markObject((Obj*)thread->instance);
+            if (thread->ctx != NULL) markThread(thread->ctx);
+            return sizeof(ObjThread);
+        }
+        case OBJ_NAMESPACE: {
+            ObjNamespace* ns = (ObjNamespace*)object;
+            markObject((Obj*)ns->name);
+            markTable(ns->namespace);
+            return sizeof(ObjNamespace) + sizeof(Table) + tableSize(ns->namespace);
+        }
+        case OBJ_DESCRIPTOR: {
+            ObjDescriptor* descriptor = (ObjDescriptor*)object;
+            markObject((Obj*)descriptor->name);
+            markObject((Obj*)descriptor->mode);
+            return sizeof(ObjDescriptor);
         }
+        case OBJ_ERROR:
+            break;
     }
+    return 0;
 }
 
 static void freeObject(Obj* object) {
@@ -164,163 +864,282 @@ static void freeObject(Obj* object) {
             FREE(ObjString, object);
             break;
         }
-
         case OBJ_FUNCTION: {
             ObjFunction* function = (ObjFunction*)object;
             freeChunk(&function->chunk);
             FREE(ObjFunction, object);
             break;
         }
-
+        case OBJ_NATIVE:
+            FREE(ObjNative, object);
+            break;
         case OBJ_CLOSURE: {
             ObjClosure* closure = (ObjClosure*)object;
             FREE_ARRAY(ObjUpvalue*, closure->upvalues, closure->upvalueCount);
             FREE(ObjClosure, object);
             break;
         }
-
-        case OBJ_UPVALUE: {
-            ObjUpvalue* upvalue = (ObjUpvalue*)object;
+        case OBJ_UPVALUE:
             FREE(ObjUpvalue, object);
             break;
-        }
-
         case OBJ_CLASS: {
             ObjClass* klass = (ObjClass*)object;
             freeTable(&klass->methods);
             freeTable(&klass->staticMethods);
             freeTable(&klass->staticVars);
+            FREE_ARRAY(ObjString*, klass->fieldNames, klass->fieldCount);
             FREE(ObjClass, object);
             break;
         }
-
         case OBJ_INSTANCE: {
             ObjInstance* instance = (ObjInstance*)object;
             freeTable(&instance->fields);
             FREE(ObjInstance, object);
             break;
         }
-
-        case OBJ_BOUND_METHOD: {
+        case OBJ_BOUND_METHOD:
             FREE(ObjBoundMethod, object);
             break;
-        }
-
+        case OBJ_BOUND_NATIVE:
+            FREE(ObjBoundNative, object);
+            break;
         case OBJ_LIST: {
             ObjList* list = (ObjList*)object;
             freeValueArray(&list->elements);
+            if (list->packed != NULL) {
+                freeValueArray(&list->packed->fields);
+                FREE(PackedStructs, list->packed);
+            }
             FREE(ObjList, object);
             break;
         }
-
-        case OBJ_MULTI_DISPATCH: {
+        case OBJ_RANGE:
+            FREE(ObjRange, object);
+            break;
+        case OBJ_MULTI_DISPATCH:
             FREE(ObjMultiDispatch, object);
             break;
+        case OBJ_IMAGE:
+            FREE(ObjImage, object);
+            break;
+        case OBJ_THREAD: {
+            ObjThread* thread = (ObjThread*)object;
+            free(thread->ctx);
+            FREE(ObjThread, object);
+            break;
         }
-
-        case OBJ_NATIVE:
-            FREE(ObjNative, object);
+        case OBJ_NAMESPACE: {
+            ObjNamespace* ns = (ObjNamespace*)object;
+            freeTable(ns->namespace);
+            FREE(Table, ns->namespace);
+            FREE(ObjNamespace, object);
+            break;
+        }
+        case OBJ_DESCRIPTOR:
+            FREE(ObjDescriptor, object);
+            break;
+        case OBJ_ERROR:
             break;
     }
 }
 
+// ---------------------
+// Collecting
+// ---------------------
+static void markRoots() {
+    markTable(&vm.globals);
+    markTable(&vm.stringClassMethods);
+    markTable(&vm.listClassMethods);
+    markTable(&vm.imageClassMethods);
+    markTable(&vm.threadClassMethods);
 
-void freeObjects() {
-    printf("freeing things"); fflush(stdout);
-    
-    Obj* object = vm.objects;
-    while (object != NULL) {
-        Obj* next = object->next;
-        freeObject(object);
-        object = next;
-        printf("%p\n", next);
+    Obj* roots[] = {
+        (Obj*)vm.initString, (Obj*)vm.toString,
+        (Obj*)vm.fileCompiler, (Obj*)vm.sourceCompiler,
+        (Obj*)vm.stringClass, (Obj*)vm.listClass, (Obj*)vm.rangeClass,
+        (Obj*)vm.imageClass, (Obj*)vm.threadClass, (Obj*)vm.numberClass,
+        (Obj*)vm.boolClass, (Obj*)vm.mathClass,
+        (Obj*)vm.errorString, (Obj*)vm.errorClass,
+        (Obj*)vm.indexErrorString, (Obj*)vm.indexErrorClass,
+        (Obj*)vm.typeErrorString, (Obj*)vm.typeErrorClass,
+        (Obj*)vm.nameErrorString, (Obj*)vm.nameErrorClass,
+        (Obj*)vm.accessErrorString, (Obj*)vm.accessErrorClass,
+        (Obj*)vm.illegalArgumentsErrorString, (Obj*)vm.illegalArgumentsErrorClass,
+        (Obj*)vm.lookUpErrorString, (Obj*)vm.lookUpErrorClass,
+        (Obj*)vm.formatErrorString, (Obj*)vm.formatErrorClass,
+        (Obj*)vm.memoryErrorString, (Obj*)vm.memoryErrorClass,
+    };
+    for (size_t i = 0; i < sizeof(roots) / sizeof(roots[0]); i++) {
+        markObject(roots[i]);
     }
 
-    free(vm.grayStack);
+    for (int i = 0; i < heap.threadCount; i++) {
+        ThreadRoot* root = &heap.threads[i];
+        if (root->pinned || !root->thread->ctx->finished) {
+            markObject((Obj*)root->thread);
+        }
+    }
+    // A thread may reach a safepoint before its spawner has registered it.
+    for (Mutator* self = heap.mutators; self != NULL; self = self->next) {
+        if (self->ctx != NULL && !self->exited) markThread(self->ctx);
+    }
+
+    markCompilerRoots();
+    markCharStrings();
+    markJitRoots();
+    markProfileRoots();
 }
 
-static void markRoots() {
-    for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
-        markValue(*slot);
-    }
+// Old objects the barrier saw take young references, and the tables and
+// arrays outside objects it saw take them. A major collection traces
+// everything anyway, so it only clears the objects' flags, before the sweep
+// can free them.
+static void markRemembered(bool major) {
+    for (Mutator* self = heap.mutators; self != NULL; self = self->next) {
+        for (int i = 0; i < self->rememberedCount; i++) {
+            Obj* object = self->remembered[i];
+            object->isRemembered = false;
+            if (!major) blackenObject(object);
+        }
+        if (major) continue;
 
-    for (int i = 0; i < vm.frameCount; i++) {
-        markObject((Obj*)vm.frames[i].closure);
+        for (int i = 0; i < self->containerCount; i++) {
+            Remembered* entry = &self->containers[i];
+            switch (entry->kind) {
+                case REMEMBERED_TABLE: markTable(entry->target); break;
+                case REMEMBERED_ARRAY: markArray(entry->target); break;
+            }
+        }
     }
+}
 
-    for (ObjUpvalue* upvalue = vm.openUpvalues; upvalue != NULL; upvalue = upvalue->next) {
-        markObject((Obj*)upvalue);
+static void traceReferences() {
+    while (heap.grayCount > 0) {
+        Obj* object = heap.gray[--heap.grayCount];
+        size_t bytes = blackenObject(object);
+        heap.marked += bytes;
+        if (heap.census) censusObject(object, bytes);
     }
 }
 
-static void traceReferences() {
-    while (vm.grayCount > 0) {
-        Obj* object = vm.grayStack[--vm.grayCount];
-        blackenObject(object);
+// Threads nothing reached are about to be freed with their objects.
+static void sweepThreads() {
+    int count = 0;
+    for (int i = 0; i < heap.threadCount; i++) {
+        if (heap.threads[i].thread->obj.isMarked) heap.threads[count++] = heap.threads[i];
     }
+    heap.threadCount = count;
 }
 
-static void sweep() {
-    Obj* previous = NULL;
-    Obj* object = vm.objects;
-    while (object != NULL) {
+static void sweepOld() {
+    int count = 0;
+    for (int i = 0; i < heap.oldCount; i++) {
+        Obj* object = heap.old[i];
         if (object->isMarked) {
-            object->isMarked = false;
-            previous = object;
-            object = object->next;
+            heap.old[count++] = object;
         } else {
-            Obj* unreached = object;
-            object = object->next;
-            if (previous != NULL) {
-                previous->next = object;
-            } else {
-                vm.objects = object;
+            freeObject(object);
+        }
+    }
+    heap.oldCount = count;
+}
+
+// Frees the young objects nothing reached and promotes the rest. Their
+// mark bits stay set.
+static void sweepYoung() {
+    for (Mutator* self = heap.mutators; self != NULL; self = self->next) {
+        for (int i = 0; i < self->youngCount; i++) {
+            Obj* object = self->young[i];
+            if (!object->isMarked) {
+                freeObject(object);
+                continue;
             }
 
-            freeObject(unreached);
+            if (heap.oldCount == heap.oldCapacity) {
+                heap.old = growBuffer(heap.old, &heap.oldCapacity, sizeof(Obj*));
+            }
+            heap.old[heap.oldCount++] = object;
         }
+        self->youngCount = 0;
     }
 }
 
-size_t getUsedRAM() {
-    FILE* file = fopen("/proc/meminfo", "r");
-    if (!file) return 0;
-
-    size_t total = 0, available = 0;
-    char key[64];
-    size_t value;
-    char unit[16];
+// Empties the remembered sets, frees blocks released since the last
+// collection and forgets threads that have exited.
+static void resetMutators() {
+    Mutator** link = &heap.mutators;
+    while (*link != NULL) {
+        Mutator* self = *link;
+        self->rememberedCount = 0;
+        if (self->containerCount > 0) {
+            memset(self->containerSet, 0, sizeof(void*) * self->containerSetCapacity);
+            self->containerCount = 0;
+        }
+        for (int i = 0; i < self->freedCount; i++) free(self->freed[i]);
+        self->freedCount = 0;
 
-    while (fscanf(file, "%63s %zu %15s", key, &value, unit) == 3) {
-        if (strcmp(key, "MemTotal:") == 0) total = value;
-        else if (strcmp(key, "MemAvailable:") == 0) available = value;
-        if (total && available) break;
+        if (self->exited) {
+            *link = self->next;
+            free(self->young);
+            free(self->remembered);
+            free(self->containers);
+            free(self->containerSet);
+            free(self->freed);
+            free(self);
+        } else {
+            link = &self->next;
+        }
     }
-
-    fclose(file);
-    return (total - available) * 1024;  // kB -> bytes
 }
 
 void collectGarbage() {
+    size_t allocated = atomic_load_explicit(&heap.allocated, memory_order_relaxed);
+    bool major = heap.forceMajor || heap.live > heap.nextMajor ||
+                 (heap.maxHeap > 0 && heap.live + allocated > heap.maxHeap);
+    heap.forceMajor = false;
 #ifdef DEBUG_LOG_GC
-    printf("-- gc begin\n");
-    size_t before = vm.bytesAllocated;
+    printf("-- gc begin (%s)\n", major ? "major" : "minor");
+    size_t before = heap.live;
 #endif
+    heap.collecting = true;
+    heap.marked = 0;
+    heap.census = major && vm.profileHeap;
+    if (heap.census) beginHeapCensus();
+
+    markRemembered(major);
+    if (major) {
+        for (int i = 0; i < heap.oldCount; i++) heap.old[i]->isMarked = false;
+    }
     markRoots();
     traceReferences();
     tableRemoveWhite(&vm.strings);
-    sweep();
+    sweepThreads();
+    if (major) sweepOld();
+    sweepYoung();
+    resetMutators();
 
-    if (getUsedRAM() < vm.maxRAM) {
-        vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
+    if (major) {
+        fullCollectionEnded();
+        heap.live = heap.marked;
+        heap.nextMajor = (size_t)(heap.live * heap.growFactor);
+        if (heap.nextMajor < GC_FIRST_MAJOR) heap.nextMajor = GC_FIRST_MAJOR;
+        if (heap.maxHeap > 0 && heap.live > heap.maxHeap) {
+            fprintf(stderr, "Live data exceeds the %zu byte heap limit.\n", heap.maxHeap);
+            exit(1);
+        }
+    } else {
+        heap.live += heap.marked;
     }
-
+    heap.totalBytes += allocated;
+    atomic_store_explicit(&heap.allocated, 0, memory_order_relaxed);
+    heap.collecting = false;
+    heap.census = false;
 
 #ifdef DEBUG_LOG_GC
     printf("-- gc end\n");
-    printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
-           before - vm.bytesAllocated, before, vm.bytesAllocated, vm.nextGC);
+    printf("   old generation %zu -> %zu bytes, next major at %zu\n",
+           before, heap.live, heap.nextMajor);
 #endif
-
 }
-*/
+
+#endif
@@ -21,11 +21,122 @@ reallocate(pointer, sizeof(type) * (oldCount), 0)
 #define ALLOCATE(type, count) \
 (type*)reallocate(NULL, 0, sizeof(type) * (count))
 
+// For payloads that never hold pointers: string bytes, bytecode, line
+// tables. The collector doesn't scan them.
+#define GROW_ARRAY_ATOMIC(type, pointer, oldCount, newCount) \
+(type*)reallocateAtomic(pointer, sizeof(type) * (oldCount), \
+sizeof(type) * (newCount))
+
+#define ALLOCATE_ATOMIC(type, count) \
+(type*)reallocateAtomic(NULL, 0, sizeof(type) * (count))
+
 
 void* reallocate(void* pointer, size_t oldSize, size_t newSize);
+void* reallocateAtomic(void* pointer, size_t oldSize, size_t newSize);
+// Memory for a new object, from the calling thread's cache when it has one.
+void* allocateObjectMemory(size_t size);
+
+#ifndef PRECISE_GC
+// Points this thread's object cache at its context.
+void useObjectCache(Thread* ctx);
+#endif
+
+// Collector settings from the command line and the environment. A zero
+// field keeps the collector's default.
+typedef struct {
+    size_t initialHeap;              // Bytes to start with.
+    size_t maxHeap;                  // Bytes the heap may never outgrow.
+    unsigned long freeSpaceDivisor;  // Higher collects more often.
+    int markers;                     // Parallel marker threads.
+    bool incremental;
+    size_t heapQuota;                // Heap in use before MemoryError.
+    size_t threadQuota;              // Bytes a thread may allocate and still hold.
+} GCOptions;
+
+typedef struct {
+    size_t collections;
+    double lastPause;  // Milliseconds the world was stopped.
+    double maxPause;
+    double totalPause;
+    size_t heapSize;
+    size_t freeBytes;
+    size_t totalBytes;  // Allocated since the program started.
+} GCStats;
+
+// Starts the collector. Call before anything is allocated.
+void initGC(const GCOptions* options);
+void gcCollect();
+void gcStats(GCStats* stats);
+// Bytes the calling thread has allocated.
+size_t gcThreadAllocated();
+
+// Quotas raise a MemoryError the program can catch, where max-heap is
+// fatal. A thread counts what it allocates and adds it to the heap's total
+// in batches; one that crosses a quota gets its quotaCheck flag set and
+// calls gcOverQuota() at its next back edge or call. Zero is no quota.
+// gcSetThreadQuota() sets the calling thread's quota and the one threads
+// started afterwards get.
+void gcBindThread(Thread* ctx);
+// The context bound on this thread, NULL outside Gem threads.
+Thread* gcCurrentThread();
+bool gcOverQuota(char* message, size_t size);
+size_t gcHeapQuota();
+void gcSetHeapQuota(size_t bytes);
+size_t gcThreadQuota();
+void gcSetThreadQuota(size_t bytes);
+
+#ifdef PRECISE_GC
+// The precise collector only runs at safepoints. A thread that blocks
+// outside one, as in a join, says so first so others can collect without it.
+void gcThreadStart(Thread* ctx);
+void gcSafepoint();
+void gcBeginBlocking();
+void gcEndBlocking();
+
+// Threads are roots while they run. A pinned thread stays one until
+// gcReleaseThread(), so an internal spawn can read its result after it ends.
+void gcAddThread(ObjThread* thread, bool pinned);
+void gcReleaseThread(ObjThread* thread);
+
+void trackObject(Obj* object);
 void markValue(Value value);
 void markObject(Obj* object);
 void collectGarbage();
-//void freeObjects();
+
+// The write barrier. Old objects keep their mark bit between collections,
+// so an unmarked target is young and the container has to be remembered
+// until the next collection. A table or array with an owner remembers the
+// owner instead, once.
+void rememberObject(Obj* object);
+void rememberTable(Table* table);
+void rememberArray(ValueArray* array);
+
+#define IS_YOUNG(value) (IS_OBJ(value) && !AS_OBJ(value)->isMarked)
+
+#define GC_SAFEPOINT() \
+    do { if (vm.gcRequested) gcSafepoint(); } while (false)
+
+#define WRITE_BARRIER(object, value) \
+    do { if (IS_YOUNG(value)) rememberObject((Obj*)(object)); } while (false)
+
+#define WRITE_BARRIER_OBJ(object, target) \
+    do { \
+        if ((target) != NULL && !((Obj*)(target))->isMarked) rememberObject((Obj*)(object)); \
+    } while (false)
+
+#define TABLE_BARRIER(table, key, value) \
+    do { \
+        if (!(key)->obj.isMarked || IS_YOUNG(value)) rememberTable(table); \
+    } while (false)
+
+#define ARRAY_BARRIER(array, value) \
+    do { if (IS_YOUNG(value)) rememberArray(array); } while (false)
+#else
+#define GC_SAFEPOINT() do {} while (false)
+#define WRITE_BARRIER(object, value) do {} while (false)
+#define WRITE_BARRIER_OBJ(object, target) do {} while (false)
+#define TABLE_BARRIER(table, key, value) do {} while (false)
+#define ARRAY_BARRIER(array, value) do {} while (false)
+#endif
 
 #endif
@@ -5,12 +5,16 @@
 #include "object.h"
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
+#include <limits.h>
 
 #include "memory.h"
 #include "object.h"
 
+#include <pthread.h>
 #include <sys/types.h>
 
+#include "profile.h"
 #include "value.h"
 #include "vm.h"
 
@@ -26,10 +30,16 @@ static inline uint32_t hash32(uint32_t x) {
 }
 
 Obj* allocateObject(size_t size, ObjType type) {
-    Obj* object = (Obj*)reallocate(NULL, 0, size);
+    Obj* object = (Obj*)allocateObjectMemory(size);
     object->type = type;
     object->isMarked = false;
-    object->id = hash32((uintptr_t)object ^ nextHashSeed++);
+    object->isRemembered = false;
+    object->id = 0;
+#ifdef PRECISE_GC
+    trackObject(object);
+#endif
+    // Instances are charged to their class once newInstance() has it.
+    if (vm.profileHeap && type != OBJ_INSTANCE) profileAllocation(type, NULL, size);
 
 #ifdef DEBUG_LOG_GC
     printf("%p allocate %zu for %d\n", (void*)object, size, type);
@@ -38,6 +48,24 @@ Obj* allocateObject(size_t size, ObjType type) {
     return object;
 }
 
+// Equal strings share their content hash. Anything else gets a random
+// one the first time it is asked, which every thread then agrees on.
+uint32_t objectId(Obj* object) {
+    if (object->type == OBJ_STRING) return ((ObjString*)object)->hash;
+
+    uint32_t id = __atomic_load_n(&object->id, __ATOMIC_RELAXED);
+    if (id != 0) return id;
+
+    uint32_t seed = (uint32_t)__atomic_fetch_add(&nextHashSeed, 1, __ATOMIC_RELAXED);
+    uint32_t fresh = hash32((uintptr_t)object ^ seed);
+    if (fresh == 0) fresh = 1;
+    if (__atomic_compare_exchange_n(&object->id, &id, fresh, false,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return fresh;
+    }
+    return id;
+}
+
 ObjBoundMethod* newBoundMethod(Value receiver, ObjString* name) {
     ObjBoundMethod* bound = ALLOCATE_OBJ(ObjBoundMethod,
                                          OBJ_BOUND_METHOD);
@@ -49,11 +77,11 @@ ObjBoundMethod* newBoundMethod(Value receiver, ObjString* name) {
     return bound;
 }
 
-ObjBoundNative* newBoundNative(NativeFn* fn) {
+ObjBoundNative* newBoundNative(ObjNative* native) {
     ObjBoundNative* bound = ALLOCATE_OBJ(ObjBoundNative,
                                          OBJ_BOUND_NATIVE);
     bound->receiver = NIL_VAL;
-    bound->method = fn;
+    bound->native = native;
     return bound;
 }
 
@@ -63,7 +91,14 @@ ObjClass* newClass(ObjString* name) {
     initTable(&klass->methods);
     initTable(&klass->staticVars);
     initTable(&klass->staticMethods);
+    klass->methods.owner = (Obj*)klass;
+    klass->staticVars.owner = (Obj*)klass;
+    klass->staticMethods.owner = (Obj*)klass;
     klass->superclass = NULL;
+    klass->isStruct = false;
+    klass->fieldCount = 0;
+    klass->fieldNames = NULL;
+    for (int i = 0; i < OPERATOR_COUNT; i++) klass->operators[i] = NULL;
     return klass;
 }
 
@@ -105,15 +140,19 @@ uint32_t hashString(const char* key, int length) {
     return hash;
 }
 
+// Threads intern strings at the same time. Looking a string up in
+// vm.strings and adding it must be one step, or two threads could each add
+// a copy of the same text, and stringsEqual() would tell them apart.
+static pthread_mutex_t internLock = PTHREAD_MUTEX_INITIALIZER;
+
 static ObjString* allocateString(char* chars, int length, uint32_t hash) {
     ObjString* string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
     string->length = length;
     string->chars = chars;
     string->hash = hash;
+    string->interned = true;
     string->instance = newInstance(vm.stringClass);
 
-    string->obj.id = hash;
-
     tableSet(&vm.strings, string, NIL_VAL);
 
     return string;
@@ -124,11 +163,9 @@ ObjString* newString(char* chars, int length){
     string->length = length;
     string->chars = chars;
     string->hash = hashString(chars, length);
+    string->interned = false;
     string->instance = newInstance(vm.stringClass);
 
-    string->obj.id = string->hash;
-
-
     return string;
 }
 
@@ -137,7 +174,9 @@ ObjFunction* newFunction() {
     function->arity = 0;
     function->name = NULL;
     initChunk(&function->chunk);
+    function->chunk.constants.owner = (Obj*)function;
     function->upvalueCount = 0;
+    function->jit = NULL;
     return function;
 }
 
@@ -154,21 +193,117 @@ ObjMultiDispatch* newMultiDispatch(ObjString* name) {
 ObjList* newList() {
     ObjList* list = ALLOCATE_OBJ(ObjList, OBJ_LIST);
     initValueArray(&list->elements);
+    list->elements.owner = (Obj*)list;
+    list->packed = NULL;
     list->instance = newInstance(vm.listClass);
     return list;
 }
 
+// Appends a struct without boxing it, to an empty list or one packed with
+// its type. False means the list needs an ordinary element instead.
+bool appendPacked(ObjList* list, Value value) {
+    if (!IS_STRUCT(value)) return false;
+    ObjInstance* instance = AS_INSTANCE(value);
+    ObjClass* klass = instance->klass;
+    if (klass->fieldCount == 0) return false;
+
+    PackedStructs* packed = packedStructs(list);
+    if (packed == NULL) {
+        if (list->elements.count > 0) return false;
+        packed = ALLOCATE(PackedStructs, 1);
+        packed->klass = klass;
+        initValueArray(&packed->fields);
+        packed->fields.owner = (Obj*)list;
+        WRITE_BARRIER_OBJ(list, klass);
+        __atomic_store_n(&list->packed, packed, __ATOMIC_RELEASE);
+    } else if (packed->klass != klass) {
+        return false;
+    }
+
+    for (int i = 0; i < klass->fieldCount; i++) {
+        writeValueArray(&packed->fields, instance->values[i]);
+    }
+    return true;
+}
+
+// Replaces an element of a packed list with a struct of the same type.
+bool setPacked(ObjList* list, int index, Value value) {
+    PackedStructs* packed = packedStructs(list);
+    if (packed == NULL || !IS_INSTANCE(value)) return false;
+    ObjInstance* instance = AS_INSTANCE(value);
+    if (instance->klass != packed->klass || index < 0 || index >= packedLength(packed)) {
+        return false;
+    }
+
+    int fieldCount = packed->klass->fieldCount;
+    Value* fields = packed->fields.values + index * fieldCount;
+    for (int i = 0; i < fieldCount; i++) {
+        fields[i] = instance->values[i];
+        ARRAY_BARRIER(&packed->fields, fields[i]);
+    }
+    return true;
+}
+
+// Two threads can find the same list packed. One boxes its elements and
+// the other waits and finds it done.
+static pthread_mutex_t unpackLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Boxes a packed list's structs into ordinary elements. A thread still
+// reading the old fields keeps them until the next collection.
+void unpackList(ObjList* list) {
+    pthread_mutex_lock(&unpackLock);
+    PackedStructs* packed = list->packed;
+    if (packed != NULL) {
+        ObjClass* klass = packed->klass;
+        for (int i = 0; i < packed->fields.count; i += klass->fieldCount) {
+            ObjInstance* instance = newInstance(klass);
+            memcpy(instance->values, packed->fields.values + i, sizeof(Value) * klass->fieldCount);
+            writeValueArray(&list->elements, OBJ_VAL(instance));
+        }
+        __atomic_store_n(&list->packed, NULL, __ATOMIC_RELEASE);
+        FREE_ARRAY(Value, packed->fields.values, packed->fields.capacity);
+        FREE(PackedStructs, packed);
+    }
+    pthread_mutex_unlock(&unpackLock);
+}
+
+
+ObjRange* newRange(double start, double end, double step) {
+    ObjRange* range = ALLOCATE_OBJ(ObjRange, OBJ_RANGE);
+    range->start = start;
+    range->end = end;
+    range->step = step;
+
+    double count = ceil((end - start) / step);
+    range->length = count > 0 ? (count < INT_MAX ? (int)count : INT_MAX) : 0;
+    range->instance = newInstance(vm.rangeClass);
+    return range;
+}
 
 ObjInstance* newInstance(ObjClass* klass) {
-    ObjInstance* instance = ALLOCATE_OBJ(ObjInstance, OBJ_INSTANCE);
+    size_t size = sizeof(ObjInstance) + sizeof(Value) * klass->fieldCount;
+    ObjInstance* instance = (ObjInstance*)allocateObject(size, OBJ_INSTANCE);
+    if (vm.profileHeap) profileAllocation(OBJ_INSTANCE, klass, size);
     instance->klass = klass;
     initTable(&instance->fields);
+    instance->fields.owner = (Obj*)instance;
+    for (int i = 0; i < klass->fieldCount; i++) {
+        instance->values[i] = NIL_VAL;
+    }
     return instance;
 }
 
 ObjNative* newNative(NativeFn function) {
     ObjNative* native = ALLOCATE_OBJ(ObjNative, OBJ_NATIVE);
     native->function = function;
+    native->def = NULL;
+    return native;
+}
+
+ObjNative* newNativeDef(const NativeDef* def) {
+    ObjNative* native = ALLOCATE_OBJ(ObjNative, OBJ_NATIVE);
+    native->function = def->function;
+    native->def = def;
     return native;
 }
 
@@ -184,6 +319,7 @@ ObjNamespace* newNamespace(ObjString* name){
     ObjNamespace* ns = ALLOCATE_OBJ(ObjNamespace, OBJ_NAMESPACE);
     ns->namespace = ALLOCATE(Table, 1);
     initTable(ns->namespace);
+    ns->namespace->owner = (Obj*)ns;
     ns->name = name;
     return ns;
 }
@@ -262,9 +398,23 @@ ObjDescriptor* newDescriptor(ObjString* name, ObjString* mode) {
 
     
 
+// Returns the interned string with these characters. It takes `chars`,
+// which becomes the new string's or is freed if the text is interned
+// already.
+static ObjString* internChars(char* chars, int length, int capacity) {
+    uint32_t hash = hashString(chars, length);
+    pthread_mutex_lock(&internLock);
+    ObjString* string = tableFindString(&vm.strings, chars, length, hash);
+    if (string == NULL) string = allocateString(chars, length, hash);
+    pthread_mutex_unlock(&internLock);
+
+    if (string->chars != chars) FREE_ARRAY(char, chars, capacity);
+    return string;
+}
+
 ObjString* takeString(char* chars, int length) {
     // Allocate enough space (worst case: no escapes)
-    char* unescaped = ALLOCATE(char, length + 1);
+    char* unescaped = ALLOCATE_ATOMIC(char, length + 1);
     int write = 0;
 
     for (int read = 0; read < length; read++) {
@@ -291,23 +441,13 @@ ObjString* takeString(char* chars, int length) {
 
     unescaped[write] = '\0';
 
-    uint32_t hash = hashString(unescaped, write);
-
-
-    ObjString* interned = tableFindString(&vm.strings, unescaped, write, hash);
-    if (interned != NULL) {
-        FREE_ARRAY(char, chars, length + 1);
-        FREE_ARRAY(char, unescaped, length + 1);
-        return interned;
-    }
-
     FREE_ARRAY(char, chars, length + 1);
-    return allocateString(unescaped, write, hash);
+    return internChars(unescaped, write, length + 1);
 }
 
 ObjString* copyString(const char* chars, int length) {
     // Allocate buffer large enough (worst case: no escapes)
-    char* unescaped = ALLOCATE(char, length + 1);
+    char* unescaped = ALLOCATE_ATOMIC(char, length + 1);
     int write = 0;
 
     for (int read = 0; read < length; read++) {
@@ -333,18 +473,44 @@ ObjString* copyString(const char* chars, int length) {
 
     unescaped[write] = '\0';
 
-    uint32_t hash = hashString(unescaped, write);
+    return internChars(unescaped, write, length + 1);
+}
+
 
+// One-character strings are shared so walking a string doesn't allocate.
+static ObjString* charStrings[256];
 
-    ObjString* interned = tableFindString(&vm.strings, unescaped, write, hash);
-    if (interned != NULL) {
-        FREE_ARRAY(char, unescaped, length + 1);
-        return interned;
+ObjString* charString(char c) {
+    ObjString* string = charStrings[(uint8_t)c];
+    if (string == NULL) {
+        string = copyString(&c, 1);
+        charStrings[(uint8_t)c] = string;
     }
+    return string;
+}
 
-    return allocateString(unescaped, write, hash);
+// Returns the interned copy of a runtime string, adding this one to
+// vm.strings if there is none yet. Used for strings that live as long as
+// the code does, such as folded constants; interning every concatenation
+// would keep them all reachable from the table.
+ObjString* internString(ObjString* string) {
+    if (string->interned) return string;
+    pthread_mutex_lock(&internLock);
+    ObjString* interned = tableFindString(&vm.strings, string->chars, string->length, string->hash);
+    if (interned == NULL) {
+        string->interned = true;
+        tableSet(&vm.strings, string, NIL_VAL);
+        interned = string;
+    }
+    pthread_mutex_unlock(&internLock);
+    return interned;
 }
 
+#ifdef PRECISE_GC
+void markCharStrings() {
+    for (int i = 0; i < 256; i++) markObject((Obj*)charStrings[i]);
+}
+#endif
 
 ObjUpvalue* newUpvalue(Value* slot) {
     ObjUpvalue* upvalue = ALLOCATE_OBJ(ObjUpvalue, OBJ_UPVALUE);
@@ -393,10 +559,20 @@ void printObject(Value value) {
         case OBJ_CLASS:
             printf("%s", AS_CLASS(value)->name->chars);
             break;
-        case OBJ_INSTANCE:
-            printf("%s instance",
-                   AS_INSTANCE(value)->klass->name->chars);
+        case OBJ_INSTANCE: {
+            ObjInstance* instance = AS_INSTANCE(value);
+            if (!instance->klass->isStruct) {
+                printf("%s instance", instance->klass->name->chars);
+                break;
+            }
+            printf("%s(", instance->klass->name->chars);
+            for (int i = 0; i < instance->klass->fieldCount; i++) {
+                printValue(instance->values[i]);
+                if (i != instance->klass->fieldCount - 1) printf(", ");
+            }
+            printf(")");
             break;
+        }
         case OBJ_BOUND_METHOD:
             printf("<md ");
             printObject(OBJ_VAL(AS_BOUND_METHOD(value)->name));
@@ -412,6 +588,12 @@ void printObject(Value value) {
             printf("]");
             break;
         }
+        case OBJ_RANGE: {
+            ObjRange* range = AS_RANGE(value);
+            if (range->step == 1) printf("%g..%g", range->start, range->end);
+            else printf("range(%g, %g, %g)", range->start, range->end, range->step);
+            break;
+        }
         case OBJ_MULTI_DISPATCH: {
             ObjMultiDispatch* method = AS_MULTI_DISPATCH(value);
             printf("<fn %s>", method->name->chars);
@@ -4,6 +4,7 @@
 #include <SDL2/SDL_render.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <string.h>
 #include "value.h"
 #include "table.h"
 #include "chunk.h"
@@ -24,17 +25,18 @@ typedef struct ObjInstance ObjInstance;
 #define IS_FUNCTION(value)     isObjType(value, OBJ_FUNCTION)
 #define AS_FUNCTION(value)     ((ObjFunction*)AS_OBJ(value))
 #define IS_NATIVE(value)       isObjType(value, OBJ_NATIVE)
-#define AS_NATIVE(value)       (((ObjNative*)AS_OBJ(value))->function)
+#define AS_NATIVE(value)       ((ObjNative*)AS_OBJ(value))
 #define IS_CLOSURE(value)      isObjType(value, OBJ_CLOSURE)
 #define AS_CLOSURE(value)      ((ObjClosure*)AS_OBJ(value))
 #define IS_CLASS(value)        isObjType(value, OBJ_CLASS)
 #define AS_CLASS(value)        ((ObjClass*)AS_OBJ(value))
 #define IS_INSTANCE(value)     isObjType(value, OBJ_INSTANCE)
+#define IS_STRUCT(value)       (IS_INSTANCE(value) && AS_INSTANCE(value)->klass->isStruct)
 #define AS_INSTANCE(value)     ((ObjInstance*)AS_OBJ(value))
 #define IS_BOUND_METHOD(value) isObjType(value, OBJ_BOUND_METHOD)
 #define AS_BOUND_METHOD(value) ((ObjBoundMethod*)AS_OBJ(value))
 #define IS_LIST(value)         isObjType(value, OBJ_LIST)
-#define AS_LIST(value)         ((ObjList*)AS_OBJ(value))
+#define AS_LIST(value)         asList(value)
 #define IS_ERROR(value)        isObjType(value, OBJ_ERROR)
 #define AS_ERROR(value)        ((ObjError*)AS_OBJ(value))
 #define IS_MULTI_DISPATCH(value) isObjType(value, OBJ_MULTI_DISPATCH)
@@ -51,6 +53,8 @@ typedef struct ObjInstance ObjInstance;
 #define AS_DESCRIPTOR(value)       ((ObjDescriptor*)AS_OBJ(value))
 #define IS_UPVALUE(value)       isObjType(value, OBJ_UPVALUE)
 #define AS_UPVALUE(value)       ((ObjUpvalue*)AS_OBJ(value))
+#define IS_RANGE(value)         isObjType(value, OBJ_RANGE)
+#define AS_RANGE(value)         ((ObjRange*)AS_OBJ(value))
 
 // ---------------------
 // Object types
@@ -72,13 +76,16 @@ typedef enum {
     OBJ_NAMESPACE,
     OBJ_BOUND_NATIVE,
     OBJ_DESCRIPTOR,
+    OBJ_RANGE,
 } ObjType;
 
+// Eight bytes. The identity hash is only assigned when objectId() first
+// asks for it; zero means it hasn't been.
 struct Obj {
-    ObjType type;
+    uint8_t type;  // An ObjType.
     bool isMarked;
+    bool isRemembered;  // In a thread's remembered set until the next collection.
     uint32_t id;
-    struct Obj* next;
 };
 
 // ---------------------
@@ -90,13 +97,39 @@ typedef struct {
     int upvalueCount;
     Chunk chunk;
     struct ObjString* name;
+    struct JitCode* jit;
 } ObjFunction;
 
 typedef Value (*NativeFn)(Thread* ctx, int argCount, Value* args);
+typedef double (*NativeNumberFn)(double* args);
 
+// Parameter types a native can declare for the VM to check.
+typedef enum {
+    NATIVE_ANY,
+    NATIVE_NUMBER,
+    NATIVE_STRING,
+    NATIVE_LIST,
+} NativeType;
+
+#define NATIVE_VARIADIC -1
+#define NATIVE_MAX_PARAMS 8
+
+// Describes a native so the VM can check its arguments before the call.
+// A NATIVE_VARIADIC native checks its own. A native that takes and
+// returns only numbers can give `number` instead of `function`, and is
+// then called with its arguments unboxed.
 typedef struct {
+    const char* name;
+    NativeFn function;
+    int arity;
+    NativeType params[NATIVE_MAX_PARAMS];
+    NativeNumberFn number;
+} NativeDef;
+
+typedef struct ObjNative {
     Obj obj;
     NativeFn function;
+    const NativeDef* def;
 } ObjNative;
 
 typedef struct {
@@ -116,6 +149,7 @@ typedef struct ObjString {
     int length;
     char* chars;
     uint32_t hash;
+    bool interned;  // In vm.strings, so equal text means the same object.
     ObjInstance* instance;
 } ObjString;
 
@@ -126,6 +160,17 @@ typedef struct ObjUpvalue {
     struct ObjUpvalue* next;
 } ObjUpvalue;
 
+// The arithmetic operators a class can overload, in ObjClass.operators.
+typedef enum {
+    OPERATOR_ADD,
+    OPERATOR_SUBTRACT,
+    OPERATOR_MULTIPLY,
+    OPERATOR_DIVIDE,
+    OPERATOR_MOD,
+    OPERATOR_INS,
+    OPERATOR_COUNT,
+} OperatorKind;
+
 typedef struct ObjClass {
     Obj obj;
     ObjString* name;
@@ -133,6 +178,10 @@ typedef struct ObjClass {
     Table staticVars;
     Table staticMethods;
     struct ObjClass* superclass;
+    bool isStruct;
+    int fieldCount;          // A struct's fields, stored inline in instances.
+    ObjString** fieldNames;
+    struct ObjBoundMethod* operators[OPERATOR_COUNT];  // The methods entries for operators.
 } ObjClass;
 
 typedef struct ObjClosure {
@@ -147,6 +196,7 @@ typedef struct ObjInstance {
     Obj obj;
     ObjClass* klass;
     Table fields;
+    Value values[];          // Struct fields, in declaration order.
 } ObjInstance;
 
 typedef struct ObjBoundMethod {
@@ -159,15 +209,33 @@ typedef struct ObjBoundMethod {
 typedef struct ObjBoundNative {
     Obj obj;
     Value receiver;
-    NativeFn* method;
+    ObjNative* native;
 } ObjBoundNative;
 
+// A list that only ever had structs of one type appended keeps their
+// fields back to back instead of an instance per element.
+typedef struct {
+    ObjClass* klass;
+    ValueArray fields;       // klass->fieldCount values per element.
+} PackedStructs;
+
 typedef struct ObjList {
     Obj obj;
-    ValueArray elements;
+    ValueArray elements;     // Empty while the list is packed.
+    PackedStructs* packed;
     ObjInstance* instance;
 } ObjList;
 
+// start, start + step, ... up to but not including end.
+typedef struct ObjRange {
+    Obj obj;
+    double start;
+    double end;
+    double step;
+    int length;
+    ObjInstance* instance;
+} ObjRange;
+
 typedef struct ObjMultiDispatch {
     Obj obj;
     ObjString* name;
@@ -199,17 +267,27 @@ typedef struct ObjNamespace{
 // Functions
 // ---------------------
 ObjBoundMethod* newBoundMethod(Value receiver, ObjString* name);
-ObjBoundNative* newBoundNative(NativeFn* fn);
+ObjBoundNative* newBoundNative(ObjNative* native);
 ObjClass* newClass(ObjString* name);
 ObjString* newString(char* chars, int length);
 ObjClosure* newClosure(ObjFunction* function);
 ObjFunction* newFunction();
 ObjInstance* newInstance(ObjClass* klass);
 ObjNative* newNative(NativeFn function);
+ObjNative* newNativeDef(const NativeDef* def);
 ObjString* takeString(char* chars, int length);
 ObjString* copyString(const char* chars, int length);
+ObjString* charString(char c);
+ObjString* internString(ObjString* string);
+#ifdef PRECISE_GC
+void markCharStrings();
+#endif
 ObjUpvalue* newUpvalue(Value* slot);
 ObjList* newList();
+bool appendPacked(ObjList* list, Value value);
+bool setPacked(ObjList* list, int index, Value value);
+void unpackList(ObjList* list);
+ObjRange* newRange(double start, double end, double step);
 ObjMultiDispatch* newMultiDispatch(ObjString*);
 ObjImage* newImage(SDL_Texture* texture, int width, int height);
 ObjThread* newThread(pthread_t *thread, Thread *ctx);
@@ -218,6 +296,7 @@ ObjDescriptor* newDescriptor(ObjString* name, ObjString* args);
 
 void printObject(Value value);
 uint32_t hashString(const char* key, int length);
+uint32_t objectId(Obj* object);
 
 Obj* allocateObject(size_t size, ObjType type);
 #define ALLOCATE_OBJ(type, objectType) \
@@ -227,4 +306,45 @@ static inline bool isObjType(Value value, ObjType type) {
     return IS_OBJ(value) && AS_OBJ(value)->type == type;
 }
 
+// Two interned strings are equal only if they are the same object. Strings
+// built at runtime are not interned, so they fall back to the characters.
+static inline bool stringsEqual(ObjString* a, ObjString* b) {
+    if (a == b) return true;
+    if (a->interned && b->interned) return false;
+    return a->hash == b->hash && a->length == b->length &&
+           memcmp(a->chars, b->chars, a->length) == 0;
+}
+
+// Looks up a field by name. A struct's own fields are found by position,
+// anything else in the field table.
+static inline bool getField(ObjInstance* instance, ObjString* name, Value* value) {
+    ObjClass* klass = instance->klass;
+    for (int i = 0; i < klass->fieldCount; i++) {
+        if (klass->fieldNames[i] == name) {
+            *value = instance->values[i];
+            return true;
+        }
+    }
+    return tableGet(&instance->fields, name, value);
+}
+
+// Threads share lists without locking, and any one of them may unpack a
+// list, so the packed storage is read with acquire.
+static inline PackedStructs* packedStructs(ObjList* list) {
+    return __atomic_load_n(&list->packed, __ATOMIC_ACQUIRE);
+}
+
+static inline int packedLength(PackedStructs* packed) {
+    return packed->fields.count / packed->klass->fieldCount;
+}
+
+// The elements of a list, boxing its structs first if it is packed. Code
+// that only wants a packed list's length or a field of one element takes
+// the ObjList directly and looks at packedStructs().
+static inline ObjList* asList(Value value) {
+    ObjList* list = (ObjList*)AS_OBJ(value);
+    if (packedStructs(list) != NULL) unpackList(list);
+    return list;
+}
+
 #endif
@@ -0,0 +1,361 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "profile.h"
+#include "memory.h"
+#include "jit.h"
+#include "vm.h"
+
+// Every function that has run at least once, for the --profile-hot report.
+static pthread_mutex_t profileLock = PTHREAD_MUTEX_INITIALIZER;
+static ObjFunction** functions = NULL;
+static int functionCount = 0;
+static int functionCapacity = 0;
+
+typedef struct {
+    ObjFunction* function;
+    int offset;
+    uint32_t count;
+} HotLoop;
+
+void profileFunction(ObjFunction* function) {
+    pthread_mutex_lock(&profileLock);
+    if (functionCount == functionCapacity) {
+        int oldCapacity = functionCapacity;
+        functionCapacity = GROW_CAPACITY(oldCapacity);
+        functions = GROW_ARRAY(ObjFunction*, functions, oldCapacity, functionCapacity);
+    }
+    functions[functionCount++] = function;
+    pthread_mutex_unlock(&profileLock);
+}
+
+static const char* functionName(ObjFunction* function) {
+    return function->name == NULL ? "<script>" : function->name->chars;
+}
+
+static const char* tier(ObjFunction* function) {
+    return function->jit != NULL && function->jit->code != NULL ? "jit" : "interp";
+}
+
+static int byAddress(const void* a, const void* b) {
+    uintptr_t left = (uintptr_t)*(ObjFunction**)a;
+    uintptr_t right = (uintptr_t)*(ObjFunction**)b;
+    return (left > right) - (left < right);
+}
+
+static int byCalls(const void* a, const void* b) {
+    uint32_t left = (*(ObjFunction**)a)->chunk.calls;
+    uint32_t right = (*(ObjFunction**)b)->chunk.calls;
+    return (left < right) - (left > right);
+}
+
+static int byIterations(const void* a, const void* b) {
+    uint32_t left = ((HotLoop*)a)->count;
+    uint32_t right = ((HotLoop*)b)->count;
+    return (left < right) - (left > right);
+}
+
+void printHotProfile() {
+    pthread_mutex_lock(&profileLock);
+
+    // Two threads can make the same first call at once.
+    qsort(functions, functionCount, sizeof(ObjFunction*), byAddress);
+    int unique = 0;
+    for (int i = 0; i < functionCount; i++) {
+        if (unique == 0 || functions[unique - 1] != functions[i]) functions[unique++] = functions[i];
+    }
+    functionCount = unique;
+
+    qsort(functions, functionCount, sizeof(ObjFunction*), byCalls);
+    fprintf(stderr, "Hot functions:\n");
+    fprintf(stderr, "%12s  %-6s  %s\n", "calls", "tier", "function");
+    for (int i = 0; i < functionCount && i < PROFILE_TOP; i++) {
+        ObjFunction* function = functions[i];
+        fprintf(stderr, "%12u  %-6s  %s (line %d)\n", function->chunk.calls, tier(function),
+                functionName(function), function->chunk.count > 0 ? function->chunk.lines[0] : 0);
+    }
+
+    int loopCount = 0;
+    for (int i = 0; i < functionCount; i++) {
+        Chunk* chunk = &functions[i]->chunk;
+        if (chunk->backedges == NULL) continue;
+        for (int offset = 0; offset <= chunk->count; offset++) {
+            if (chunk->backedges[offset] > 0) loopCount++;
+        }
+    }
+
+    HotLoop* loops = malloc(sizeof(HotLoop) * (loopCount + 1));
+    if (loops != NULL) {
+        int count = 0;
+        for (int i = 0; i < functionCount; i++) {
+            Chunk* chunk = &functions[i]->chunk;
+            if (chunk->backedges == NULL) continue;
+            for (int offset = 0; offset <= chunk->count; offset++) {
+                if (chunk->backedges[offset] == 0) continue;
+                loops[count++] = (HotLoop){functions[i], offset, chunk->backedges[offset]};
+            }
+        }
+        qsort(loops, count, sizeof(HotLoop), byIterations);
+
+        fprintf(stderr, "Hot loops:\n");
+        fprintf(stderr, "%12s  %-6s  %s\n", "iterations", "tier", "loop");
+        for (int i = 0; i < count && i < PROFILE_TOP; i++) {
+            Chunk* chunk = &loops[i].function->chunk;
+            fprintf(stderr, "%12u  %-6s  %s line %d\n", loops[i].count, tier(loops[i].function),
+                    functionName(loops[i].function), chunk->lines[loops[i].offset - 1]);
+        }
+        free(loops);
+    }
+
+    pthread_mutex_unlock(&profileLock);
+}
+
+// ---------------------
+// Heap profile
+// ---------------------
+
+// Allocations charged to one site: a function and line and the type made
+// there. The census uses the same entries without a function.
+typedef struct {
+    ObjFunction* function;  // NULL outside Gem code, as in the compiler.
+    int line;
+    ObjType type;
+    ObjClass* klass;        // For instances.
+    size_t bytes;
+    size_t objects;
+    bool used;
+} HeapSite;
+
+typedef struct {
+    HeapSite* sites;
+    int count;
+    int capacity;
+} SiteTable;
+
+static size_t heapInterval = PROFILE_HEAP_INTERVAL;
+static _Thread_local size_t sinceSample = 0;
+static _Thread_local size_t nextSample = 0;
+static _Thread_local uint32_t sampleSeed = 0;
+static SiteTable allocationSites;
+#ifdef PRECISE_GC
+static SiteTable census;
+#endif
+
+static const char* typeNames[] = {
+    [OBJ_STRING] = "string",
+    [OBJ_FUNCTION] = "function",
+    [OBJ_NATIVE] = "native",
+    [OBJ_CLOSURE] = "closure",
+    [OBJ_UPVALUE] = "upvalue",
+    [OBJ_CLASS] = "class",
+    [OBJ_INSTANCE] = "instance",
+    [OBJ_BOUND_METHOD] = "bound method",
+    [OBJ_LIST] = "list",
+    [OBJ_MULTI_DISPATCH] = "overloads",
+    [OBJ_ERROR] = "error",
+    [OBJ_IMAGE] = "image",
+    [OBJ_THREAD] = "thread",
+    [OBJ_NAMESPACE] = "namespace",
+    [OBJ_BOUND_NATIVE] = "bound native",
+    [OBJ_DESCRIPTOR] = "file",
+    [OBJ_RANGE] = "range",
+};
+
+static uint32_t siteHash(ObjFunction* function, int line, ObjType type, ObjClass* klass) {
+    uint64_t key = (uintptr_t)function ^ ((uintptr_t)klass << 1) ^
+                   ((uint64_t)line << 32) ^ type;
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return (uint32_t)key;
+}
+
+static HeapSite* findSite(SiteTable* table, ObjFunction* function, int line,
+                          ObjType type, ObjClass* klass);
+
+static void growSites(SiteTable* table) {
+    HeapSite* old = table->sites;
+    int oldCapacity = table->capacity;
+    table->capacity = GROW_CAPACITY(oldCapacity);
+    table->sites = ALLOCATE(HeapSite, table->capacity);
+    memset(table->sites, 0, sizeof(HeapSite) * table->capacity);
+    table->count = 0;
+
+    for (int i = 0; i < oldCapacity; i++) {
+        HeapSite* site = &old[i];
+        if (!site->used) continue;
+        HeapSite* copy = findSite(table, site->function, site->line, site->type, site->klass);
+        copy->bytes = site->bytes;
+        copy->objects = site->objects;
+    }
+    FREE_ARRAY(HeapSite, old, oldCapacity);
+}
+
+static HeapSite* findSite(SiteTable* table, ObjFunction* function, int line,
+                          ObjType type, ObjClass* klass) {
+    if ((table->count + 1) * 4 > table->capacity * 3) growSites(table);
+
+    uint32_t mask = (uint32_t)table->capacity - 1;
+    uint32_t index = siteHash(function, line, type, klass) & mask;
+    for (;;) {
+        HeapSite* site = &table->sites[index];
+        if (!site->used) {
+            *site = (HeapSite){function, line, type, klass, 0, 0, true};
+            table->count++;
+            return site;
+        }
+        if (site->function == function && site->line == line &&
+            site->type == type && site->klass == klass) {
+            return site;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+void startHeapProfile(size_t interval) {
+    if (interval > 0) heapInterval = interval;
+    vm.profileHeap = true;
+}
+
+// Somewhere between half and one and a half intervals. A fixed interval
+// would stay in step with a loop that allocates the same objects each time
+// round and always sample the same one.
+static size_t sampleDistance() {
+    if (sampleSeed == 0) sampleSeed = (uint32_t)(uintptr_t)&sampleSeed | 1;
+    sampleSeed ^= sampleSeed << 13;
+    sampleSeed ^= sampleSeed >> 17;
+    sampleSeed ^= sampleSeed << 5;
+    return heapInterval / 2 + sampleSeed % (heapInterval + 1);
+}
+
+// Charges the allocation that crosses the distance with every byte since
+// the last sample, so a site's share of the samples estimates its share of
+// the bytes.
+void profileAllocation(ObjType type, ObjClass* klass, size_t size) {
+    if (nextSample == 0) nextSample = sampleDistance();
+    sinceSample += size;
+    if (sinceSample < nextSample) return;
+    size_t weight = sinceSample;
+    sinceSample = 0;
+    nextSample = sampleDistance();
+
+    ObjFunction* function = NULL;
+    int line = 0;
+    Thread* ctx = gcCurrentThread();
+    if (ctx != NULL && ctx->frameCount > 0) {
+        CallFrame* frame = &ctx->frames[ctx->frameCount - 1];
+        function = frame->closure->function;
+        int instruction = (int)(frame->ip - function->chunk.code) - 1;
+        if (instruction >= 0 && instruction < function->chunk.count) {
+            line = function->chunk.lines[instruction];
+        }
+    }
+
+    pthread_mutex_lock(&profileLock);
+    HeapSite* site = findSite(&allocationSites, function, line, type, klass);
+    site->bytes += weight;
+    site->objects += weight / size;
+    pthread_mutex_unlock(&profileLock);
+}
+
+#ifdef PRECISE_GC
+// Called before the roots are marked, so the classes left from the last
+// census are never read after they are freed.
+void beginHeapCensus() {
+    if (census.capacity > 0) memset(census.sites, 0, sizeof(HeapSite) * census.capacity);
+    census.count = 0;
+}
+
+void censusObject(Obj* object, size_t bytes) {
+    ObjClass* klass = object->type == OBJ_INSTANCE ? ((ObjInstance*)object)->klass : NULL;
+    HeapSite* site = findSite(&census, NULL, 0, object->type, klass);
+    site->bytes += bytes;
+    site->objects++;
+}
+#endif
+
+static int byBytes(const void* a, const void* b) {
+    size_t left = ((HeapSite*)a)->bytes;
+    size_t right = ((HeapSite*)b)->bytes;
+    return (left < right) - (left > right);
+}
+
+// Strings and lists carry an instance of their class, which shows up as
+// "String instance" next to "string".
+static const char* siteTypeName(HeapSite* site, char* buffer, size_t size) {
+    if (site->klass == NULL) return typeNames[site->type];
+    snprintf(buffer, size, "%s instance", site->klass->name->chars);
+    return buffer;
+}
+
+// Returns the used entries, largest first.
+static HeapSite* sortedSites(SiteTable* table) {
+    HeapSite* sorted = malloc(sizeof(HeapSite) * (table->count + 1));
+    if (sorted == NULL) return NULL;
+    int count = 0;
+    for (int i = 0; i < table->capacity; i++) {
+        if (table->sites[i].used) sorted[count++] = table->sites[i];
+    }
+    qsort(sorted, count, sizeof(HeapSite), byBytes);
+    return sorted;
+}
+
+void printHeapProfile() {
+#ifdef PRECISE_GC
+    // A last full collection counts what the program still holds.
+    gcCollect();
+#endif
+    pthread_mutex_lock(&profileLock);
+
+    char type[64];
+    HeapSite* sites = sortedSites(&allocationSites);
+    if (sites != NULL) {
+        fprintf(stderr, "Allocation sites (sampled about every %zu bytes):\n", heapInterval);
+        fprintf(stderr, "%12s  %10s  %-20s  %s\n", "bytes", "objects", "type", "site");
+        for (int i = 0; i < allocationSites.count && i < PROFILE_TOP; i++) {
+            HeapSite* site = &sites[i];
+            if (site->function == NULL) {
+                fprintf(stderr, "%12zu  %10zu  %-20s  <native>\n", site->bytes, site->objects,
+                        siteTypeName(site, type, sizeof(type)));
+            } else {
+                fprintf(stderr, "%12zu  %10zu  %-20s  %s line %d\n", site->bytes, site->objects,
+                        siteTypeName(site, type, sizeof(type)),
+                        functionName(site->function), site->line);
+            }
+        }
+        free(sites);
+    }
+
+#ifdef PRECISE_GC
+    sites = sortedSites(&census);
+    if (sites != NULL) {
+        fprintf(stderr, "Live objects after the last full collection:\n");
+        fprintf(stderr, "%12s  %10s  %s\n", "bytes", "objects", "type");
+        for (int i = 0; i < census.count && i < PROFILE_TOP; i++) {
+            fprintf(stderr, "%12zu  %10zu  %s\n", sites[i].bytes, sites[i].objects,
+                    siteTypeName(&sites[i], type, sizeof(type)));
+        }
+        free(sites);
+    }
+#else
+    fprintf(stderr, "Live objects by type need the precise collector (-DGEM_PRECISE_GC=ON).\n");
+#endif
+
+    pthread_mutex_unlock(&profileLock);
+}
+
+#ifdef PRECISE_GC
+// Functions and classes are kept for the reports even once nothing else
+// refers to them.
+void markProfileRoots() {
+    for (int i = 0; i < functionCount; i++) markObject((Obj*)functions[i]);
+    for (int i = 0; i < allocationSites.capacity; i++) {
+        HeapSite* site = &allocationSites.sites[i];
+        if (!site->used) continue;
+        markObject((Obj*)site->function);
+        markObject((Obj*)site->klass);
+    }
+}
+#endif
@@ -0,0 +1,25 @@
+#ifndef gem_profile_h
+#define gem_profile_h
+
+#include "object.h"
+
+// How many functions and loops --profile-hot lists.
+#define PROFILE_TOP 20
+
+// --profile-heap samples an allocation every this many bytes by default.
+#define PROFILE_HEAP_INTERVAL (64 * 1024)
+
+void profileFunction(ObjFunction* function);
+void printHotProfile();
+
+void startHeapProfile(size_t interval);
+void profileAllocation(ObjType type, ObjClass* klass, size_t size);
+void printHeapProfile();
+#ifdef PRECISE_GC
+void markProfileRoots();
+// Full collections count what survived, by type and class.
+void beginHeapCensus();
+void censusObject(Obj* object, size_t bytes);
+#endif
+
+#endif
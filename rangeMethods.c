@@ -0,0 +1,99 @@
+#include "memory.h"
+#include "value.h"
+#include "vm.h"
+
+static Value rangeNative(Thread* ctx, int argCount, Value* args) {
+    if (argCount < 1 || argCount > 3) {
+        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
+                     "No function range for arity %d.", argCount);
+        return NIL_VAL;
+    }
+
+    for (int i = 0; i < argCount; i++) {
+        if (!IS_NUMBER(args[i])) {
+            runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
+                         "range: expected Number but got %s.", getValueTypeName(args[i]));
+            return NIL_VAL;
+        }
+    }
+
+    if (argCount == 1) return OBJ_VAL(newRange(0, AS_NUMBER(args[0]), 1));
+
+    double step = argCount == 3 ? AS_NUMBER(args[2]) : 1;
+    if (step == 0) {
+        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass, "range: step cannot be 0.");
+        return NIL_VAL;
+    }
+
+    return OBJ_VAL(newRange(AS_NUMBER(args[0]), AS_NUMBER(args[1]), step));
+}
+
+static Value rangeLengthNative(Thread* ctx, int argCount, Value* args) {
+    return NUMBER_VAL(AS_RANGE(args[-1])->length);
+}
+
+static Value rangeGetNative(Thread* ctx, int argCount, Value* args) {
+    ObjRange* range = AS_RANGE(args[-1]);
+    int index = (int)AS_NUMBER(args[0]);
+    if (index < 0 || index >= range->length) {
+        runtimeErrorCtx(ctx, vm.indexErrorClass,
+                     "get: index %d out of range (0–%d).",
+                     index, range->length - 1);
+        return NIL_VAL;
+    }
+
+    return NUMBER_VAL(range->start + index * range->step);
+}
+
+// Slicing only moves the bounds, so the result is as lazy as the source.
+static Value rangeSliceNative(Thread* ctx, int argCount, Value* args) {
+    if (argCount != 1 && argCount != 2) {
+        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
+                     "No method slice for arity %d.", argCount);
+        return NIL_VAL;
+    }
+
+    ObjRange* range = AS_RANGE(args[-1]);
+    if (!IS_NUMBER(args[0]) || (argCount == 2 && !IS_NUMBER(args[1]))) {
+        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
+                     "slice: expected (Number, Number) but got (%s, %s).",
+                     getValueTypeName(args[0]),
+                     argCount == 2 ? getValueTypeName(args[1]) : "none");
+        return NIL_VAL;
+    }
+
+    int from = (int)AS_NUMBER(args[0]);
+    int to = argCount == 2 ? (int)AS_NUMBER(args[1]) : range->length;
+    if (from < 0) from = 0;
+    if (to > range->length) to = range->length;
+    if (to < from) to = from;
+
+    return OBJ_VAL(newRange(range->start + from * range->step,
+                            range->start + to * range->step, range->step));
+}
+
+static Value rangeContainsNative(Thread* ctx, int argCount, Value* args) {
+    if (!IS_NUMBER(args[0])) return BOOL_VAL(false);
+
+    ObjRange* range = AS_RANGE(args[-1]);
+    double offset = (AS_NUMBER(args[0]) - range->start) / range->step;
+    return BOOL_VAL(offset >= 0 && offset < range->length && offset == (int)offset);
+}
+
+static Value rangeToListNative(Thread* ctx, int argCount, Value* args) {
+    ObjRange* range = AS_RANGE(args[-1]);
+    ObjList* list = newList();
+    for (int i = 0; i < range->length; i++) {
+        writeValueArray(&list->elements, NUMBER_VAL(range->start + i * range->step));
+    }
+    return OBJ_VAL(list);
+}
+
+static const NativeDef rangeMethods[] = {
+    {"length", rangeLengthNative, 0},
+    {"get", rangeGetNative, 1, {NATIVE_NUMBER}},
+    {"slice", rangeSliceNative, NATIVE_VARIADIC},
+    {"contains", rangeContainsNative, 1, {NATIVE_ANY}},
+    {"toList", rangeToListNative, 0},
+    {NULL},
+};
@@ -123,8 +123,14 @@ static TokenType identifierType() {
             if (scanner.current - scanner.start > 1) {
                 switch (scanner.start[1]) {
                     case 'l': return checkKeyword(2, 3, "ass", TOKEN_CLASS);
-                    case 'a': return checkKeyword(2, 3, "tch", TOKEN_CATCH);
-                    case 'o': return checkKeyword(2, 6, "ntinue", TOKEN_CONTINUE);
+                    case 'a':
+                        if (scanner.current - scanner.start > 2 && scanner.start[2] == 's')
+                            return checkKeyword(2, 2, "se", TOKEN_CASE);
+                        return checkKeyword(2, 3, "tch", TOKEN_CATCH);
+                    case 'o':
+                        if (scanner.current - scanner.start > 3 && scanner.start[3] == 's')
+                            return checkKeyword(2, 3, "nst", TOKEN_CONST);
+                        return checkKeyword(2, 6, "ntinue", TOKEN_CONTINUE);
                 }
             }
         case 'e': 
@@ -132,6 +138,7 @@ static TokenType identifierType() {
                 switch(scanner.start[1]){
                     case 'x': return checkKeyword(2, 4, "port", TOKEN_EXPORT);
                     case 'l': return checkKeyword(2, 2, "se", TOKEN_ELSE);
+                    case 'n': return checkKeyword(2, 2, "um", TOKEN_ENUM);
                 }
             }
         case 'i':
@@ -168,12 +175,18 @@ static TokenType identifierType() {
         case 's':
             if (scanner.current - scanner.start > 1) {
                 switch (scanner.start[1]) {
-                    case 't': return checkKeyword(2, 4, "atic", TOKEN_STATIC);
+                    case 't':
+                        if (scanner.current - scanner.start > 2 && scanner.start[2] == 'r') {
+                            return checkKeyword(3, 3, "uct", TOKEN_STRUCT);
+                        }
+                        return checkKeyword(2, 4, "atic", TOKEN_STATIC);
                     case 'u': return checkKeyword(2, 3, "per", TOKEN_SUPER);
+                    case 'w': return checkKeyword(2, 4, "itch", TOKEN_SWITCH);
                 }
             }
         case 'v': return checkKeyword(1, 2, "ar", TOKEN_VAR);
         case 'w': return checkKeyword(1, 4, "hile", TOKEN_WHILE);
+        case 'd': return checkKeyword(1, 6, "efault", TOKEN_DEFAULT);
         case 'f':
             if (scanner.current - scanner.start > 1) {
                 switch (scanner.start[1]) {
@@ -321,7 +334,7 @@ Token scanToken() {
         case ']': return makeToken(TOKEN_RIGHT_BRACKET);
         case ';': return makeToken(TOKEN_SEMICOLON);
         case ',': return makeToken(TOKEN_COMMA);
-        case '.': return makeToken(TOKEN_DOT);
+        case '.': if (match('.')) return makeToken(TOKEN_DOT_DOT); else return makeToken(TOKEN_DOT);
         case '-': if(match('-')) return makeToken(TOKEN_DECRE); else return makeToken(TOKEN_MINUS);
         case '+': if(match('+')) return makeToken(TOKEN_INCRE); else return makeToken(TOKEN_PLUS);
         case '/': return makeToken(TOKEN_SLASH);
@@ -13,7 +13,7 @@ typedef enum {
     TOKEN_BANG, TOKEN_BANG_EQUAL,
     TOKEN_EQUAL, TOKEN_EQUAL_EQUAL,
     TOKEN_GREATER, TOKEN_GREATER_EQUAL,
-    TOKEN_LESS, TOKEN_LESS_EQUAL, TOKEN_DOUBLE_COLON,
+    TOKEN_LESS, TOKEN_LESS_EQUAL, TOKEN_DOUBLE_COLON, TOKEN_DOT_DOT,
     // Literals.
     TOKEN_IDENTIFIER, TOKEN_STRING, TOKEN_NUMBER, TOKEN_BINARY_NUMBER,
     TOKEN_OCTAL_NUMBER, TOKEN_HEX_NUMBER,
@@ -23,6 +23,7 @@ typedef enum {
     TOKEN_PRINT, TOKEN_PRINTLN, TOKEN_RETURN, TOKEN_SUPER, TOKEN_THIS, TOKEN_IS,
     TOKEN_TRUE, TOKEN_VAR, TOKEN_WHILE, TOKEN_THROW, TOKEN_IMPORT, TOKEN_NAMESPACE,
     TOKEN_TRY, TOKEN_CATCH, TOKEN_FINALLY, TOKEN_OPERATOR, TOKEN_BREAK, TOKEN_CONTINUE,
+    TOKEN_CONST, TOKEN_ENUM, TOKEN_SWITCH, TOKEN_CASE, TOKEN_DEFAULT, TOKEN_STRUCT,
 
     TOKEN_ERROR, TOKEN_EOF
 } TokenType;
@@ -17,9 +17,16 @@ FILE* file;
 #define NumType 3
 #define BoolType 4
 #define ChunkType 5
+#define FunctionRefType 6
 
 static void serialize_function(ObjFunction* func);
 
+// Functions already written, in order. Inlined calls keep the callee in the
+// caller's constants, so the same function is reached more than once.
+static ObjFunction** written;
+static int writtenCount;
+static int writtenCapacity;
+
 void writeByte(uint8_t value) {
     fwrite(&value, sizeof(uint8_t), 1, file);
 }
@@ -82,6 +89,20 @@ static void serialize_chunk(Chunk* chunk) {
 }
 
 static void serialize_function(ObjFunction* func) {
+    for (int i = 0; i < writtenCount; i++) {
+        if (written[i] == func) {
+            writeByte(FunctionRefType);
+            writeInt(i);
+            return;
+        }
+    }
+
+    if (writtenCount == writtenCapacity) {
+        writtenCapacity = writtenCapacity < 8 ? 8 : writtenCapacity * 2;
+        written = realloc(written, sizeof(ObjFunction*) * writtenCapacity);
+    }
+    written[writtenCount++] = func;
+
     writeByte(FunctionType);
 
     if(func->name == NULL)
@@ -103,6 +124,7 @@ void serialize(const char* filename, ObjFunction* function) {
     
     Value val = OBJ_VAL(function);
 
+    writtenCount = 0;
     serialize_function(AS_FUNCTION(val));
     fclose(file);
 }
@@ -13,11 +13,6 @@
 #include <stdlib.h>
 
 static Value stringIteratorNative(Thread* ctx, int argCount, Value* args) {
-    if (argCount != 0) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "No method iterator for arity %d.", argCount);
-        return NIL_VAL;
-    }
     
     Value classVal;
     ObjString* className = copyString("StringIterator", 14);
@@ -40,12 +35,6 @@ static Value stringIteratorNative(Thread* ctx, int argCount, Value* args) {
 }
 
 static Value stringCharCodeNative(Thread* ctx, int argCount, Value* args) {
-    if (argCount != 0) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "No method charCode for arity %d.", argCount);
-        return NIL_VAL;
-    }
-
     ObjString* self = AS_STRING(args[-1]); // assuming it's a bound method
     if (self->length == 0) return NUMBER_VAL(-1);
 
@@ -53,19 +42,6 @@ static Value stringCharCodeNative(Thread* ctx, int argCount, Value* args) {
 }
 
 static Value stringSplitNative(Thread* ctx, int argCount, Value* args) {
-    if (argCount != 1) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "No method split for arity %d.", argCount);
-        return NIL_VAL;
-    }
-
-    if (!IS_STRING(args[0])) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "split: expected (String) but got (%s).",
-                     getValueTypeName(args[0]));
-        return NIL_VAL;
-    }
-
     ObjString* source = AS_STRING(args[-1]);
     ObjString* delimiter = AS_STRING(args[0]);
 
@@ -108,12 +84,6 @@ static Value stringSplitNative(Thread* ctx, int argCount, Value* args) {
 #include <ctype.h>
 
 static Value stringTrimNative(Thread* ctx, int argCount, Value* args) {
-    if (argCount != 0) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "No method trim for arity %d.", argCount);
-        return NIL_VAL;
-    }
-
     ObjString* self = AS_STRING(args[-1]);
     const char* start = self->chars;
     const char* end = self->chars + self->length - 1;
@@ -126,30 +96,11 @@ static Value stringTrimNative(Thread* ctx, int argCount, Value* args) {
 }
 
 static Value stringLengthNative(Thread* ctx, int argCount, Value* args) {
-    if (argCount != 0) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "No method length for arity %d.", argCount);
-        return NIL_VAL;
-    }
-
     ObjString* string = AS_STRING(args[-1]);
     return NUMBER_VAL(string->length);
 }
 
 static Value stringStartsWithNative(Thread* ctx, int argCount, Value* args) {
-    if (argCount != 1) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "No method startsWith for arity %d.", argCount);
-        return NIL_VAL;
-    }
-
-    if (!IS_STRING(args[0])) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "startsWith: expected (String) but got (%s).",
-                     getValueTypeName(args[0]));
-        return NIL_VAL;
-    }
-
     ObjString* str = AS_STRING(args[-1]);
     ObjString* prefix = AS_STRING(args[0]);
 
@@ -163,19 +114,6 @@ static Value stringStartsWithNative(Thread* ctx, int argCount, Value* args) {
 }
 
 static Value stringEndsWithNative(Thread* ctx, int argCount, Value* args) {
-    if (argCount != 1) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "No method endsWith for arity %d.", argCount);
-        return NIL_VAL;
-    }
-
-    if (!IS_STRING(args[0])) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "endsWith: expected (String) but got (%s).",
-                     getValueTypeName(args[0]));
-        return NIL_VAL;
-    }
-
     ObjString* str = AS_STRING(args[-1]);
     ObjString* suffix = AS_STRING(args[0]);
 
@@ -190,19 +128,6 @@ static Value stringEndsWithNative(Thread* ctx, int argCount, Value* args) {
 }
 
 static Value stringCharAtNative(Thread* ctx, int argCount, Value* args) {
-    if (argCount != 1) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "No method charAt for arity %d.", argCount);
-        return NIL_VAL;
-    }
-
-    if (!IS_NUMBER(args[0])) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "charAt: expected (Number) but got (%s).",
-                     getValueTypeName(args[0]));
-        return NIL_VAL;
-    }
-
     ObjString* string = AS_STRING(args[-1]);
     double num = AS_NUMBER(args[0]);
 
@@ -214,18 +139,12 @@ static Value stringCharAtNative(Thread* ctx, int argCount, Value* args) {
      }
     int index = (int)num;
 
-    return OBJ_VAL(copyString(&string->chars[index], 1));
+    return OBJ_VAL(charString(string->chars[index]));
 }
 
 static Value stringToUpperCaseNative(Thread* ctx, int argCount, Value* args) {
-    if (argCount != 0) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "No method toUpperCase for arity %d.", argCount);
-        return NIL_VAL;
-    }
-
     ObjString* string = AS_STRING(args[-1]);
-    char* upper = ALLOCATE(char, string->length);
+    char* upper = ALLOCATE_ATOMIC(char, string->length);
     for (int i = 0; i < string->length; i++) {
         upper[i] = toupper((unsigned char)string->chars[i]);
     }
@@ -236,14 +155,8 @@ static Value stringToUpperCaseNative(Thread* ctx, int argCount, Value* args) {
 }
 
 static Value stringToLowerCaseNative(Thread* ctx, int argCount, Value* args) {
-    if (argCount != 0) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "No method toLowerCase for arity %d.", argCount);
-        return NIL_VAL;
-    }
-
     ObjString* string = AS_STRING(args[-1]);
-    char* lower = ALLOCATE(char, string->length);
+    char* lower = ALLOCATE_ATOMIC(char, string->length);
 
     for (int i = 0; i < string->length; i++) {
         lower[i] = tolower((unsigned char)string->chars[i]);
@@ -255,19 +168,6 @@ static Value stringToLowerCaseNative(Thread* ctx, int argCount, Value* args) {
 }
 
 static Value stringSubstringNative(Thread* ctx, int argCount, Value* args) {
-    if (argCount != 2) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "No method substring for arity %d.", argCount);
-        return NIL_VAL;
-    }
-
-    if (!IS_NUMBER(args[0]) || !IS_NUMBER(args[1])) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "substring: expected (Number, Number) but got (%s, %s).",
-                     getValueTypeName(args[0]), getValueTypeName(args[1]));
-        return NIL_VAL;
-    }
-
     ObjString* string = AS_STRING(args[-1]);
     int start = (int)AS_NUMBER(args[0]);
     int end = (int)AS_NUMBER(args[1]);
@@ -281,18 +181,6 @@ static Value stringSubstringNative(Thread* ctx, int argCount, Value* args) {
 }
 
 static Value stringIndexOfNative(Thread* ctx, int argCount, Value* args) {
-    if (argCount != 1) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "no method indexOf for arity %d.", argCount);
-        return NIL_VAL;
-    }
-
-    if (!IS_STRING(args[0])) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "indexOf: expected (String) but got (%s).", getValueTypeName(args[0]));
-        return NIL_VAL;
-    }
-
     ObjString* haystack = AS_STRING(args[-1]);
     ObjString* needle = AS_STRING(args[0]);
 
@@ -307,12 +195,6 @@ static Value stringIndexOfNative(Thread* ctx, int argCount, Value* args) {
 
 
 static Value stringParseNumberNative(Thread* ctx, int argCount, Value* args) {
-    if (argCount != 0) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "no method asNum for arity %d.", argCount);
-        return NIL_VAL;
-    }
-
     ObjString* str = AS_STRING(args[-1]);
     char* end;
     double value = strtod(str->chars, &end);
@@ -327,12 +209,6 @@ static Value stringParseNumberNative(Thread* ctx, int argCount, Value* args) {
 }
 
 static Value stringParseBooleanNative(Thread* ctx, int argCount, Value* args) {
-    if (argCount != 0) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "no method parseBoolean for arity %d.", argCount);
-        return NIL_VAL;
-    }
-
     ObjString* str = AS_STRING(args[-1]);
     if (strcasecmp(str->chars, "true") == 0 || strcmp(str->chars, "1") == 0)
         return BOOL_VAL(true);
@@ -345,12 +221,6 @@ static Value stringParseBooleanNative(Thread* ctx, int argCount, Value* args) {
 }
 
 static Value str_isDigit(Thread* ctx, int argCount, Value* args) {
-    if (argCount != 0) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "no method isDigit for arity %d.", argCount);
-        return NIL_VAL;
-    }
-
     ObjString* str = AS_STRING(args[-1]);
     char* end;
     double num = strtod(str->chars, &end);
@@ -358,12 +228,6 @@ static Value str_isDigit(Thread* ctx, int argCount, Value* args) {
 }
 
 static Value str_parse(Thread* ctx, int argCount, Value* args) {
-    if (argCount != 0) {
-        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
-                     "no method parse for arity %d.", argCount);
-        return NIL_VAL;
-    }
-
     ObjString* str = AS_STRING(args[-1]);
     char* end;
     double num = strtod(str->chars, &end);
@@ -378,3 +242,23 @@ static Value str_parse(Thread* ctx, int argCount, Value* args) {
 
     return OBJ_VAL(str);
 }
+
+static const NativeDef stringMethods[] = {
+    {"length", stringLengthNative, 0},
+    {"charAt", stringCharAtNative, 1, {NATIVE_NUMBER}},
+    {"toUpperCase", stringToUpperCaseNative, 0},
+    {"toLowerCase", stringToLowerCaseNative, 0},
+    {"substring", stringSubstringNative, 2, {NATIVE_NUMBER, NATIVE_NUMBER}},
+    {"indexOf", stringIndexOfNative, 1, {NATIVE_STRING}},
+    {"asNum", stringParseNumberNative, 0},
+    {"asBool", stringParseBooleanNative, 0},
+    {"charCode", stringCharCodeNative, 0},
+    {"parse", str_parse, 0},
+    {"split", stringSplitNative, 1, {NATIVE_STRING}},
+    {"trim", stringTrimNative, 0},
+    {"startsWith", stringStartsWithNative, 1, {NATIVE_STRING}},
+    {"endsWith", stringEndsWithNative, 1, {NATIVE_STRING}},
+    {"isDigit", str_isDigit, 0},
+    {"iterator", stringIteratorNative, 0},
+    {NULL},
+};
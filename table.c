@@ -6,7 +6,9 @@
 #include "table.h"
 #include "value.h"
 #include "vm.h"
+#ifndef PRECISE_GC
 #include <gc.h>
+#endif
 
 #define TABLE_MAX_LOAD 0.5
 
@@ -15,11 +17,14 @@ void initTable(Table* table) {
     table->count = 0;
     table->capacity = 0;
     table->entries = NULL;
+    table->owner = NULL;
 }
 
 void freeTable(Table* table) {
     FREE_ARRAY(Entry, table->entries, table->capacity);
-    initTable(table);
+    table->count = 0;
+    table->capacity = 0;
+    table->entries = NULL;
 }
 
 static Entry* findEntry(Entry* entries, int capacity,
@@ -97,7 +102,8 @@ bool tableSet(Table* table, ObjString* key, Value value) {
 
     entry->key = key;
     entry->value = value;
-    
+    TABLE_BARRIER(table, key, value);
+
     return isNewKey;
 }
 
@@ -140,6 +146,16 @@ ObjString* tableFindString(Table* table, const char* chars,
     }
 }
 
+#ifdef PRECISE_GC
+void markTable(Table* table) {
+    for (int i = 0; i < table->capacity; i++) {
+        Entry* entry = &table->entries[i];
+        markObject((Obj*)entry->key);
+        markValue(entry->value);
+    }
+}
+#endif
+
 void tableRemoveWhite(Table* table) {
     for (int i = 0; i < table->capacity; i++) {
         Entry* entry = &table->entries[i];
@@ -13,6 +13,7 @@ typedef struct {
     int count;
     int capacity;
     Entry* entries;
+    Obj* owner;  // The object the table is part of, for the write barrier.
 } Table;
 
 void initTable(Table* table);
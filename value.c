@@ -11,6 +11,7 @@ void initValueArray(ValueArray* array) {
     array->values = NULL;
     array->capacity = 0;
     array->count = 0;
+    array->owner = NULL;
 }
 
 void writeValueArray(ValueArray* array, Value value) {
@@ -23,11 +24,14 @@ void writeValueArray(ValueArray* array, Value value) {
 
     array->values[array->count] = value;
     array->count++;
+    ARRAY_BARRIER(array, value);
 }
 
 void freeValueArray(ValueArray* array) {
     FREE_ARRAY(Value, array->values, array->capacity);
-    initValueArray(array);
+    array->values = NULL;
+    array->capacity = 0;
+    array->count = 0;
 }
 
 void printValue(Value value) {
@@ -51,10 +55,16 @@ bool valuesEqual(Value a, Value b) {
         case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
         case VAL_OBJ:    
             if (AS_OBJ(a)->type == OBJ_STRING && AS_OBJ(b)->type == OBJ_STRING)
-                return (
-                    AS_STRING(a)->length == AS_STRING(b)->length &&
-                    memcmp(AS_STRING(a)->chars, AS_STRING(b)->chars, AS_STRING(a)->length) == 0
-                );
+                return stringsEqual(AS_STRING(a), AS_STRING(b));
+            // Structs are values: the same type and equal fields.
+            if (IS_STRUCT(a) && IS_STRUCT(b) && AS_INSTANCE(a)->klass == AS_INSTANCE(b)->klass) {
+                ObjInstance* x = AS_INSTANCE(a);
+                ObjInstance* y = AS_INSTANCE(b);
+                for (int i = 0; i < x->klass->fieldCount; i++) {
+                    if (!valuesEqual(x->values[i], y->values[i])) return false;
+                }
+                return true;
+            }
             return AS_OBJ(a) == AS_OBJ(b);
             
         default:         return false; // Unreachable.
@@ -78,6 +88,7 @@ char* getValueTypeName(Value value){
             case OBJ_BOUND_METHOD: return "BoundMethod";
             case OBJ_MULTI_DISPATCH: return "MultiDispatch";
             case OBJ_LIST:     return "List";
+            case OBJ_RANGE:    return "Range";
             case OBJ_ERROR:    return "Error";
             default:           return "Object";
         }
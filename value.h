@@ -38,6 +38,7 @@ typedef struct {
   int capacity;
   int count;
   Value* values;
+  Obj* owner;  // The object the array is part of, for the write barrier.
 } ValueArray;
 
 bool valuesEqual(Value a, Value b);
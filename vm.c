@@ -26,12 +26,18 @@
 #include <setjmp.h>
 
 #include "debug.h"
+#include "jit.h"
+#include "profile.h"
 #include "stringMethods.c"
 #include "listMethods.c"
+#include "rangeMethods.c"
+#include "gcMethods.c"
 #include "windowMethods.h"
 #include "Math.c"
 #include <pthread.h>
+#ifndef PRECISE_GC
 #include <gc.h>
+#endif
 
 extern jmp_buf repl_env;
 
@@ -46,10 +52,16 @@ int threadCount = 0;
 
 static Value sleepNative(Thread* ctx, int argCount, Value* args){
     int ms = AS_NUMBER(args[0]);
+#ifdef PRECISE_GC
+    gcBeginBlocking();
+#endif
 #ifdef _WIN32
     Sleep(ms);
 #else
     usleep(ms * 1000);
+#endif
+#ifdef PRECISE_GC
+    gcEndBlocking();
 #endif
     return NIL_VAL;
 }
@@ -65,7 +77,7 @@ static Value exitNative(Thread* ctx, int argCount, Value* args){
 }
 
 static Value hashNative(Thread* ctx, int argCount, Value* args){
-    return NUMBER_VAL(AS_OBJ(args[0])->id);
+    return NUMBER_VAL(objectId(AS_OBJ(args[0])));
 }
 
 static void resetStackCtx(Thread *ctx);
@@ -81,11 +93,31 @@ static void* runCtx(void*);
 
 #include "fileMethods.h"
 
-Value spawnNative(Thread*, int argCount, Value* args) {
+// A thread's stacks. The precise collector frees them itself, when the
+// thread is joined internally or its object is collected.
+static Thread* allocateContext() {
+#ifdef PRECISE_GC
+    return calloc(1, sizeof(Thread));
+#else
+    return GC_MALLOC(sizeof(Thread));
+#endif
+}
+
+// Returns the new thread's object. `caller` is NULL for the VM's own
+// spawns, which are always joined with joinInternal().
+static Value threadValue(Thread* caller, void* thread, Thread* ctx) {
+    ObjThread* threadObj = newThread(thread, ctx);
+#ifdef PRECISE_GC
+    gcAddThread(threadObj, caller == NULL);
+#endif
+    return OBJ_VAL(threadObj);
+}
+
+Value spawnNative(Thread* caller, int argCount, Value* args) {
 #ifdef _WIN32
     HANDLE hThread = NULL;
 
-    Thread* ctx = GC_MALLOC(sizeof(Thread));  // GC-managed context
+    Thread* ctx = allocateContext();  // GC-managed context
     memset(ctx, 0, sizeof(Thread));
     resetStackCtx(ctx);
 
@@ -109,7 +141,7 @@ Value spawnNative(Thread*, int argCount, Value* args) {
         exit(1);
     }
 
-    return OBJ_VAL(newThread(hThread, ctx));
+    return threadValue(caller, hThread, ctx);
 #else
     pthread_t *tid = malloc(sizeof(pthread_t)); 
     if (!tid) {
@@ -117,7 +149,7 @@ Value spawnNative(Thread*, int argCount, Value* args) {
         exit(1);
     }
 
-    Thread *ctx = GC_MALLOC(sizeof(Thread));
+    Thread *ctx = allocateContext();
     memset(ctx, 0, sizeof(Thread));
     resetStackCtx(ctx);
     ctx->namespace = NULL;
@@ -133,14 +165,14 @@ Value spawnNative(Thread*, int argCount, Value* args) {
         exit(1);
     }
 
-    return OBJ_VAL(newThread(tid, ctx));
+    return threadValue(caller, tid, ctx);
 #endif
 }
 
 Value spawnNamespace(ObjClosure* closure, ObjNamespace* namespace) {
-    Thread* ctx = GC_MALLOC(sizeof(Thread));
+    Thread* ctx = allocateContext();
     if (!ctx) {
-        fprintf(stderr, "GC_MALLOC failed for Thread\n");
+        fprintf(stderr, "Not enough memory for Thread\n");
         exit(1);
     }
 
@@ -166,7 +198,7 @@ Value spawnNamespace(ObjClosure* closure, ObjNamespace* namespace) {
         exit(1);
     }
 
-    return OBJ_VAL(newThread(tid, ctx));
+    return threadValue(NULL, tid, ctx);
 
 #elif __linux__
     pthread_t* tid = malloc(sizeof(pthread_t));
@@ -181,7 +213,7 @@ Value spawnNamespace(ObjClosure* closure, ObjNamespace* namespace) {
         exit(1);
     }
 
-    return OBJ_VAL(newThread(tid, ctx));
+    return threadValue(NULL, tid, ctx);
 #else
 #error "Unsupported platform"
 #endif
@@ -198,7 +230,13 @@ Value joinNative(Thread* ctx, int argCount, Value* args) {
 
 #else
     // Wait for the POSIX thread to finish
+#ifdef PRECISE_GC
+    gcBeginBlocking();
+#endif
     pthread_join(*threadObj->thread, NULL);
+#ifdef PRECISE_GC
+    gcEndBlocking();
+#endif
     free(threadObj->thread);          // ✅ free after join
     threadObj->thread = NULL;
 #endif
@@ -217,12 +255,25 @@ Value joinInternal(Value arg) {
 
 #else
     // Wait for POSIX thread to finish execution
+#ifdef PRECISE_GC
+    gcBeginBlocking();
+#endif
     pthread_join(*threadObj->thread, NULL);
+#ifdef PRECISE_GC
+    gcEndBlocking();
+#endif
     free(threadObj->thread);            // ✅ free after join
     threadObj->thread = NULL;
 #endif
 
+#ifdef PRECISE_GC
+    // Nothing else holds an internal thread, so its stacks can go now.
+    Value result = popCtx(threadObj->ctx);
+    gcReleaseThread(threadObj);
+    return result;
+#else
     return popCtx(threadObj->ctx);
+#endif
 }
 
 static Value clockNative(Thread* ctx, int argCount, Value* args) {
@@ -259,49 +310,77 @@ static Value inputNative(Thread* ctx, int argCount, Value* args) {
     return NIL_VAL;
 }
 
-void defineStringMethods() {
-    tableSet(&vm.stringClass->methods, copyString("length", 6), OBJ_VAL(newNative(stringLengthNative)));
-    tableSet(&vm.stringClass->methods, copyString("charAt", 6), OBJ_VAL(newNative(stringCharAtNative)));
-    tableSet(&vm.stringClass->methods, copyString("toUpperCase", 11), OBJ_VAL(newNative(stringToUpperCaseNative)));
-    tableSet(&vm.stringClass->methods, copyString("toLowerCase", 11), OBJ_VAL(newNative(stringToLowerCaseNative)));
-    tableSet(&vm.stringClass->methods, copyString("substring", 9), OBJ_VAL(newNative(stringSubstringNative)));
-    tableSet(&vm.stringClass->methods, copyString("indexOf", 7), OBJ_VAL(newNative(stringIndexOfNative)));
-    tableSet(&vm.stringClass->methods, copyString("asNum", 5), OBJ_VAL(newNative(stringParseNumberNative)));
-    tableSet(&vm.stringClass->methods, copyString("asBool", 6), OBJ_VAL(newNative(stringParseBooleanNative)));
-    tableSet(&vm.stringClass->methods, copyString("charCode", 8), OBJ_VAL(newNative(stringCharCodeNative)));
-    tableSet(&vm.stringClass->methods, copyString("parse", 5), OBJ_VAL(newNative(str_parse)));
-    tableSet(&vm.stringClass->methods, copyString("split", 5), OBJ_VAL(newNative(stringSplitNative)));
-    tableSet(&vm.stringClass->methods, copyString("trim", 4), OBJ_VAL(newNative(stringTrimNative)));
-    tableSet(&vm.stringClass->methods, copyString("startsWith", 10), OBJ_VAL(newNative(stringStartsWithNative)));
-    tableSet(&vm.stringClass->methods, copyString("endsWith", 8), OBJ_VAL(newNative(stringEndsWithNative)));
-    tableSet(&vm.stringClass->methods, copyString("isDigit", 7), OBJ_VAL(newNative(str_isDigit)));
-    tableSet(&vm.stringClass->methods, copyString("iterator", 8), OBJ_VAL(newNative(stringIteratorNative)));
+// Registers every native in a descriptor table, which ends with an entry
+// whose name is NULL.
+static void defineNatives(Table* table, const NativeDef* defs) {
+    for (const NativeDef* def = defs; def->name != NULL; def++) {
+        tableSet(table, copyString(def->name, (int)strlen(def->name)), OBJ_VAL(newNativeDef(def)));
+    }
+}
+
+static const NativeDef imageMethods[] = {
+    {"getWidth", Image_getWidth, 0},
+    {"getHeight", Image_getHeight, 0},
+    {NULL},
+};
+
+static const NativeDef threadMethods[] = {
+    {"join", joinNative, NATIVE_VARIADIC},
+    {NULL},
+};
+
+// Window calls accept optional arguments and check them themselves.
+static const NativeDef windowNatives[] = {
+    {"init", window_init, NATIVE_VARIADIC},
+    {"clear", window_clear, NATIVE_VARIADIC},
+    {"drawRect", window_drawRect, NATIVE_VARIADIC},
+    {"update", window_update, NATIVE_VARIADIC},
+    {"pollEvent", window_pollEvent, NATIVE_VARIADIC},
+    {"getMousePos", window_getMousePosition, NATIVE_VARIADIC},
+    {"drawCircle", window_drawCircle, NATIVE_VARIADIC},
+    {"drawImage", window_drawImage, NATIVE_VARIADIC},
+    {"loadImage", window_loadImage, NATIVE_VARIADIC},
+    {"exit", window_exit, NATIVE_VARIADIC},
+    {"drawLine", window_drawLine, NATIVE_VARIADIC},
+    {"drawTrig", window_drawTriangle, NATIVE_VARIADIC},
+    {"drawText", window_drawText, NATIVE_VARIADIC},
+    {NULL},
+};
+
+static const NativeDef globalNatives[] = {
+    {"clock", clockNative, NATIVE_VARIADIC},
+    {"input", inputNative, NATIVE_VARIADIC},
+    {"sleep", sleepNative, NATIVE_VARIADIC},
+    {"readAll", readNative, NATIVE_VARIADIC},
+    {"spawn", spawnNative, NATIVE_VARIADIC},
+    {"join", joinNative, NATIVE_VARIADIC},
+    {"sync", syncNative, NATIVE_VARIADIC},
+    {"exit", exitNative, NATIVE_VARIADIC},
+    {"hash", hashNative, NATIVE_VARIADIC},
+    {"put", writeNative, NATIVE_VARIADIC},
+    {"putByte", writeByteNative, NATIVE_VARIADIC},
+    {"putDouble", writeDoubleNative, NATIVE_VARIADIC},
+    {"open", openNative, NATIVE_VARIADIC},
+    {"process", preprocessorNative, NATIVE_VARIADIC},
+    {"range", rangeNative, NATIVE_VARIADIC},
+    {NULL},
+};
 
+void defineStringMethods() {
+    defineNatives(&vm.stringClass->methods, stringMethods);
 }
 
 void defineListMethods() {
-    tableSet(&vm.listClass->methods, copyString("append", 6), OBJ_VAL(newNative(listAppendNative)));
-    tableSet(&vm.listClass->methods, copyString("add", 3), OBJ_VAL(newNative(listAppendNative)));
-    tableSet(&vm.listClass->methods, copyString("push", 4), OBJ_VAL(newNative(listAppendNative)));
-    tableSet(&vm.listClass->methods, copyString("length", 6), OBJ_VAL(newNative(listLengthNative)));
-    tableSet(&vm.listClass->methods, copyString("get", 3), OBJ_VAL(newNative(listGetNative)));
-    tableSet(&vm.listClass->methods, copyString("set", 3), OBJ_VAL(newNative(listSetNative)));
-    tableSet(&vm.listClass->methods, copyString("pop", 3), OBJ_VAL(newNative(listPopNative)));
-    tableSet(&vm.listClass->methods, copyString("insert", 6), OBJ_VAL(newNative(listInsertNative)));
-    tableSet(&vm.listClass->methods, copyString("clear", 5), OBJ_VAL(newNative(listClearNative)));
-    tableSet(&vm.listClass->methods, copyString("contains", 8), OBJ_VAL(newNative(listContainsNative)));
-    tableSet(&vm.listClass->methods, copyString("remove", 6), OBJ_VAL(newNative(listRemoveNative)));
-    tableSet(&vm.listClass->methods, copyString("sort", 4), OBJ_VAL(newNative(listSortNative)));
-    tableSet(&vm.listClass->methods, copyString("iterator", 8), OBJ_VAL(newNative(listIteratorNative)));
-    tableSet(&vm.listClass->methods, copyString("peek", 4), OBJ_VAL(newNative(listPeekNative)));
-
-
-    tableSet(&vm.imageClass->methods, copyString("getWidth", 8), OBJ_VAL(newNative(Image_getWidth)));
-    tableSet(&vm.imageClass->methods, copyString("getHeight", 9), OBJ_VAL(newNative(Image_getHeight)));
+    defineNatives(&vm.listClass->methods, listMethods);
+    defineNatives(&vm.imageClass->methods, imageMethods);
+}
+
+void defineRangeMethods() {
+    defineNatives(&vm.rangeClass->methods, rangeMethods);
 }
 
 void defineThreadMethods() {
-    tableSet(&vm.threadClass->methods, copyString("join", 4), OBJ_VAL(newNative(joinNative)));
+    defineNatives(&vm.threadClass->methods, threadMethods);
 }
 
 static void resetStack() {
@@ -488,10 +567,6 @@ CallFrame* VMErrorCtx(Thread *ctx, const char* format, ...) {
     pthread_exit(NULL);
 }
 
-static void defineNative(const char* name, NativeFn function) {
-    tableSet(&vm.globals, copyString(name, (int)strlen(name)), OBJ_VAL(newNative(function)));
-}
-
 void initVM() {
     initTable(&vm.strings);
     initTable(&vm.globals);
@@ -502,17 +577,21 @@ void initVM() {
 
     vm.sourceCompiler = NULL;
     vm.fileCompiler = NULL;
+    vm.mathClass = NULL;
 
     ObjString* string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
     string->length = 6;
     string->chars = "String";
     string->hash = hashString(string->chars, string->length);
+    string->interned = true;
     string->instance = NULL;
+    tableSet(&vm.strings, string, NIL_VAL);
 
     vm.stringClass = newClass(string);
     string->instance = newInstance(vm.stringClass);
     
     vm.listClass = newClass(copyString("List", 4));
+    vm.rangeClass = newClass(copyString("Range", 5));
     vm.threadClass = newClass(copyString("Thread", 6));
     vm.imageClass = newClass(copyString("Image", 5));
     vm.numberClass = newClass(copyString("Number", 6));
@@ -522,6 +601,7 @@ void initVM() {
     tableSet(&vm.globals, copyString("Bool", 4), OBJ_VAL(vm.boolClass));
     tableSet(&vm.globals, copyString("String", 6), OBJ_VAL(vm.stringClass));
     tableSet(&vm.globals, copyString("List", 4), OBJ_VAL(vm.listClass));
+    tableSet(&vm.globals, copyString("Range", 5), OBJ_VAL(vm.rangeClass));
 
     vm.initString = copyString("init", 4);
     vm.toString = copyString("toString", 8);
@@ -533,29 +613,28 @@ void initVM() {
     vm.illegalArgumentsErrorString = copyString("IllegalArgumentError", 20);
     vm.lookUpErrorString = copyString("LookUpError", 11);
     vm.formatErrorString = copyString("FormatError", 11);
+    vm.memoryErrorString = copyString("MemoryError", 11);
 
-    defineNative("clock", clockNative);
-    defineNative("input", inputNative);
-    defineNative("sleep", sleepNative);
-    defineNative("readAll",  readNative);
-    defineNative("spawn", spawnNative);
-    defineNative("join", joinNative);
-    defineNative("sync", syncNative);
-    defineNative("exit", exitNative);
-    defineNative("hash", hashNative);
-    defineNative("put", writeNative);
-    defineNative("putByte", writeByteNative);
-    defineNative("putDouble", writeDoubleNative);
-    defineNative("open", openNative);
-    defineNative("process", preprocessorNative);
+    defineNatives(&vm.globals, globalNatives);
 
+    ObjClass* gcClass = newClass(copyString("gc", 2));
+    defineNatives(&gcClass->staticMethods, gcNatives);
+    tableSet(&vm.globals, copyString("gc", 2), OBJ_VAL(gcClass));
 
     defineStringMethods();
     defineListMethods();
+    defineRangeMethods();
     defineThreadMethods();
 
     vm.repl = 0;
     vm.path = "";
+#ifdef JIT_SUPPORTED
+    vm.jit = true;
+#else
+    vm.jit = false;
+#endif
+    vm.profileHot = false;
+    vm.profileHeap = false;
 }
 
 void pushCtx(Thread *ctx, Value value) {
@@ -572,6 +651,11 @@ static Value peekCtx(Thread *ctx, int distance) {
     return ctx->stackTop[-1 - distance];
 }
 
+static inline void countCall(ObjFunction* function) {
+    uint32_t calls = __atomic_fetch_add(&function->chunk.calls, 1, __ATOMIC_RELAXED);
+    if (calls == 0 && vm.profileHot) profileFunction(function);
+}
+
 static bool callCtx(Thread *ctx, ObjClosure* closure, int argCount) {
     if (argCount != closure->function->arity) {
         runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass, "Expected %d arguments but got %d.",
@@ -584,6 +668,7 @@ static bool callCtx(Thread *ctx, ObjClosure* closure, int argCount) {
         return false;
     }
 
+    countCall(closure->function);
     CallFrame* frame = &ctx->frames[ctx->frameCount++];
     frame->closure = closure;
     frame->ip = closure->function->chunk.code;
@@ -608,6 +693,7 @@ static bool callBoundCtx(Thread *ctx, ObjClosure* closure, int argCount, ObjInst
         return false;
     }
 
+    countCall(closure->function);
     CallFrame* frame = &ctx->frames[ctx->frameCount++];
     frame->closure = closure;
     frame->ip = closure->function->chunk.code;
@@ -632,15 +718,125 @@ void printDispatcher(ObjMultiDispatch* dispatcher) {
     }
 }
 
-static bool callBoundedNativeCtx(Thread *ctx, Value callee, int argCount) {
-    NativeFn native = AS_NATIVE(callee);
-    Value result = native(ctx, argCount, ctx->stackTop - argCount);
+static const char* nativeTypeName(NativeType type) {
+    switch (type) {
+        case NATIVE_NUMBER: return "Number";
+        case NATIVE_STRING: return "String";
+        case NATIVE_LIST:   return "List";
+        default:            return "Any";
+    }
+}
+
+static bool nativeTypeMatches(NativeType type, Value value) {
+    switch (type) {
+        case NATIVE_NUMBER: return IS_NUMBER(value);
+        case NATIVE_STRING: return IS_STRING(value);
+        case NATIVE_LIST:   return IS_LIST(value);
+        default:            return true;
+    }
+}
+
+// Raises the error a native would have raised itself when a call doesn't
+// fit its declared arity and parameter types.
+static bool checkNativeArgs(Thread *ctx, const NativeDef* def, int argCount, Value* args) {
+    if (argCount != def->arity) {
+        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
+                     "No method %s for arity %d.", def->name, argCount);
+        return false;
+    }
+
+    for (int i = 0; i < argCount; i++) {
+        if (nativeTypeMatches(def->params[i], args[i])) continue;
+
+        char expected[128] = "";
+        char got[128] = "";
+        for (int j = 0; j < argCount; j++) {
+            const char* separator = j == 0 ? "" : ", ";
+            strcat(expected, separator);
+            strcat(expected, nativeTypeName(def->params[j]));
+            strcat(got, separator);
+            strcat(got, getValueTypeName(args[j]));
+        }
+        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass,
+                     "%s: expected (%s) but got (%s).", def->name, expected, got);
+        return false;
+    }
+    return true;
+}
+
+// Runs a native on the arguments at the top of the stack, checking them
+// first when it has a descriptor.
+static Value callNativeCtx(Thread *ctx, ObjNative* native, int argCount) {
+    Value* args = ctx->stackTop - argCount;
+    // Errors raised outside natives leave the flag set, so only one raised
+    // by this call counts.
+    ctx->hasError = false;
+    ctx->returnCount = 0;
+
+    const NativeDef* def = native->def;
+    if (def == NULL || def->arity == NATIVE_VARIADIC) {
+        return native->function(ctx, argCount, args);
+    }
+    if (!checkNativeArgs(ctx, def, argCount, args)) return NIL_VAL;
+
+    if (def->number != NULL) {
+        double numbers[NATIVE_MAX_PARAMS];
+        for (int i = 0; i < argCount; i++) numbers[i] = AS_NUMBER(args[i]);
+        return NUMBER_VAL(def->number(numbers));
+    }
+    return def->function(ctx, argCount, args);
+}
+
+// Moves the `count` values at the top of the stack down to `base`, where
+// the callee was. If the caller goes on to unpack exactly that many, as in
+// `var a, b = f();`, they stay there and the OP_UNPACK is skipped.
+// Anywhere else they are collected into a list.
+static void returnValuesTo(Thread* ctx, CallFrame* caller, Value* base, int count) {
+    Value* values = ctx->stackTop - count;
+    if (caller != NULL && caller->ip[0] == OP_UNPACK && caller->ip[1] == count) {
+        memmove(base, values, sizeof(Value) * count);
+        ctx->stackTop = base + count;
+        caller->ip += 2;
+        return;
+    }
+
+    ObjList* list = newList();
+    pushCtx(ctx, OBJ_VAL(list));
+    for (int i = 0; i < count; i++) {
+        writeValueArray(&list->elements, values[i]);
+    }
+    ctx->stackTop = base;
+    pushCtx(ctx, OBJ_VAL(list));
+}
+
+// Lets a native return several values, at most NATIVE_MAX_RETURNS. Its
+// own return value is ignored.
+Value returnValuesCtx(Thread* ctx, int count, Value* values) {
+    memcpy(ctx->returnValues, values, sizeof(Value) * count);
+    ctx->returnCount = count;
+    return NIL_VAL;
+}
+
+// Calls a native method on the receiver below its arguments, replacing
+// both with the result.
+static bool callBoundedNativeCtx(Thread *ctx, ObjNative* native, int argCount) {
+    Value result = callNativeCtx(ctx, native, argCount);
     if(ctx->hasError){
+        // The stack was already reset to the handler's, error on top.
         ctx->hasError = false;
-        result = popCtx(ctx);
-        pushCtx(ctx, result);
+        return true;
+    }
+
+    Value* base = ctx->stackTop - argCount - 1;
+    if (ctx->returnCount > 0) {
+        int count = ctx->returnCount;
+        ctx->returnCount = 0;
+        for (int i = 0; i < count; i++) pushCtx(ctx, ctx->returnValues[i]);
+        CallFrame* caller = ctx->frameCount > 0 ? &ctx->frames[ctx->frameCount - 1] : NULL;
+        returnValuesTo(ctx, caller, base, count);
+        return true;
     }
-    ctx->stackTop = ctx->stackTop - argCount;
+    ctx->stackTop = base;
     pushCtx(ctx, result);
     return true;
 }
@@ -664,25 +860,30 @@ static bool callValueCtx(Thread *ctx, Value callee, int argCount) {
         switch (OBJ_TYPE(callee)) {
             case OBJ_CLOSURE:
                 return callCtx(ctx, AS_CLOSURE(callee), argCount);
-            case OBJ_NATIVE: {
-                NativeFn native = AS_NATIVE(callee);
-                Value result = native(ctx, argCount, ctx->stackTop - argCount);
-                if(ctx->hasError){
-                    ctx->hasError = false;
-                    result = popCtx(ctx);
-                    pushCtx(ctx, result);
-                }
-                ctx->stackTop = ctx->stackTop - argCount - 1;
-                pushCtx(ctx, result);
-                return true;
-            }
+            case OBJ_NATIVE:
+                return callBoundedNativeCtx(ctx, AS_NATIVE(callee), argCount);
             case OBJ_CLASS: {
                 ObjClass* klass = AS_CLASS(callee);
                 Value initializer;
 
+                // A struct is built straight from one argument per field.
+                if (klass->isStruct) {
+                    if (argCount != klass->fieldCount) {
+                        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass, "Struct '%s' has %d fields but got %d arguments.",
+                                        klass->name->chars, klass->fieldCount, argCount);
+                        return false;
+                    }
+                    ObjInstance* instance = newInstance(klass);
+                    memcpy(instance->values, ctx->stackTop - argCount, sizeof(Value) * argCount);
+                    ctx->stackTop -= argCount;
+                    ctx->stackTop[-1] = OBJ_VAL(instance);
+                    return true;
+                }
+
                 if (tableGet(&klass->methods, vm.initString, &initializer)) {
 
                     AS_BOUND_METHOD(initializer)->receiver = OBJ_VAL(newInstance(klass));
+                    WRITE_BARRIER(AS_BOUND_METHOD(initializer), AS_BOUND_METHOD(initializer)->receiver);
                     if (AS_BOUND_METHOD(initializer)->method[argCount] == NULL) {
                         runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass, "No matching initializer found with %d arguments.", argCount);
                         return false;
@@ -709,13 +910,8 @@ static bool callValueCtx(Thread *ctx, Value callee, int argCount) {
             }
             case OBJ_BOUND_NATIVE: {
                 ObjBoundNative* bound = AS_BOUND_NATIVE(callee);
-                NativeFn native = *bound->method;
                 ctx->stackTop[-argCount - 1] = bound->receiver;
-
-                Value result = native(ctx, argCount, ctx->stackTop - argCount);
-                ctx->stackTop = ctx->stackTop - argCount;
-                pushCtx(ctx, result);
-                return true;
+                return callBoundedNativeCtx(ctx, bound->native, argCount);
             }
             case OBJ_MULTI_DISPATCH:{
                 ObjMultiDispatch* md = AS_MULTI_DISPATCH(callee);
@@ -764,10 +960,78 @@ static void closeUpvaluesCtx(Thread *ctx, Value* last) {
         ObjUpvalue* upvalue = ctx->openUpvalues;
         upvalue->closed = *upvalue->location;
         upvalue->location = &upvalue->closed;
+        WRITE_BARRIER(upvalue, upvalue->closed);
         ctx->openUpvalues = upvalue->next;
     }
 }
 
+// Finishes a tail call that pushed a frame on top of the caller at
+// frameCount. The callee's slots slide down over the caller's and its frame
+// takes the caller's place, so tail recursion runs in constant stack depth.
+// A caller inside a try block keeps its frame to catch the error.
+static void tailCallCtx(Thread *ctx, int frameCount) {
+    if (ctx->frameCount != frameCount + 1) return;
+
+    CallFrame* caller = &ctx->frames[frameCount - 1];
+    CallFrame* callee = &ctx->frames[frameCount];
+    if (caller->hasTry[caller->tryTop] != -1) return;
+
+    closeUpvaluesCtx(ctx, caller->slots);
+
+    Value* slots = caller->slots;
+    int count = (int)(ctx->stackTop - callee->slots);
+    memmove(slots, callee->slots, sizeof(Value) * count);
+    *caller = *callee;
+    caller->slots = slots;
+    ctx->stackTop = slots + count;
+    ctx->frameCount--;
+}
+
+// OP_INLINE_GUARD: whether the callee below the arguments still runs the
+// inlined body. Saved bytecode keeps one copy of each function, so the
+// function constant the compiler recorded is the one the closure runs.
+static bool inlineGuardCtx(Thread *ctx, ObjFunction* expected, int argCount) {
+    Value callee = peekCtx(ctx, argCount);
+    ObjClosure* closure = NULL;
+    if (IS_CLOSURE(callee)) {
+        closure = AS_CLOSURE(callee);
+    } else if (IS_MULTI_DISPATCH(callee) && argCount < 10) {
+        closure = AS_MULTI_DISPATCH(callee)->closures[argCount];
+    }
+    return closure != NULL && closure->function == expected;
+}
+
+// OP_INLINE_INVOKE_GUARD: the same for a method looked up on an instance.
+static bool inlineInvokeGuardCtx(Thread *ctx, ObjString* name, ObjFunction* expected, int argCount) {
+    Value receiver = peekCtx(ctx, argCount);
+    if (!IS_INSTANCE(receiver) || argCount >= 10) return false;
+
+    ObjInstance* instance = AS_INSTANCE(receiver);
+    Value method;
+    if (getField(instance, name, &method)) return false;
+    if (!tableGet(&instance->klass->methods, name, &method) || !IS_BOUND_METHOD(method)) return false;
+
+    ObjClosure* closure = AS_BOUND_METHOD(method)->method[argCount];
+    return closure != NULL && closure->function == expected;
+}
+
+// OP_MATH: computes a Math static without invoking it, as long as the
+// receiver is still the built-in Math class and the arguments are numbers.
+static bool mathCtx(Thread *ctx, int id, int argCount) {
+    Value receiver = peekCtx(ctx, argCount);
+    if (vm.mathClass == NULL || !IS_CLASS(receiver) || AS_CLASS(receiver) != vm.mathClass) return false;
+
+    Value* args = ctx->stackTop - argCount;
+    for (int i = 0; i < argCount; i++) {
+        if (!IS_NUMBER(args[i])) return false;
+    }
+
+    double result = mathIntrinsic(id, args);
+    ctx->stackTop -= argCount + 1;
+    pushCtx(ctx, NUMBER_VAL(result));
+    return true;
+}
+
 static bool isFalsey(Value value) {
     return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value)) || (IS_NUMBER(value) && AS_NUMBER(value) == 0.0);
 }
@@ -777,7 +1041,7 @@ static void concatenateCtx(Thread *ctx) {
     ObjString* a = AS_STRING(popCtx(ctx));
 
     int length = a->length + b->length;
-    char* chars = ALLOCATE(char, length + 1);
+    char* chars = ALLOCATE_ATOMIC(char, length + 1);
     memcpy(chars, a->chars, a->length);
     memcpy(chars + a->length, b->chars, b->length);
     chars[length] = '\0';
@@ -789,17 +1053,31 @@ static void concatenateCtx(Thread *ctx) {
 void multiDispatchAdd(ObjMultiDispatch* dispatch, ObjClosure* closure) {
     int arity = closure->function->arity;
     dispatch->closures[arity] = closure;
+    WRITE_BARRIER_OBJ(dispatch, closure);
 }
 
 void multiBoundAdd(ObjBoundMethod* dispatch, ObjClosure* closure) {
     int arity = closure->function->arity;
     dispatch->method[arity] = closure;
+    WRITE_BARRIER_OBJ(dispatch, closure);
+}
+
+// Operator methods are named by their symbol, in OperatorKind order.
+static const char operatorSymbols[OPERATOR_COUNT] = {'+', '-', '*', '/', '%', '\\'};
+
+static int operatorKind(ObjString* name) {
+    if (name->length != 1) return -1;
+    for (int i = 0; i < OPERATOR_COUNT; i++) {
+        if (name->chars[0] == operatorSymbols[i]) return i;
+    }
+    return -1;
 }
 
 static void defineMethodCtx(Thread *ctx, ObjString* name) {
     Value method = peekCtx(ctx, 0);
     ObjClass* klass = AS_CLASS(peekCtx(ctx, 1));
     AS_CLOSURE(method)->klass = klass;
+    WRITE_BARRIER_OBJ(AS_CLOSURE(method), klass);
 
     Value dispatcher;
     if (tableGet(&klass->methods, name, &dispatcher)) {
@@ -810,10 +1088,40 @@ static void defineMethodCtx(Thread *ctx, ObjString* name) {
         ObjBoundMethod* md = newBoundMethod(dispatcher, AS_CLOSURE(method)->function->name);
         multiBoundAdd(md, AS_CLOSURE(method));
         tableSet(&klass->methods, name, OBJ_VAL(md));
+
+        int kind = operatorKind(name);
+        if (kind != -1) klass->operators[kind] = md;
+        WRITE_BARRIER_OBJ(klass, md);
     }
     popCtx(ctx);
 }
 
+// Calls the left operand's overload of an arithmetic operator. Both
+// operands are instances of the same class.
+static bool invokeOperatorCtx(Thread *ctx, OperatorKind kind) {
+    ObjClass* klass = AS_INSTANCE(peekCtx(ctx, 1))->klass;
+    if (klass != AS_INSTANCE(peekCtx(ctx, 0))->klass) {
+        runtimeErrorCtx(ctx, vm.typeErrorClass, "Cannot perform operation for instances of different classes.");
+        return false;
+    }
+
+    ObjBoundMethod* method = klass->operators[kind];
+    if (method == NULL) {
+        runtimeErrorCtx(ctx, vm.typeErrorClass, "No overload of '%c' for instances of class '%s'.",
+                        operatorSymbols[kind], klass->name->chars);
+        return false;
+    }
+    // The left operand already sits where a call puts the receiver. The
+    // dispatcher is shared by every thread, so it is called without
+    // binding it to the operand.
+    ObjClosure* closure = method->method[1];
+    if (closure == NULL) {
+        runtimeErrorCtx(ctx, vm.illegalArgumentsErrorClass, "No method with arity %d found.", 1);
+        return false;
+    }
+    return callBoundCtx(ctx, closure, 1, AS_INSTANCE(peekCtx(ctx, 1)));
+}
+
 static bool bindMethodCtx(Thread *ctx, ObjClass* klass, ObjString* name) {
     Value method;
     if (!tableGet(&klass->methods, name, &method)) {
@@ -821,7 +1129,7 @@ static bool bindMethodCtx(Thread *ctx, ObjClass* klass, ObjString* name) {
     }
 
     if(IS_NATIVE(method)){
-        ObjBoundNative* bound = newBoundNative(&AS_NATIVE(method));
+        ObjBoundNative* bound = newBoundNative(AS_NATIVE(method));
         bound->receiver = peekCtx(ctx, 0);
         popCtx(ctx);
         pushCtx(ctx, OBJ_VAL(bound));
@@ -832,12 +1140,14 @@ static bool bindMethodCtx(Thread *ctx, ObjClass* klass, ObjString* name) {
     ObjBoundMethod* bound = AS_BOUND_METHOD(method);
     ObjInstance* instance = NULL;
     if (IS_STRING(peekCtx(ctx, 0))) instance = AS_STRING(peekCtx(ctx, 0))->instance;
-    if (IS_LIST(peekCtx(ctx, 0))) instance = AS_LIST(peekCtx(ctx, 0))->instance;
+    if (IS_LIST(peekCtx(ctx, 0))) instance = ((ObjList*)AS_OBJ(peekCtx(ctx, 0)))->instance;
+    if (IS_RANGE(peekCtx(ctx, 0))) instance = AS_RANGE(peekCtx(ctx, 0))->instance;
     if (IS_THREAD(peekCtx(ctx, 0))) instance = AS_THREAD(peekCtx(ctx, 0))->instance;
     if (IS_IMAGE(peekCtx(ctx, 0))) instance = AS_IMAGE(peekCtx(ctx, 0))->instance;
     if(instance == NULL) instance = AS_INSTANCE(peekCtx(ctx, 0));
 
-    bound->receiver = OBJ_VAL(instance);;
+    bound->receiver = OBJ_VAL(instance);
+    WRITE_BARRIER(bound, bound->receiver);
 
     popCtx(ctx);
     pushCtx(ctx, OBJ_VAL(bound));
@@ -850,25 +1160,18 @@ static bool invokeFromClassCtx(Thread *ctx, ObjClass* klass, ObjString* name, in
 
     if (tableGet(&klass->methods, name, &method)) {
         if(IS_NATIVE(method)){
-            bool res = callBoundedNativeCtx(ctx, method, argCount);
-            Value result = popCtx(ctx);
-            popCtx(ctx);
-            pushCtx(ctx, result);
-            return res;
+            return callBoundedNativeCtx(ctx, AS_NATIVE(method), argCount);
         }
             
         AS_BOUND_METHOD(method)->receiver = peekCtx(ctx, argCount);
+        WRITE_BARRIER(AS_BOUND_METHOD(method), AS_BOUND_METHOD(method)->receiver);
         bool yes = callValueCtx(ctx, method, argCount);
         return yes;
     }
 
     if (tableGet(&klass->staticMethods, name, &method)) {
         if (IS_NATIVE(method)) {
-            bool res = callBoundedNativeCtx(ctx, method, argCount);
-            Value result = popCtx(ctx);
-            popCtx(ctx);
-            pushCtx(ctx, result);
-            return res;
+            return callBoundedNativeCtx(ctx, AS_NATIVE(method), argCount);
         }
         bool res = callValueCtx(ctx, method, argCount);
         Value result = popCtx(ctx);
@@ -934,11 +1237,7 @@ static bool invokeCtx(Thread *ctx, ObjString* name, int argCount, CallFrame* fra
 
         if (tableGet(&klass->staticMethods, name, &value)) {
             if (IS_NATIVE(value)) {
-                bool res = callBoundedNativeCtx(ctx, value, argCount);
-                Value result = popCtx(ctx);
-                popCtx(ctx);
-                pushCtx(ctx, result);
-                return res;
+                return callBoundedNativeCtx(ctx, AS_NATIVE(value), argCount);
             }
 
             bool res = callValueCtx(ctx, value, argCount);
@@ -959,7 +1258,8 @@ static bool invokeCtx(Thread *ctx, ObjString* name, int argCount, CallFrame* fra
 
     if (IS_STRING(receiver)) instance = AS_STRING(receiver)->instance;
     if (IS_IMAGE(receiver)) instance = AS_IMAGE(receiver)->instance;
-    if (IS_LIST(receiver)) instance = AS_LIST(receiver)->instance;
+    if (IS_LIST(receiver)) instance = ((ObjList*)AS_OBJ(receiver))->instance;
+    if (IS_RANGE(receiver)) instance = AS_RANGE(receiver)->instance;
     if (IS_THREAD(receiver)) instance = AS_THREAD(receiver)->instance;
     if (IS_INSTANCE(receiver)) instance = AS_INSTANCE(receiver);
 
@@ -972,7 +1272,7 @@ static bool invokeCtx(Thread *ctx, ObjString* name, int argCount, CallFrame* fra
         runtimeErrorCtx(ctx, vm.accessErrorClass, "Cannot access private field of a different class.");
 
     Value value;
-    if (tableGet(&instance->fields, name, &value)) {
+    if (getField(instance, name, &value)) {
         ctx->stackTop[-argCount - 1] = value;
         return callValueCtx(ctx, value, argCount);
     }
@@ -1006,25 +1306,330 @@ bool hasAncestor(ObjInstance* instance, ObjClass* ancestor) {
     return false;
 }
 
+// String keys are rejected by identity or cached hash before comparing characters.
+static inline bool switchKeyMatches(Value key, Value value) {
+    if (IS_STRING(key) && IS_STRING(value)) return stringsEqual(AS_STRING(key), AS_STRING(value));
+    return valuesEqual(key, value);
+}
+
 Value readConst(CallFrame* frame){
     frame->ip += 2;
     return frame->closure->function->chunk.constants.values[(uint16_t)((frame->ip[-2] << 8) | frame->ip[-1])];
 }
 
+// Pushes the next element of a list, string, number or range in a for-in
+// loop. The sequence sits in `slot` and the element index right after it.
+static inline IterStep iterateCtx(Thread *ctx, Value* slots, int slot) {
+    Value sequence = slots[slot];
+    Value* cursor = &slots[slot + 1];
+    int index = IS_NUMBER(*cursor) ? (int)AS_NUMBER(*cursor) : 0;
+
+    if (IS_LIST(sequence)) {
+        ValueArray* elements = &AS_LIST(sequence)->elements;
+        if (index >= elements->count) return ITER_DONE;
+        pushCtx(ctx, elements->values[index]);
+    } else if (IS_STRING(sequence)) {
+        ObjString* string = AS_STRING(sequence);
+        if (index >= string->length) return ITER_DONE;
+        pushCtx(ctx, OBJ_VAL(charString(string->chars[index])));
+    } else if (IS_NUMBER(sequence)) {
+        if (index >= AS_NUMBER(sequence)) return ITER_DONE;
+        pushCtx(ctx, NUMBER_VAL(index));
+    } else if (IS_RANGE(sequence)) {
+        ObjRange* range = AS_RANGE(sequence);
+        if (index >= range->length) return ITER_DONE;
+        pushCtx(ctx, NUMBER_VAL(range->start + index * range->step));
+    } else {
+        return ITER_CUSTOM;
+    }
+
+    *cursor = NUMBER_VAL(index + 1);
+    return ITER_NEXT;
+}
+
+// ---------------------
+// JIT helpers
+// ---------------------
+// These cover the common case of an instruction and return false for
+// anything else, leaving the stack as it was so the interpreter can run
+// the full version and raise its errors.
+bool jitGetGlobal(Thread* ctx, CallFrame* frame, ObjString* name) {
+    Value value;
+    if (!jitLoadGlobal(frame, name, &value)) return false;
+    pushCtx(ctx, value);
+    return true;
+}
+
+bool jitLoadGlobal(CallFrame* frame, ObjString* name, Value* out) {
+    if (frame->receiver != NULL) return false;
+    return tableGet(&vm.globals, name, out);
+}
+
+bool jitSetGlobal(Thread* ctx, CallFrame* frame, ObjString* name) {
+    Value value;
+    if (!jitLoadGlobal(frame, name, &value)) return false;
+    tableSet(&vm.globals, name, peekCtx(ctx, 0));
+    return true;
+}
+
+bool jitGetProperty(Thread* ctx, CallFrame* frame, ObjString* name) {
+    if (!IS_INSTANCE(peekCtx(ctx, 0))) return false;
+    ObjInstance* instance = AS_INSTANCE(peekCtx(ctx, 0));
+    if (isPrivate(name) && instance->klass != frame->klass) return false;
+
+    Value value;
+    if (!getField(instance, name, &value)) return false;
+    ctx->stackTop[-1] = value;
+    return true;
+}
+
+bool jitSetProperty(Thread* ctx, ObjString* name) {
+    if (!IS_INSTANCE(peekCtx(ctx, 1)) || IS_STRUCT(peekCtx(ctx, 1))) return false;
+
+    Value value = popCtx(ctx);
+    tableSet(&AS_INSTANCE(popCtx(ctx))->fields, name, value);
+    pushCtx(ctx, value);
+    return true;
+}
+
+// OP_SINK keeps a struct's fields in the slots above the callee instead of
+// building it. That is only right while the callee is still the struct the
+// compiler saw, so it pushes true then, and leaves the call after it to
+// build the value otherwise.
+static bool sinkCtx(Thread* ctx, ObjString* name, int count) {
+    Value callee = peekCtx(ctx, count);
+    if (!IS_CLASS(callee)) return false;
+    ObjClass* klass = AS_CLASS(callee);
+    if (!klass->isStruct || klass->name != name || klass->fieldCount != count) return false;
+    pushCtx(ctx, BOOL_VAL(true));
+    return true;
+}
+
+// Builds a sunk struct where it escapes, from the class and fields OP_SINK
+// kept in the slots from `sunk`.
+static void buildSunkCtx(Thread* ctx, Value* sunk, int count) {
+    ObjInstance* instance = newInstance(AS_CLASS(sunk[0]));
+    memcpy(instance->values, sunk + 1, sizeof(Value) * count);
+    pushCtx(ctx, OBJ_VAL(instance));
+}
+
+bool jitSink(Thread* ctx, ObjString* name, int count) {
+    return sinkCtx(ctx, name, count);
+}
+
+void jitBuildSunk(Thread* ctx, CallFrame* frame, int slot, int count) {
+    buildSunkCtx(ctx, &frame->slots[slot], count);
+}
+
+// Reads one field of a packed list's element, as list[i].x does, without
+// boxing the element. False leaves it to an ordinary index and property.
+static bool getPackedField(Value list, Value index, ObjString* name, Value* value) {
+    if (!IS_LIST(list) || !IS_NUMBER(index) || isPrivate(name)) return false;
+    PackedStructs* packed = packedStructs((ObjList*)AS_OBJ(list));
+    if (packed == NULL) return false;
+    int i = (int)AS_NUMBER(index);
+    if (i < 0 || i >= packedLength(packed)) return false;
+
+    ObjClass* klass = packed->klass;
+    for (int field = 0; field < klass->fieldCount; field++) {
+        if (klass->fieldNames[field] == name) {
+            *value = packed->fields.values[i * klass->fieldCount + field];
+            return true;
+        }
+    }
+    return false;
+}
+
+IndexRead jitGetIndexField(Thread* ctx, ObjString* name) {
+    Value value;
+    if (getPackedField(peekCtx(ctx, 1), peekCtx(ctx, 0), name, &value)) {
+        ctx->stackTop -= 2;
+        pushCtx(ctx, value);
+        return INDEX_FIELD;
+    }
+    return jitGetIndex(ctx) ? INDEX_ELEMENT : INDEX_BAILOUT;
+}
 
+bool jitGetIndex(Thread* ctx) {
+    Value index = peekCtx(ctx, 0);
+    Value list = peekCtx(ctx, 1);
+    if (!IS_NUMBER(index)) return false;
+    int i = (int)AS_NUMBER(index);
+
+    Value value;
+    if (IS_LIST(list)) {
+        if (i < 0 || i >= AS_LIST(list)->elements.count) return false;
+        value = AS_LIST(list)->elements.values[i];
+    } else if (IS_RANGE(list)) {
+        ObjRange* range = AS_RANGE(list);
+        if (i < 0 || i >= range->length) return false;
+        value = NUMBER_VAL(range->start + i * range->step);
+    } else {
+        return false;
+    }
+
+    ctx->stackTop -= 2;
+    pushCtx(ctx, value);
+    return true;
+}
+
+bool jitSetIndex(Thread* ctx) {
+    Value value = peekCtx(ctx, 0);
+    Value index = peekCtx(ctx, 1);
+    Value list = peekCtx(ctx, 2);
+    if (!IS_LIST(list) || !IS_NUMBER(index)) return false;
+
+    int i = (int)AS_NUMBER(index);
+    if (!setPacked((ObjList*)AS_OBJ(list), i, value)) {
+        ObjList* objList = AS_LIST(list);
+        if (i < 0 || i >= objList->elements.count) return false;
+
+        objList->elements.values[i] = value;
+        ARRAY_BARRIER(&objList->elements, value);
+    }
+    ctx->stackTop -= 3;
+    pushCtx(ctx, value);
+    return true;
+}
+
+void jitEqual(Thread* ctx) {
+    Value b = popCtx(ctx);
+    Value a = popCtx(ctx);
+    pushCtx(ctx, BOOL_VAL(valuesEqual(a, b)));
+}
+
+void jitList(Thread* ctx, int count) {
+    ObjList* list = newList();
+    pushCtx(ctx, OBJ_VAL(list));
+
+    for (int i = count; i >= 1; i--) {
+        writeValueArray(&list->elements, peekCtx(ctx, i));
+    }
+    ctx->stackTop -= count + 1;
+    pushCtx(ctx, OBJ_VAL(list));
+}
+
+void jitCloseUpvalue(Thread* ctx) {
+    closeUpvaluesCtx(ctx, ctx->stackTop - 1);
+    popCtx(ctx);
+}
+
+IterStep jitForIter(Thread* ctx, CallFrame* frame, int slot) {
+    return iterateCtx(ctx, frame->slots, slot);
+}
+
+// Returns from a frame unless it is the last one or the result is an
+// error, which the interpreter formats on the way out.
+bool jitReturn(Thread* ctx, CallFrame* frame) {
+    Value result = peekCtx(ctx, 0);
+    if (ctx->frameCount == 1) return false;
+    if (IS_INSTANCE(result) && hasAncestor(AS_INSTANCE(result), vm.errorClass)) return false;
+
+    closeUpvaluesCtx(ctx, frame->slots);
+    ctx->frameCount--;
+    ctx->stackTop = frame->slots;
+    pushCtx(ctx, result);
+    return true;
+}
+
+bool jitReturnValues(Thread* ctx, CallFrame* frame, int count) {
+    if (ctx->frameCount == 1) return false;
+
+    closeUpvaluesCtx(ctx, frame->slots);
+    ctx->frameCount--;
+    returnValuesTo(ctx, &ctx->frames[ctx->frameCount - 1], frame->slots, count);
+    return true;
+}
+
+// Calls return true while native code can carry on in the same frame:
+// a native function ran and nothing was thrown.
+bool jitCall(Thread* ctx, CallFrame* frame, int argCount) {
+    int frameCount = ctx->frameCount;
+    uint8_t* ip = frame->ip;
+    callValueCtx(ctx, peekCtx(ctx, argCount), argCount);
+    return ctx->frameCount == frameCount && frame->ip == ip;
+}
+
+bool jitInvoke(Thread* ctx, CallFrame* frame, ObjString* name, int argCount) {
+    int frameCount = ctx->frameCount;
+    uint8_t* ip = frame->ip;
+    invokeCtx(ctx, name, argCount, frame);
+    return ctx->frameCount == frameCount && frame->ip == ip;
+}
+
+bool jitTailCall(Thread* ctx, CallFrame* frame, int argCount) {
+    int frameCount = ctx->frameCount;
+    uint8_t* ip = frame->ip;
+    if (callValueCtx(ctx, peekCtx(ctx, argCount), argCount)) tailCallCtx(ctx, frameCount);
+    return ctx->frameCount == frameCount && frame->ip == ip;
+}
+
+bool jitTailInvoke(Thread* ctx, CallFrame* frame, ObjString* name, int argCount) {
+    int frameCount = ctx->frameCount;
+    uint8_t* ip = frame->ip;
+    if (invokeCtx(ctx, name, argCount, frame)) tailCallCtx(ctx, frameCount);
+    return ctx->frameCount == frameCount && frame->ip == ip;
+}
+
+bool jitInlineGuard(Thread* ctx, ObjFunction* expected, int argCount) {
+    return inlineGuardCtx(ctx, expected, argCount);
+}
+
+bool jitInlineInvokeGuard(Thread* ctx, ObjString* name, ObjFunction* expected, int argCount) {
+    return inlineInvokeGuardCtx(ctx, name, expected, argCount);
+}
+
+bool jitMath(Thread* ctx, int id, int argCount) {
+    return mathCtx(ctx, id, argCount);
+}
+
+bool jitSuperInvoke(Thread* ctx, CallFrame* frame, ObjString* name, int argCount) {
+    int frameCount = ctx->frameCount;
+    uint8_t* ip = frame->ip;
+    ObjClass* superclass = AS_CLASS(popCtx(ctx));
+    invokeFromClassCtx(ctx, superclass, name, argCount);
+    return ctx->frameCount == frameCount && frame->ip == ip;
+}
+
+#ifdef PRECISE_GC
+// Native OP_SET_UPVALUE stores inline and calls this for the barrier.
+void jitUpvalueBarrier(CallFrame* frame, int slot) {
+    ObjUpvalue* upvalue = frame->closure->upvalues[slot];
+    WRITE_BARRIER(upvalue, *upvalue->location);
+}
+#endif
+
+
+// Raises MemoryError if the thread is still over a quota, after any
+// collection that could have brought it back under.
+static CallFrame* checkQuota(Thread* ctx, CallFrame* frame) {
+    ctx->quotaCheck = false;
+    char message[128];
+    if (!gcOverQuota(message, sizeof(message))) return frame;
+    return runtimeErrorCtx(ctx, vm.memoryErrorClass, "%s", message);
+}
+
+#ifndef PRECISE_GC
 #include <gc/gc.h>
+#endif
 #ifdef _WIN32
 static DWORD WINAPI runCtx(LPVOID context) {
 #else
 static void* runCtx(void *context) {
 #endif
+#ifdef PRECISE_GC
+    gcThreadStart((Thread*)context);
+#else
     if (GC_thread_is_registered() == 0) {
         if (GC_register_my_thread(NULL) != 0) {
             fprintf(stderr, "Failed to register GC thread\n");
             pthread_exit(NULL);
         }
     }
-    
+    useObjectCache((Thread*)context);
+#endif
+    gcBindThread((Thread*)context);
+
     Thread* ctx = (Thread*)context;
     ctx->finished = false;
     register CallFrame* frame = &ctx->frames[ctx->frameCount - 1];
@@ -1054,6 +1659,34 @@ static void* runCtx(void *context) {
 
     #define READ_STRING() AS_STRING(READ_CONSTANT())
 
+    // Jumps back and counts the loop. A hot loop switches to compiled code
+    // right away instead of waiting for the next call.
+    #define BACKEDGE(distance) \
+        do { \
+            Chunk* chunk = &frame->closure->function->chunk; \
+            uint32_t count = countBackedge(chunk, (int)(frame->ip - chunk->code)); \
+            frame->ip -= (distance); \
+            GC_SAFEPOINT(); \
+            if (ctx->quotaCheck) { \
+                frame = checkQuota(ctx, frame); \
+            } else if (count >= JIT_THRESHOLD && vm.jit) { \
+                jitEnterLoop(ctx); \
+                frame = &ctx->frames[ctx->frameCount - 1]; \
+            } \
+        } while (false)
+
+    // Hands the current frame to compiled code if it has become hot.
+    #define JIT_ENTER() \
+        do { \
+            GC_SAFEPOINT(); \
+            if (ctx->quotaCheck) { \
+                frame = checkQuota(ctx, frame); \
+            } else if (vm.jit) { \
+                jitRun(ctx); \
+                frame = &ctx->frames[ctx->frameCount - 1]; \
+            } \
+        } while (false)
+
         for (;;) {
     #ifdef DEBUG_TRACE_EXECUTION
             printf("\x1b[31m          ");
@@ -1100,6 +1733,7 @@ static void* runCtx(void *context) {
                         }
                     }
                 }
+                JIT_ENTER();
                 break;
             }
             case OP_CONSTANT: {
@@ -1121,24 +1755,8 @@ static void* runCtx(void *context) {
 
                 // Instance operator overloading
                 if (IS_INSTANCE(left) && IS_INSTANCE(right)) {
-                    ObjInstance* a = AS_INSTANCE(left);
-                    ObjInstance* b = AS_INSTANCE(right);
-
-                    if (a->klass != b->klass) {
-                        runtimeErrorCtx(ctx, vm.typeErrorClass,
-                            "Cannot perform operation for instances of different classes.");
-                        break;
-                    }
-
-                    Value method;
-                    if (tableGet(&a->klass->methods, copyString("+", 1), &method)) {
-                        invokeCtx(ctx, copyString("+", 1), 1, frame);
-                        frame = &ctx->frames[ctx->frameCount - 1];
-                        break;
-                    }
-
-                    runtimeErrorCtx(ctx, vm.typeErrorClass,
-                        "No overload of '+' for instances of class '%s'.", a->klass->name->chars);
+                    invokeOperatorCtx(ctx, OPERATOR_ADD);
+                    frame = &ctx->frames[ctx->frameCount - 1];
                     break;
                 }
 
@@ -1161,12 +1779,11 @@ static void* runCtx(void *context) {
 
                     char buffer[32];
                     int len = snprintf(buffer, sizeof(buffer), "%.14g", num);
-                    ObjString* b = newString(buffer, len);
 
-                    int length = a->length + b->length;
-                    char* chars = ALLOCATE(char, length + 1);
+                    int length = a->length + len;
+                    char* chars = ALLOCATE_ATOMIC(char, length + 1);
                     memcpy(chars, a->chars, a->length);
-                    memcpy(chars + a->length, b->chars, b->length);
+                    memcpy(chars + a->length, buffer, len);
                     chars[length] = '\0';
 
                     ObjString* result = newString(chars, length);
@@ -1178,13 +1795,12 @@ static void* runCtx(void *context) {
                     double num = AS_NUMBER(left);
                     char buffer[32];
                     int len = snprintf(buffer, sizeof(buffer), "%.14g", num);
-                    ObjString* a = newString(buffer, len);
                     ObjString* b = AS_STRING(right);
 
-                    int length = a->length + b->length;
-                    char* chars = ALLOCATE(char, length + 1);
-                    memcpy(chars, a->chars, a->length);
-                    memcpy(chars + a->length, b->chars, b->length);
+                    int length = len + b->length;
+                    char* chars = ALLOCATE_ATOMIC(char, length + 1);
+                    memcpy(chars, buffer, len);
+                    memcpy(chars + len, b->chars, b->length);
                     chars[length] = '\0';
 
                     ObjString* result = newString(chars, length);
@@ -1200,7 +1816,7 @@ static void* runCtx(void *context) {
                         : "nil";
 
                     int length = a->length + (int)strlen(suffix);
-                    char* chars = ALLOCATE(char, length + 1);
+                    char* chars = ALLOCATE_ATOMIC(char, length + 1);
                     memcpy(chars, a->chars, a->length);
                     memcpy(chars + a->length, suffix, strlen(suffix));
                     chars[length] = '\0';
@@ -1217,7 +1833,7 @@ static void* runCtx(void *context) {
 
                     ObjString* b = AS_STRING(right);
                     int length = (int)strlen(prefix) + b->length;
-                    char* chars = ALLOCATE(char, length + 1);
+                    char* chars = ALLOCATE_ATOMIC(char, length + 1);
                     memcpy(chars, prefix, strlen(prefix));
                     memcpy(chars + strlen(prefix), b->chars, b->length);
                     chars[length] = '\0';
@@ -1235,86 +1851,30 @@ static void* runCtx(void *context) {
             }
             case OP_SUBTRACT:
                 if (IS_INSTANCE(peekCtx(ctx, 0)) && IS_INSTANCE(peekCtx(ctx, 1))) {
-                    ObjInstance* a = AS_INSTANCE(peekCtx(ctx, 0));
-                    ObjInstance* b = AS_INSTANCE(peekCtx(ctx, 1));
-
-                    if (a->klass != b->klass) {
-                        runtimeErrorCtx(ctx, vm.typeErrorClass, "Cannot perform operation for instances of different classes.");
-                        break;
-                    }
-
-                    Value method;
-                    if (tableGet(&a->klass->methods, copyString("-", 1), &method)) {
-                        int argCount = 1;
-                        invokeCtx(ctx, copyString("-", 1), argCount, frame);
-                        frame = &ctx->frames[ctx->frameCount - 1];
-                        break;
-                    }
-                    runtimeErrorCtx(ctx, vm.typeErrorClass, "No overload of '-' for instances of class '%s'.", a->klass->name->chars);
+                    invokeOperatorCtx(ctx, OPERATOR_SUBTRACT);
+                    frame = &ctx->frames[ctx->frameCount - 1];
                     break;
                 }
                 BINARY_OP(NUMBER_VAL, -); break;
             case OP_MULTIPLY: {
                 if (IS_INSTANCE(peekCtx(ctx, 0)) && IS_INSTANCE(peekCtx(ctx, 1))) {
-                    ObjInstance* a = AS_INSTANCE(peekCtx(ctx, 0));
-                    ObjInstance* b = AS_INSTANCE(peekCtx(ctx, 1));
-
-                    if (a->klass != b->klass) {
-                        runtimeErrorCtx(ctx, vm.typeErrorClass, "Cannot perform operation for instances of different classes.");
-                        break;
-                    }
-
-                    Value method;
-                    if (tableGet(&a->klass->methods, copyString("*", 1), &method)) {
-                        int argCount = 1;
-                        invokeCtx(ctx, copyString("*", 1), argCount, frame);
-                        frame = &ctx->frames[ctx->frameCount - 1];
-                        break;
-                    }
-                    runtimeErrorCtx(ctx, vm.typeErrorClass, "No overload of '*' for instances of class '%s'.", a->klass->name->chars);
+                    invokeOperatorCtx(ctx, OPERATOR_MULTIPLY);
+                    frame = &ctx->frames[ctx->frameCount - 1];
                     break;
                 }
                 BINARY_OP(NUMBER_VAL, *); break;
             }
             case OP_DIVIDE:
                 if (IS_INSTANCE(peekCtx(ctx, 0)) && IS_INSTANCE(peekCtx(ctx, 1))) {
-                    ObjInstance* a = AS_INSTANCE(peekCtx(ctx, 0));
-                    ObjInstance* b = AS_INSTANCE(peekCtx(ctx, 1));
-
-                    if (a->klass != b->klass) {
-                        runtimeErrorCtx(ctx, vm.typeErrorClass, "Cannot perform operation for instances of different classes.");
-                        break;
-                    }
-
-                    Value method;
-                    if (tableGet(&a->klass->methods, copyString("/", 1), &method)) {
-                        int argCount = 1;
-                        invokeCtx(ctx, copyString("/", 1), argCount, frame);
-                        frame = &ctx->frames[ctx->frameCount - 1];
-                        break;
-                    }
-                    runtimeErrorCtx(ctx, vm.typeErrorClass, "No overload of '/' for instances of class '%s'.", a->klass->name->chars);
+                    invokeOperatorCtx(ctx, OPERATOR_DIVIDE);
+                    frame = &ctx->frames[ctx->frameCount - 1];
                     break;
                 }
                 BINARY_OP(NUMBER_VAL, /); break;
             case OP_MOD: {
                 if (IS_INSTANCE(peekCtx(ctx, 0)) && IS_INSTANCE(peekCtx(ctx, 1))) {
-                    ObjInstance* a = AS_INSTANCE(peekCtx(ctx, 0));
-                    ObjInstance* b = AS_INSTANCE(peekCtx(ctx, 1));
-
-                    if (a->klass != b->klass) {
-                        runtimeErrorCtx(ctx, vm.typeErrorClass, "Cannot perform operation for instances of different classes.");
-                        break;
-                    }
-
-                    Value method;
-                    if (tableGet(&a->klass->methods, copyString("-", 1), &method)) {
-                        int argCount = 1;
-                        invokeCtx(ctx, copyString("-", 1), argCount, frame);
-                        frame = &ctx->frames[ctx->frameCount - 1];
-                        break;
-                    }
-                    runtimeErrorCtx(ctx, vm.typeErrorClass, "No overload of '-' for instances of class '%s'.", a->klass->name->chars);
+                    invokeOperatorCtx(ctx, OPERATOR_MOD);
+                    frame = &ctx->frames[ctx->frameCount - 1];
                     break;
                 }
 
@@ -1331,22 +1891,8 @@ static void* runCtx(void *context) {
             }
             case OP_INS: {
                 if (IS_INSTANCE(peekCtx(ctx, 0)) && IS_INSTANCE(peekCtx(ctx, 1))) {
-                    ObjInstance* a = AS_INSTANCE(peekCtx(ctx, 0));
-                    ObjInstance* b = AS_INSTANCE(peekCtx(ctx, 1));
-
-                    if (a->klass != b->klass) {
-                        runtimeErrorCtx(ctx, vm.typeErrorClass, "Cannot perform operation for instances of different classes.");
-                        break;
-                    }
-
-                    Value method;
-                    if (tableGet(&a->klass->methods, copyString("-", 1), &method)) {
-                        int argCount = 1;
-                        invokeCtx(ctx, copyString("-", 1), argCount, frame);
-                        frame = &ctx->frames[ctx->frameCount - 1];
-                        break;
-                    }
-                    runtimeErrorCtx(ctx, vm.typeErrorClass, "No overload of '\' for instances of class '%s'.", a->klass->name->chars);
+                    invokeOperatorCtx(ctx, OPERATOR_INS);
+                    frame = &ctx->frames[ctx->frameCount - 1];
                     break;
                 }
 
@@ -1424,9 +1970,10 @@ static void* runCtx(void *context) {
                 Value value;
                 ObjInstance* instance = frame->receiver;
 
-                if(instance != NULL && (tableGet(&instance->fields, name, &value) || tableGet(&instance->klass->methods, name, &value))){
+                if(instance != NULL && (getField(instance, name, &value) || tableGet(&instance->klass->methods, name, &value))){
                     if(IS_BOUND_METHOD(value)){
                         AS_BOUND_METHOD(value)->receiver = OBJ_VAL(instance);
+                        WRITE_BARRIER(AS_BOUND_METHOD(value), OBJ_VAL(instance));
                     }
                 }
                 else if (!tableGet(&vm.globals, name, &value)) {
@@ -1444,6 +1991,12 @@ static void* runCtx(void *context) {
                 ObjInstance* instance = frame->receiver;
 
                 if (instance != NULL) {
+                    Value field;
+                    if (instance->klass->isStruct && getField(instance, name, &field)) {
+                        runtimeErrorCtx(ctx, vm.typeErrorClass, "Can't assign to field '%s' of struct '%s'.",
+                                        name->chars, instance->klass->name->chars);
+                        break;
+                    }
                     if (!tableSet(&instance->fields, name, value)) break;
                     tableDelete(&instance->fields, name);
 
@@ -1490,6 +2043,107 @@ static void* runCtx(void *context) {
                 tableSet(ctx->namespace, name, OBJ_VAL(uv));
                 break;
             }
+            case OP_FOR_ITER: {
+                uint8_t slot = READ_BYTE();
+                uint16_t exit = READ_SHORT();
+                uint16_t fallback = READ_SHORT();
+
+                switch (iterateCtx(ctx, frame->slots, slot)) {
+                    case ITER_DONE:   frame->ip += exit; break;
+                    case ITER_CUSTOM: frame->ip += fallback; break;
+                    default: break;
+                }
+                break;
+            }
+            case OP_FOR_STEP: {
+                uint8_t slot = READ_BYTE();
+                uint8_t kind = READ_BYTE();
+                uint16_t operand = READ_SHORT();
+                Value step = READ_CONSTANT();
+                uint8_t compare = READ_BYTE();
+                uint16_t body = READ_SHORT();
+                uint16_t increment = READ_SHORT();
+                Value* counter = &frame->slots[slot];
+                Value limit = NIL_VAL;
+
+                if (kind == 0) {
+                    limit = frame->slots[operand];
+                } else if (kind == 1) {
+                    limit = frame->closure->function->chunk.constants.values[operand];
+                } else if (frame->receiver == NULL) {
+                    ObjString* name = AS_STRING(frame->closure->function->chunk.constants.values[operand]);
+                    tableGet(&vm.globals, name, &limit);
+                }
+
+                // Anything but two numbers takes the generic increment and condition.
+                if (!IS_NUMBER(*counter) || !IS_NUMBER(limit)) {
+                    frame->ip -= increment;
+                    break;
+                }
+
+                double next = AS_NUMBER(*counter) + AS_NUMBER(step);
+                double bound = AS_NUMBER(limit);
+                *counter = NUMBER_VAL(next);
+
+                bool loops;
+                switch (compare) {
+                    case 0:  loops = next < bound; break;
+                    case 1:  loops = !(next > bound); break;
+                    case 2:  loops = next > bound; break;
+                    default: loops = !(next < bound); break;
+                }
+                if (loops) BACKEDGE(body);
+                break;
+            }
+            case OP_RANGE: {
+                if (!IS_NUMBER(peekCtx(ctx, 0)) || !IS_NUMBER(peekCtx(ctx, 1))) {
+                    runtimeErrorCtx(ctx, vm.typeErrorClass, "Range bounds must be numbers.");
+                    break;
+                }
+                double end = AS_NUMBER(popCtx(ctx));
+                double start = AS_NUMBER(popCtx(ctx));
+                pushCtx(ctx, OBJ_VAL(newRange(start, end, 1)));
+                break;
+            }
+            case OP_SWITCH_TABLE: {
+                double base = AS_NUMBER(READ_CONSTANT());
+                uint16_t count = READ_SHORT();
+                uint8_t* entry = frame->ip;
+                uint8_t* end = frame->ip + 2 + count * 2;
+                Value value = popCtx(ctx);
+
+                if (IS_NUMBER(value)) {
+                    double index = AS_NUMBER(value) - base;
+                    if (index >= 0 && index < count && index == (int)index)
+                        entry = frame->ip + 2 + (int)index * 2;
+                }
+
+                frame->ip = end - (uint16_t)((entry[0] << 8) | entry[1]);
+                break;
+            }
+            case OP_SWITCH_HASH: {
+                uint16_t capacity = READ_SHORT();
+                uint8_t* entry = frame->ip;
+                uint8_t* slots = frame->ip + 2;
+                uint8_t* end = slots + capacity * 4;
+                Value value = popCtx(ctx);
+                Value* constants = frame->closure->function->chunk.constants.values;
+
+                uint32_t slot = switchKeyHash(value) & (capacity - 1);
+                for (;;) {
+                    uint8_t* key = slots + slot * 4;
+                    uint16_t constant = (uint16_t)((key[0] << 8) | key[1]);
+                    if (constant == SWITCH_EMPTY_SLOT) break;
+                    if (switchKeyMatches(constants[constant], value)) {
+                        entry = key + 2;
+                        break;
+                    }
+                    slot = (slot + 1) & (capacity - 1);
+                }
+
+                frame->ip = end - (uint16_t)((entry[0] << 8) | entry[1]);
+                break;
+            }
             case OP_JUMP_IF_FALSE: {
                 uint16_t offset = READ_SHORT();
                 if (isFalsey(peekCtx(ctx, 0))) frame->ip += offset;
@@ -1502,7 +2156,7 @@ static void* runCtx(void *context) {
             }
             case OP_LOOP: {
                 uint16_t offset = READ_SHORT();
-                frame->ip -= offset;
+                BACKEDGE(offset);
                 break;
             }
             case OP_CALL: {
@@ -1512,6 +2166,19 @@ static void* runCtx(void *context) {
                     break;
                 }
                 frame = &ctx->frames[ctx->frameCount - 1];
+                JIT_ENTER();
+                break;
+            }
+            case OP_TAIL_CALL: {
+                int argCount = READ_BYTE();
+                int frameCount = ctx->frameCount;
+
+                if (!callValueCtx(ctx, peekCtx(ctx, argCount), argCount)) {
+                    break;
+                }
+                tailCallCtx(ctx, frameCount);
+                frame = &ctx->frames[ctx->frameCount - 1];
+                JIT_ENTER();
                 break;
             }
             case OP_CLOSURE: {
@@ -1538,7 +2205,9 @@ static void* runCtx(void *context) {
             }
             case OP_SET_UPVALUE: {
                 uint8_t slot = READ_BYTE();
-                *frame->closure->upvalues[slot]->location = peekCtx(ctx, 0);
+                ObjUpvalue* upvalue = frame->closure->upvalues[slot];
+                *upvalue->location = peekCtx(ctx, 0);
+                WRITE_BARRIER(upvalue, peekCtx(ctx, 0));
                 break;
             }
             case OP_CLOSE_UPVALUE:
@@ -1557,63 +2226,24 @@ static void* runCtx(void *context) {
                 if (name == vm.illegalArgumentsErrorString) vm.illegalArgumentsErrorClass = klass;
                 if (name == vm.lookUpErrorString) vm.lookUpErrorClass = klass;
                 if (name == vm.formatErrorString) vm.formatErrorClass = klass;
+                if (name == vm.memoryErrorString) vm.memoryErrorClass = klass;
 
                 if (name == copyString("Window", 6)) {
-                    tableSet(&klass->staticMethods, copyString("init", 4),       OBJ_VAL(newNative(window_init)));
-                    tableSet(&klass->staticMethods, copyString("clear", 5),      OBJ_VAL(newNative(window_clear)));
-                    tableSet(&klass->staticMethods, copyString("drawRect", 8),   OBJ_VAL(newNative(window_drawRect)));
-                    tableSet(&klass->staticMethods, copyString("update", 6),     OBJ_VAL(newNative(window_update)));
-                    tableSet(&klass->staticMethods, copyString("pollEvent", 9),  OBJ_VAL(newNative(window_pollEvent)));
-                    tableSet(&klass->staticMethods, copyString("getMousePos", 11),   OBJ_VAL(newNative(window_getMousePosition)));
-                    tableSet(&klass->staticMethods, copyString("drawCircle", 10),OBJ_VAL(newNative(window_drawCircle)));
-                    tableSet(&klass->staticMethods, copyString("drawImage", 9),   OBJ_VAL(newNative(window_drawImage)));
-                    tableSet(&klass->staticMethods, copyString("loadImage", 9),   OBJ_VAL(newNative(window_loadImage)));
-                    tableSet(&klass->staticMethods, copyString("exit", 4),        OBJ_VAL(newNative(window_exit)));
-                    tableSet(&klass->staticMethods, copyString("drawLine", 8),        OBJ_VAL(newNative(window_drawLine)));
-                    tableSet(&klass->staticMethods, copyString("drawTrig", 8),        OBJ_VAL(newNative(window_drawTriangle)));
-                    tableSet(&klass->staticMethods, copyString("drawText", 8),    OBJ_VAL(newNative(window_drawText)));
+                    defineNatives(&klass->staticMethods, windowNatives);
                 }
 
                 if (name == copyString("Math", 4)) {
-                    Table* staticMethods = &klass->staticMethods;
-                    tableSet(staticMethods, copyString("abs", 3), OBJ_VAL(newNative(math_abs)));
-                    tableSet(staticMethods, copyString("min", 3), OBJ_VAL(newNative(math_min)));
-                    tableSet(staticMethods, copyString("max", 3), OBJ_VAL(newNative(math_max)));
-                    tableSet(staticMethods, copyString("clamp", 5), OBJ_VAL(newNative(math_clamp)));
-                    tableSet(staticMethods, copyString("sign", 4), OBJ_VAL(newNative(math_sign)));
-
-                    tableSet(staticMethods, copyString("pow", 3), OBJ_VAL(newNative(math_pow)));
-                    tableSet(staticMethods, copyString("sqrt", 4), OBJ_VAL(newNative(math_sqrt)));
-                    tableSet(staticMethods, copyString("cbrt", 4), OBJ_VAL(newNative(math_cbrt)));
-
-                    tableSet(staticMethods, copyString("exp", 3), OBJ_VAL(newNative(math_exp)));
-                    tableSet(staticMethods, copyString("log", 3), OBJ_VAL(newNative(math_log)));
-                    tableSet(staticMethods, copyString("log10", 5), OBJ_VAL(newNative(math_log10)));
-
-                    tableSet(staticMethods, copyString("sin", 3), OBJ_VAL(newNative(math_sin)));
-                    tableSet(staticMethods, copyString("cos", 3), OBJ_VAL(newNative(math_cos)));
-                    tableSet(staticMethods, copyString("tan", 3), OBJ_VAL(newNative(math_tan)));
-                    tableSet(staticMethods, copyString("asin", 4), OBJ_VAL(newNative(math_asin)));
-                    tableSet(staticMethods, copyString("acos", 4), OBJ_VAL(newNative(math_acos)));
-                    tableSet(staticMethods, copyString("atan", 4), OBJ_VAL(newNative(math_atan)));
-                    tableSet(staticMethods, copyString("atan2", 5), OBJ_VAL(newNative(math_atan2)));
-
-                    tableSet(staticMethods, copyString("floor", 5), OBJ_VAL(newNative(math_floor)));
-                    tableSet(staticMethods, copyString("ceil", 4), OBJ_VAL(newNative(math_ceil)));
-                    tableSet(staticMethods, copyString("round", 5), OBJ_VAL(newNative(math_round)));
-                    tableSet(staticMethods, copyString("trunc", 5), OBJ_VAL(newNative(math_trunc)));
-
-                    tableSet(staticMethods, copyString("mod", 3), OBJ_VAL(newNative(math_mod)));
-                    tableSet(staticMethods, copyString("lerp", 4), OBJ_VAL(newNative(math_lerp)));
+                    vm.mathClass = klass;
+                    defineNatives(&klass->staticMethods, mathNatives);
                 }
 
-
                 pushCtx(ctx, OBJ_VAL(klass));
                 break;
             case OP_GET_PROPERTY: {
                 ObjInstance* instance = NULL;
                 if (IS_STRING(peekCtx(ctx, 0))) instance = AS_STRING(peekCtx(ctx, 0))->instance;
-                if (IS_LIST(peekCtx(ctx, 0))) instance = AS_LIST(peekCtx(ctx, 0))->instance;
+                if (IS_LIST(peekCtx(ctx, 0))) instance = ((ObjList*)AS_OBJ(peekCtx(ctx, 0)))->instance;
+                if (IS_RANGE(peekCtx(ctx, 0))) instance = AS_RANGE(peekCtx(ctx, 0))->instance;
                 if (IS_THREAD(peekCtx(ctx, 0))) instance = AS_THREAD(peekCtx(ctx, 0))->instance;
                 if (IS_IMAGE(peekCtx(ctx, 0))) instance = AS_IMAGE(peekCtx(ctx, 0))->instance;
 
@@ -1672,7 +2302,7 @@ static void* runCtx(void *context) {
                     }
                     
                     Value value;
-                    if (tableGet(&instance->fields, name, &value)) {
+                    if (getField(instance, name, &value)) {
                         popCtx(ctx);
                         pushCtx(ctx, value);
                         break;
@@ -1760,7 +2390,8 @@ static void* runCtx(void *context) {
 
                 ObjInstance* instance = NULL;
                 if (IS_STRING(peekCtx(ctx, 1))) instance = AS_STRING(peekCtx(ctx, 1))->instance;
-                if (IS_LIST(peekCtx(ctx, 1))) instance = AS_LIST(peekCtx(ctx, 1))->instance;
+                if (IS_LIST(peekCtx(ctx, 1))) instance = ((ObjList*)AS_OBJ(peekCtx(ctx, 1)))->instance;
+                if (IS_RANGE(peekCtx(ctx, 1))) instance = AS_RANGE(peekCtx(ctx, 1))->instance;
                 if (IS_THREAD(peekCtx(ctx, 1))) instance = AS_THREAD(peekCtx(ctx, 1))->instance;
                 if (IS_IMAGE(peekCtx(ctx, 1))) instance = AS_IMAGE(peekCtx(ctx, 1))->instance;
                 if (IS_INSTANCE(peekCtx(ctx, 1))) instance = AS_INSTANCE(peekCtx(ctx, 1));
@@ -1768,6 +2399,11 @@ static void* runCtx(void *context) {
                     runtimeErrorCtx(ctx, vm.typeErrorClass, "Only instances have fields.");
                     break;
                 }
+                if (instance->klass->isStruct) {
+                    frame = runtimeErrorCtx(ctx, vm.typeErrorClass, "Can't assign to field '%s' of struct '%s'.",
+                                            READ_STRING()->chars, instance->klass->name->chars);
+                    break;
+                }
 
                 tableSet(&instance->fields, READ_STRING(), peekCtx(ctx, 0));
                 Value value = popCtx(ctx);
@@ -1786,6 +2422,116 @@ static void* runCtx(void *context) {
                 }
                 //popCtx(ctx);
                 frame = &ctx->frames[ctx->frameCount - 1];
+                JIT_ENTER();
+                break;
+            }
+            case OP_TAIL_INVOKE: {
+                ObjString* method = READ_STRING();
+                int argCount = READ_BYTE();
+                int frameCount = ctx->frameCount;
+                if (!invokeCtx(ctx, method, argCount, frame)) {
+                    break;
+                }
+                tailCallCtx(ctx, frameCount);
+                frame = &ctx->frames[ctx->frameCount - 1];
+                JIT_ENTER();
+                break;
+            }
+            case OP_MATH: {
+                ObjString* method = READ_STRING();
+                int argCount = READ_BYTE();
+                int id = READ_BYTE();
+                if (mathCtx(ctx, id, argCount)) break;
+                if (!invokeCtx(ctx, method, argCount, frame)) {
+                    break;
+                }
+                frame = &ctx->frames[ctx->frameCount - 1];
+                JIT_ENTER();
+                break;
+            }
+            case OP_INLINE_GUARD: {
+                int argCount = READ_BYTE();
+                ObjFunction* function = AS_FUNCTION(READ_CONSTANT());
+                uint16_t offset = READ_SHORT();
+                if (!inlineGuardCtx(ctx, function, argCount)) frame->ip += offset;
+                break;
+            }
+            case OP_INLINE_INVOKE_GUARD: {
+                int argCount = READ_BYTE();
+                ObjString* name = READ_STRING();
+                ObjFunction* function = AS_FUNCTION(READ_CONSTANT());
+                uint16_t offset = READ_SHORT();
+                if (!inlineInvokeGuardCtx(ctx, name, function, argCount)) frame->ip += offset;
+                break;
+            }
+            case OP_PEEK:
+                pushCtx(ctx, peekCtx(ctx, READ_BYTE()));
+                break;
+            case OP_RETURN_VALUES: {
+                int count = READ_BYTE();
+                closeUpvaluesCtx(ctx, frame->slots);
+                ctx->frameCount--;
+                CallFrame* caller = ctx->frameCount > 0 ? &ctx->frames[ctx->frameCount - 1] : NULL;
+                returnValuesTo(ctx, caller, frame->slots, count);
+                if (caller == NULL) return nullptr;
+
+                frame = caller;
+                JIT_ENTER();
+                break;
+            }
+            case OP_UNPACK: {
+                // Calls that return several values skip this, so here the
+                // value must be a list with one element per variable.
+                int count = READ_BYTE();
+                Value value = peekCtx(ctx, 0);
+                if (!IS_LIST(value) || AS_LIST(value)->elements.count != count) {
+                    frame = runtimeErrorCtx(ctx, vm.typeErrorClass, "Can only unpack a list of %d values.", count);
+                    break;
+                }
+
+                ObjList* list = AS_LIST(popCtx(ctx));
+                for (int i = 0; i < count; i++) pushCtx(ctx, list->elements.values[i]);
+                break;
+            }
+            case OP_INLINE_RETURN: {
+                int argCount = READ_BYTE();
+                Value result = popCtx(ctx);
+                ctx->stackTop -= argCount + 1;
+                pushCtx(ctx, result);
+                break;
+            }
+            case OP_FIELD: {
+                // Follows OP_CLASS once per field of a struct.
+                ObjClass* klass = AS_CLASS(peekCtx(ctx, 0));
+                klass->fieldNames = GROW_ARRAY(ObjString*, klass->fieldNames,
+                                               klass->fieldCount, klass->fieldCount + 1);
+                klass->fieldNames[klass->fieldCount++] = READ_STRING();
+                WRITE_BARRIER_OBJ(klass, klass->fieldNames[klass->fieldCount - 1]);
+                klass->isStruct = true;
+                break;
+            }
+            case OP_SINK: {
+                ObjString* name = READ_STRING();
+                uint8_t count = READ_BYTE();
+                // Skips the OP_CALL and the padding after it.
+                if (sinkCtx(ctx, name, count)) frame->ip += 3 + count;
+                break;
+            }
+            case OP_GET_SUNK: {
+                uint8_t slot = READ_BYTE();
+                uint8_t count = READ_BYTE();
+                uint8_t field = READ_BYTE();
+                Value* sunk = &frame->slots[slot];
+                // False when OP_SINK left the value to the call, which the
+                // generic read after this one finds in the slot.
+                if (!AS_BOOL(sunk[count + 1])) break;
+                if (field > 0) {
+                    pushCtx(ctx, sunk[field]);
+                    frame->ip += 5;
+                } else {
+                    buildSunkCtx(ctx, sunk, count);
+                    frame->ip += 2;
+                }
                 break;
             }
             case OP_INHERIT: {
@@ -1796,10 +2542,15 @@ static void* runCtx(void *context) {
 
                 ObjClass* superclass = AS_CLASS(peekCtx(ctx, 1));
                 ObjClass* subclass = AS_CLASS(peekCtx(ctx, 0));
+                if (superclass->isStruct) {
+                    runtimeErrorCtx(ctx, vm.typeErrorClass, "Can't inherit from struct '%s'.", superclass->name->chars);
+                    break;
+                }
                 //tableAddAll(&AS_CLASS(superclass)->methods,
                 //            &subclass->methods);
 
                 subclass->superclass = superclass;
+                WRITE_BARRIER_OBJ(subclass, superclass);
                 for (int i = 0; i < superclass->methods.capacity; i++) {
                     Entry* entry = &superclass->methods.entries[i];
                     if (entry == NULL) continue;
@@ -1813,6 +2564,9 @@ static void* runCtx(void *context) {
                     }
 
                     tableSet(&subclass->methods, entry->key, OBJ_VAL(md));
+                    int kind = operatorKind(entry->key);
+                    if (kind != -1) subclass->operators[kind] = md;
+                    WRITE_BARRIER_OBJ(subclass, md);
                 }
 
                 popCtx(ctx); // Subclass.
@@ -1835,12 +2589,37 @@ static void* runCtx(void *context) {
                     break;
                 }
                 frame = &ctx->frames[ctx->frameCount - 1];
+                JIT_ENTER();
                 break;
             }
             case OP_GET_INDEX: {
+                if (*frame->ip == OP_GET_PROPERTY) {
+                    Value value;
+                    uint8_t* property = frame->ip++;
+                    if (getPackedField(peekCtx(ctx, 1), peekCtx(ctx, 0), READ_STRING(), &value)) {
+                        ctx->stackTop -= 2;
+                        pushCtx(ctx, value);
+                        break;
+                    }
+                    frame->ip = property;
+                }
+
                 Value index = popCtx(ctx);
                 Value list = popCtx(ctx);
 
+                if (IS_RANGE(list) && IS_NUMBER(index)) {
+                    ObjRange* range = AS_RANGE(list);
+                    int i = (int)AS_NUMBER(index);
+
+                    if (i < 0 || i >= range->length) {
+                        runtimeErrorCtx(ctx, vm.indexErrorClass, "Range index out of bounds.");
+                        break;
+                    }
+
+                    pushCtx(ctx, NUMBER_VAL(range->start + i * range->step));
+                    break;
+                }
+
                 if (!IS_LIST(list)) {
                     runtimeErrorCtx(ctx, vm.typeErrorClass, "Can only index into lists.");
                     break;
@@ -1878,15 +2657,20 @@ static void* runCtx(void *context) {
                     break;
                 }
 
-                ObjList* objList = AS_LIST(list);
                 int i = (int)AS_NUMBER(index);
+                if (setPacked((ObjList*)AS_OBJ(list), i, value)) {
+                    pushCtx(ctx, value);
+                    break;
+                }
 
+                ObjList* objList = AS_LIST(list);
                 if (i < 0 || i >= objList->elements.count) {
                     runtimeErrorCtx(ctx, vm.indexErrorClass, "List index out of bounds.");
                     break;
                 }
 
                 objList->elements.values[i] = value;
+                ARRAY_BARRIER(&objList->elements, value);
                 pushCtx(ctx, value);
                 break;
             }
@@ -1960,6 +2744,8 @@ static void* runCtx(void *context) {
                 ObjString* name = READ_STRING();
 
                 AS_CLOSURE(method)->klass = klass;
+                WRITE_BARRIER_OBJ(AS_CLOSURE(method), klass);
+                if (klass == vm.mathClass) vm.mathClass = NULL;
 
                 Value dispatcher;
                 if (tableGet(&klass->staticMethods, name, &dispatcher)) {
@@ -1996,7 +2782,10 @@ static void* runCtx(void *context) {
                     return nullptr;
                 }
 
-                throwRuntimeErrorCtx(ctx, instance); // a function you'll define
+                // The handler may be in a caller, and hasError only
+                // signals natives, so reload the frame and clear it.
+                frame = throwRuntimeErrorCtx(ctx, instance);
+                ctx->hasError = false;
                 break;
             }
             case OP_NAMESPACE:{
@@ -2005,8 +2794,12 @@ static void* runCtx(void *context) {
 
                 ObjNamespace* namespace = newNamespace(name);
 
+                // Stays on the stack while the body runs, so its table
+                // survives any collection in between.
+                pushCtx(ctx, OBJ_VAL(namespace));
                 joinInternal(spawnNamespace(closure, namespace));
                 popCtx(ctx);
+                popCtx(ctx);
                 pushCtx(ctx, OBJ_VAL(namespace));
 
                 break;
@@ -2029,6 +2822,11 @@ static void* runCtx(void *context) {
                     pushCtx(ctx, BOOL_VAL(true));
                     break;
                 }
+
+                if(AS_CLASS(right) == vm.rangeClass && IS_RANGE(left)){
+                    pushCtx(ctx, BOOL_VAL(true));
+                    break;
+                }
                 
                 if(AS_CLASS(right) == vm.numberClass && IS_NUMBER(left)){
                     pushCtx(ctx, BOOL_VAL(true));
@@ -2079,7 +2877,11 @@ InterpretResult callFunction(ObjFunction* function) {
 InterpretResult interpretBootStrapped(const char* source){
     Value args;
     tableGet(&vm.globals, copyString("argv", 4), &args);
-    writeValueArray(&AS_LIST(args)->elements, OBJ_VAL(newString(source, strlen(source))));
+    // The string owns its characters, and the caller frees the source.
+    int length = (int)strlen(source);
+    char* chars = ALLOCATE_ATOMIC(char, length + 1);
+    memcpy(chars, source, length + 1);
+    writeValueArray(&AS_LIST(args)->elements, OBJ_VAL(newString(chars, length)));
     
     callFunction(vm.sourceCompiler);
     AS_LIST(args)->elements.count--;
@@ -2100,7 +2902,7 @@ InterpretResult interpret(const char* source) {
     
     if (vm.noRun) {
         size_t len = strlen(vm.path);
-        char* filename = GC_MALLOC(len + 2);     // +1 for 'c', +1 for '\0'
+        char* filename = ALLOCATE_ATOMIC(char, len + 2);     // +1 for 'c', +1 for '\0'
         strcpy(filename, vm.path);             // copy original filename
         filename[len] = 'c';                   // append 'c'
         filename[len + 1] = '\0';
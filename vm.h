@@ -18,6 +18,10 @@ typedef struct ObjClass ObjClass;
 // ---------------------
 #define FRAMES_MAX 1000
 #define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+// Small objects are cached per thread in 16-byte size classes.
+#define OBJECT_CACHE_GRANULE 16
+#define OBJECT_CACHE_CLASSES 8
+#define NATIVE_MAX_RETURNS 8
 
 typedef struct {
     ObjClosure* closure;
@@ -46,6 +50,19 @@ typedef struct Thread {
     struct ObjUpvalue* openUpvalues; // forward-declared elsewhere
     bool hasError;
     bool finished;
+
+    // Values a native hands back through returnValuesCtx().
+    Value returnValues[NATIVE_MAX_RETURNS];
+    int returnCount;
+
+    // Set by an allocation that crossed a heap quota.
+    bool quotaCheck;
+
+#ifndef PRECISE_GC
+    // Free lists of small objects, one per size class. They live here
+    // rather than in thread-local storage so the collector sees them.
+    void* objectCache[OBJECT_CACHE_CLASSES];
+#endif
 } Thread;
 
 // ---------------------
@@ -74,10 +91,12 @@ typedef struct {
 
     ObjClass* stringClass;
     ObjClass* listClass;
+    ObjClass* rangeClass;
     ObjClass* imageClass;
     ObjClass* threadClass;
     ObjClass* numberClass;
     ObjClass* boolClass;
+    ObjClass* mathClass;   // The class OP_MATH stands in for, NULL once redefined.
 
     ObjString* errorString;
     ObjClass* errorClass;
@@ -95,6 +114,8 @@ typedef struct {
     ObjClass* lookUpErrorClass;
     ObjString* formatErrorString;
     ObjClass* formatErrorClass;
+    ObjString* memoryErrorString;
+    ObjClass* memoryErrorClass;
 
 
     const char* path;
@@ -105,6 +126,12 @@ typedef struct {
     bool repl;
     bool hasError;
     bool zip;
+    bool jit;
+    bool profileHot;
+    bool profileHeap;
+    // Set by an allocation that filled the nursery. Threads check it at
+    // backedges and calls and stop there for the collection.
+    atomic_bool gcRequested;
 
 } VM;
 
@@ -131,6 +158,7 @@ void push(Value value);
 Value pop();
 void printStack();
 CallFrame* runtimeErrorCtx(Thread*, ObjClass*, const char* format, ...);
+Value returnValuesCtx(Thread* ctx, int count, Value* values);
 
 Value spawnNative(Thread* ctx, int argCount, Value* args);
 Value joinNative(Thread* ctx, int argCount, Value* args);
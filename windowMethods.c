@@ -456,11 +456,8 @@ Value window_getMousePosition(Thread* ctx, int argCount, Value* args) {
     int x, y;
     SDL_GetMouseState(&x, &y);
 
-    ObjList* list = newList();
-    writeValueArray(&list->elements, NUMBER_VAL(x));
-    writeValueArray(&list->elements, NUMBER_VAL(y));
-
-    return OBJ_VAL(list);
+    // `var x, y = Window.getMousePos();` takes these without a list.
+    return returnValuesCtx(ctx, 2, (Value[]){NUMBER_VAL(x), NUMBER_VAL(y)});
 }
 
 Value window_drawCircle(Thread* ctx, int argCount, Value* args) {